@@ -7,6 +7,7 @@
 #include "Client.hpp"
 #include "../common/network/Utils.hpp"
 #include "../common/network/Command.hpp"
+#include "../common/network/ServerInfo.hpp"
 #include "../common/Logger.hpp"
 #include "version.hpp"
 
@@ -109,7 +110,7 @@ Client::Client(const std::string& host,
                                             session->udp_port()
                                     ));
 							
-							session->Send(network::ServerRequestedFullServerInfo());
+							session->Send(network::ServerRequestedFullServerInfo(SERVER_INFO_FORMAT_VERSION));
                         }
                     }
                     break;
@@ -170,6 +171,15 @@ Client::Client(const std::string& host,
                     }
                     break;
 
+                    // 往復遅延の計測要求にはすぐに応答する
+                    case network::header::ClientRequestedPing:
+                    {
+                        if (auto session = c.session().lock()) {
+                            session->Send(ServerReceivePong(Utils::Deserialize<uint32_t>(c.body())));
+                        }
+                    }
+                    return;
+
                     // 通信量制限
                     case network::header::ClientReceiveWriteAverageLimitUpdate:
                     {
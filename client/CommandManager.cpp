@@ -10,11 +10,29 @@
 #include "../common/Logger.hpp"
 #include "Client.hpp"
 #include "../common/network/Utils.hpp"
+#include "../common/network/ServerInfo.hpp"
 #include "Profiler.hpp"
 
+namespace {
+	// 全体へのメッセージにサーバーが付けるシーケンス番号 ("seq":"123") を取り出す
+	uint32_t GetChatSequence(const std::string& info_json)
+	{
+		static const std::string key = "\"seq\":\"";
+		auto pos = info_json.find(key);
+		if (pos == std::string::npos) {
+			return 0;
+		}
+		return static_cast<uint32_t>(strtoul(info_json.c_str() + pos + key.size(), nullptr, 10));
+	}
+}
+
 CommandManager::CommandManager(const ManagerAccessorPtr& manager_accessor) :
 	manager_accessor_(manager_accessor),
-	status_(STATUS_STANDBY)
+	status_(STATUS_STANDBY),
+	server_time_(0),
+	account_cursor_(0),
+	chat_channel_(0),
+	chat_sequence_(0)
 {
 }
 
@@ -27,10 +45,26 @@ void CommandManager::Update()
         auto command = client_->PopCommand();
 
 		// 移動コマンドが溜まっている場合は強制的に消費
+		// 差分の基準値がずれないよう、スナップショットは復号だけして最新の位置を反映する
 		if (client_->GetCommandSize() > 40) {
-			while (command && command->header() == network::header::ClientUpdatePlayerPosition) {
+			std::map<uint32_t, PlayerPosition> latest;
+			while (command && (command->header() == network::header::ClientUpdatePlayerPosition ||
+				command->header() == network::header::ClientUpdatePlayerPositionSnapshot)) {
+				if (command->header() == network::header::ClientUpdatePlayerPositionSnapshot) {
+					std::vector<network::UserPosition> positions;
+					DecodePositionSnapshot(*command, &positions);
+					BOOST_FOREACH(const auto& item, positions) {
+						latest[item.first] = item.second;
+					}
+				}
 				command = client_->PopCommand();
 			}
+
+			if (auto player_manager = manager_accessor_->player_manager().lock()) {
+				BOOST_FOREACH(const auto& item, latest) {
+					player_manager->UpdatePlayerPosition(item.first, item.second);
+				}
+			}
 		}
 		
 		if (command) {
@@ -56,7 +90,7 @@ void CommandManager::FetchCommand(const network::Command& command)
 	{
 		const std::string& data = account_manager->GetSerializedData();
 		if (data.size() > 0) {
-			client_->Write(network::ServerReceiveAccountInitializeData(data));
+			client_->Write(network::ServerReceiveAccountInitializeData(data, account_cursor_));
 		}
 	}
 		break;
@@ -88,44 +122,32 @@ void CommandManager::FetchCommand(const network::Command& command)
 	// サーバーデータ受信
 	case ClientReceiveFullServerInfo:
 	{
-		using namespace boost::property_tree;
 		std::string buffer;
 		network::Utils::Deserialize(command.body(), &buffer);
-		std::stringstream stream(buffer);
-		ptree pt;
-		try {
-			boost::archive::text_iarchive ia(stream);
-			ia >> pt;
-		} catch (std::exception& e) {
-			Logger::Error(_T("%s"), unicode::ToTString(e.what()));
+
+		// バイナリ形式に対応していないサーバーからはtext_archive形式で届く
+		network::ServerInfo info;
+		if (!info.Parse(buffer)) {
+			Logger::Error(_T("Invalid server info"));
 		}
 
-		auto channels = pt.get_child("channels", ptree());
-		BOOST_FOREACH(const auto& channel, channels) {
+		BOOST_FOREACH(const auto& channel, info.channels) {
 			auto ptr = std::make_shared<Channel>();
-			auto id = boost::lexical_cast<int>(channel.first.substr(2));
-			ptr->name = channel.second.get<std::string>("name");
-			ptr->stage = channel.second.get<std::string>("stage");
-
-			auto warp_points = channel.second.get_child("warp_points", ptree());
-			BOOST_FOREACH(const auto& warp_point, warp_points) {
-				auto channel = warp_point.second.get<unsigned char>("channel", 0);
-				auto x = warp_point.second.get<float>("position.x", 0);
-				auto y = warp_point.second.get<float>("position.y", 0);
-				auto z = warp_point.second.get<float>("position.z", 0);
+			ptr->name = channel.name;
+			ptr->stage = channel.stage;
 
+			BOOST_FOREACH(const auto& warp_point, channel.warp_points) {
 				std::shared_ptr<VECTOR> destination;
-				if (!warp_point.second.get_child("destination", ptree()).empty()) {
-					auto dest_x = warp_point.second.get<float>("destination.x", 0);
-					auto dest_y = warp_point.second.get<float>("destination.y", 0);
-					auto dest_z = warp_point.second.get<float>("destination.z", 0);
-					destination = std::make_shared<VECTOR>(VGet(dest_x, dest_y, dest_z));
+				if (warp_point.has_destination) {
+					destination = std::make_shared<VECTOR>(
+						VGet(warp_point.dest_x, warp_point.dest_y, warp_point.dest_z));
 				}
-				Channel::WarpPoint point = {VGet(x, y, z), channel, "", destination};
+				Channel::WarpPoint point = {VGet(warp_point.x, warp_point.y, warp_point.z),
+					warp_point.channel, "", destination};
 
 				ptr->warp_points.push_back(point);
 			}
-			channels_[id] = ptr;
+			channels_[channel.id] = ptr;
 		}
 
 		// 存在しない・ステージデータがないチャンネルへのワープポイントを削除
@@ -161,14 +183,46 @@ void CommandManager::FetchCommand(const network::Command& command)
 	break;
 
 	case ClientReceiveJSON:
-	// case ClientReceiveChatLog:
 	{
 		std::string info_json, msg_json;
 		network::Utils::Deserialize(command.body(), &info_json, &msg_json);
 
 		Logger::Info(_T("Receive JSON: %s %s"), unicode::ToTString(info_json), unicode::ToTString(msg_json));
 
-		card_manager->OnReceiveJSON(info_json, msg_json);
+		// 再接続時に、受信済みのメッセージの続きから履歴を取得する
+		if (auto sequence = GetChatSequence(info_json)) {
+			if (player_manager) {
+				if (auto myself = player_manager->GetMyself()) {
+					chat_channel_ = myself->channel();
+				}
+			}
+			chat_sequence_ = sequence;
+		}
+
+		if (card_manager) {
+			card_manager->OnReceiveJSON(info_json, msg_json);
+		}
+	}
+		break;
+
+	// チャット履歴 (参加時にまとめて受信)
+	case ClientReceiveChatLog:
+	{
+		uint32_t size;
+		std::string data;
+		network::Utils::Deserialize(command.body(), &chat_channel_, &chat_sequence_, &size, &data);
+
+		std::string buffer;
+		if (size > 0) {
+			buffer = network::Utils::LZ4Uncompress(data, size);
+		}
+		while (!buffer.empty()) {
+			std::string info_json, msg_json;
+			buffer.erase(0, network::Utils::Deserialize(buffer, &info_json, &msg_json));
+			if (card_manager) {
+				card_manager->OnReceiveJSON(info_json, msg_json);
+			}
+		}
 	}
 		break;
 
@@ -185,6 +239,34 @@ void CommandManager::FetchCommand(const network::Command& command)
 	}
 		break;
 
+	// プレイヤー位置更新 (ティックごとにまとめて受信)
+	case ClientUpdatePlayerPositionSnapshot:
+	{
+		std::vector<network::UserPosition> positions;
+		DecodePositionSnapshot(command, &positions);
+
+		if (player_manager) {
+			BOOST_FOREACH(const auto& item, positions) {
+				player_manager->UpdatePlayerPosition(item.first, item.second);
+			}
+		}
+	}
+		break;
+
+	// 関心範囲から出たプレイヤーを消す
+	case ClientLeaveInterestRange:
+	{
+		if (player_manager) {
+			std::string buffer = network::Utils::Deserialize<std::string>(command.body());
+			while (buffer.size() >= sizeof(uint32_t)) {
+				uint32_t user_id;
+				buffer.erase(0, network::Utils::Deserialize(buffer, &user_id));
+				player_manager->HidePlayer(user_id);
+			}
+		}
+	}
+		break;
+
 	case ClientReceiveAccountRevisionUpdateNotify:
 	{
 		if (player_manager) {
@@ -203,6 +285,42 @@ void CommandManager::FetchCommand(const network::Command& command)
 	}
 		break;
 
+	// ティックごとにまとめた更新通知
+	case ClientReceiveAccountRevisionUpdateNotifyBatch:
+	{
+		if (player_manager) {
+			std::string buffer = network::Utils::Deserialize<std::string>(command.body());
+			while (!buffer.empty()) {
+				uint32_t user_id;
+				uint32_t server_revision;
+				buffer.erase(0, network::Utils::Deserialize(buffer, &user_id, &server_revision));
+
+				auto current_revision = player_manager->GetCurrentUserRevision(user_id);
+				if (server_revision > current_revision) {
+					client_->Write(network::ServerRequestedAccountRevisionPatch(user_id, current_revision));
+				}
+			}
+		}
+	}
+		break;
+
+	// ティックごとにまとめた更新データ
+	case ClientReceiveAccountRevisionPatchBatch:
+	{
+		if (player_manager) {
+			std::string buffer;
+			network::Utils::Deserialize(command.body(), &account_cursor_, &buffer);
+			while (!buffer.empty()) {
+				std::string patch;
+				buffer.erase(0, network::Utils::Deserialize(buffer, &patch));
+				if (!patch.empty()) {
+					player_manager->ApplyRevisionPatch(patch);
+				}
+			}
+		}
+	}
+		break;
+
 	case ClientReceiveAccountRevisionPatch:
 	{
 		Logger::Info(_T("Receive account database update data"));
@@ -212,6 +330,37 @@ void CommandManager::FetchCommand(const network::Command& command)
 	}
 		break;
 
+	// 参加時のスナップショット (全ユーザーの情報と同じチャンネルの位置)
+	case ClientReceiveWorldSnapshot:
+	{
+		std::string patches, position_data;
+		network::Utils::Deserialize(command.body(), &account_cursor_, &patches, &position_data);
+
+		if (player_manager) {
+			while (!patches.empty()) {
+				std::string patch;
+				patches.erase(0, network::Utils::Deserialize(patches, &patch));
+				if (!patch.empty()) {
+					player_manager->ApplyRevisionPatch(patch);
+				}
+			}
+
+			std::vector<network::UserPosition> positions;
+			network::PositionDecoder decoder;
+			if (decoder.Decode(position_data, &positions)) {
+				BOOST_FOREACH(const auto& item, positions) {
+					player_manager->UpdatePlayerPosition(item.first, item.second);
+				}
+			} else {
+				Logger::Error(_T("Invalid world snapshot"));
+			}
+		}
+
+		// 再接続時は受信済みの続きから取得する
+		client_->Write(network::ServerRequestedChatLog(chat_channel_, chat_sequence_, CHAT_LOG_REQUEST_COUNT));
+	}
+		break;
+
 	case FatalConnectionError:
 	case UserFatalConnectionError:
 	{
@@ -223,9 +372,27 @@ void CommandManager::FetchCommand(const network::Command& command)
 	}
 }
 
+bool CommandManager::DecodePositionSnapshot(const network::Command& command,
+	std::vector<network::UserPosition>* positions)
+{
+	const bool synchronized = position_decoder_.synchronized();
+	if (position_decoder_.Decode(
+		network::Utils::Deserialize<std::string>(command.body()), positions, &server_time_)) {
+		return true;
+	}
+
+	// キーフレームを待っている間は、同期が外れた時点で一度だけ要求する
+	if (synchronized) {
+		Logger::Error(_T("Invalid position snapshot"));
+		client_->Write(network::ServerRequestedPositionKeyframe());
+	}
+	return false;
+}
+
 void CommandManager::set_client(ClientUniqPtr client)
 {
     client_= std::move(client);
+	position_decoder_.Reset();
 	// status_ = STATUS_CONNECTING;
 }
 
@@ -268,6 +435,11 @@ CommandManager::Status CommandManager::status() const
 	return status_;
 }
 
+uint32_t CommandManager::server_time() const
+{
+	return server_time_;
+}
+
 const std::map<unsigned char, ChannelPtr>& CommandManager::channels() const
 {
 	return channels_;
@@ -5,8 +5,11 @@
 #pragma once
 
 #include "ManagerAccessor.hpp"
+#include "../common/network/PositionCodec.hpp"
 #include <string>
 
+#define CHAT_LOG_REQUEST_COUNT (50)
+
 namespace network {
     class Client;
     class Command;
@@ -56,17 +59,32 @@ class CommandManager {
         unsigned int user_id();
 		const std::map<unsigned char, ChannelPtr>& channels() const;
 		ChannelPtr current_channel() const;
+		uint32_t server_time() const;
 
 		void FetchCommand(const network::Command& command);
 
 		Status status() const;		
 
+	private:
+		// 失敗した場合は、サーバーにキーフレームを要求する
+		bool DecodePositionSnapshot(const network::Command& command,
+			std::vector<network::UserPosition>* positions);
+
     private:
         ManagerAccessorPtr manager_accessor_;
         ClientUniqPtr client_;
 		Status status_;
 
 		std::map<unsigned char, ChannelPtr> channels_;
+		network::PositionDecoder position_decoder_;
+		uint32_t server_time_;
+
+		// 再接続時に送る、受信済みのアカウント変更履歴の位置
+		uint32_t account_cursor_;
+
+		// 受信済みのチャット履歴の位置
+		uint8_t chat_channel_;
+		uint32_t chat_sequence_;
 };
 
 typedef std::shared_ptr<CommandManager> CommandManagerPtr;
@@ -7,6 +7,7 @@
 #include <boost/property_tree/xml_parser.hpp>
 #include "../common/network/Utils.hpp"
 #include "../common/network/CommandHeader.hpp"
+#include "../common/network/ServerInfo.hpp"
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/property_tree/ptree_serialization.hpp>
 #include <boost/serialization/string.hpp>
@@ -39,7 +40,7 @@ void LobbySession::Start()
 void LobbySession::Connect(const boost::system::error_code& error)
 {
     if (!error) {
-		Send(network::ServerRequestedFullServerInfo());
+		Send(network::ServerRequestedFullServerInfo(SERVER_INFO_FORMAT_VERSION));
         boost::asio::async_read_until(socket_tcp_, receive_buf_, NETWORK_UTILS_DELIMITOR,
                 boost::bind(&LobbySession::ReceiveTCP, shared_from_this(),
                         boost::asio::placeholders::error));
@@ -112,24 +113,21 @@ void Lobby::Server::Start(const std::string& host)
 						// NCAgv
 						case network::header::ClientReceiveFullServerInfo:
 						{
-							using namespace boost::property_tree;
 							std::string buffer;
 							network::Utils::Deserialize(c.body(), &buffer);
-							std::stringstream stream(buffer);
-							ptree pt;
-							try {
-								boost::archive::text_iarchive ia(stream);
-								ia >> pt;
+
+							network::ServerInfo info;
+							if (info.Parse(buffer)) {
 								loaded_ = true;
-							} catch (std::exception& e) {
-								Logger::Error(_T("%s"), unicode::ToTString(e.what()));
+							} else {
+								Logger::Error(_T("Invalid server info"));
 							}
 
-							name_ = pt.get<std::string>("config.server_name","");
-							note_ = pt.get<std::string>("config.server_note","");
-							stage_ = pt.get<std::string>("config.stage","");
-							capacity_ = pt.get<int>("config.capacity", 0);
-							player_num_ = pt.get_child("players", ptree()).size();
+							name_ = info.name;
+							note_ = info.note;
+							stage_ = info.stage;
+							capacity_ = info.capacity;
+							player_num_ = info.players.size();
 
 							Logger::Info(_T("%s %s %d %d"), unicode::ToTString(name_)
 								, unicode::ToTString(note_)
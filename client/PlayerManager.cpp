@@ -218,6 +218,11 @@ void PlayerManager::Update()
 		}
 		// ※ここまで
 
+		// 関心範囲外のプレイヤーは、位置を受信するまで読み込まない
+		if (out_of_range_players_.find(player->id()) != out_of_range_players_.end()) {
+			model = "";
+		}
+
 
     // ※ ここから  非同期読み込み対応
     //	if (player->current_model_name().empty() && !model.empty()) {
@@ -232,6 +237,13 @@ void PlayerManager::Update()
 				AddCharacter<PlayerCharacter>(player->id(), unicode::ToTString(player->model_name()));
 
 				player->set_current_model_name(player->model_name());
+
+				// 読み込む前に受信した位置に出す
+				auto spawn_it = spawn_positions_.find(player->id());
+				if (spawn_it != spawn_positions_.end()) {
+					UpdatePlayerPosition(spawn_it->first, spawn_it->second);
+					spawn_positions_.erase(spawn_it);
+				}
 //           } else {
 //                if (!model.empty() && !player->current_model_name().empty() && player->current_model_name() != model) {
                     // モデル非同期読み込み開始
@@ -334,7 +346,7 @@ void PlayerManager::ApplyRevisionPatch(const std::string& patch)
 	MMO_PROFILE_FUNCTION;
 
     std::string buffer(patch);
-    Logger::Debug(_T("%s"), unicode::ToTString(network::Utils::ToHexString(buffer)));
+    LOG_DEBUG(_T("%s"), unicode::ToTString(network::Utils::ToHexString(buffer)));
 
     uint32_t user_id;
     uint32_t new_revision;
@@ -518,14 +530,36 @@ std::vector<PlayerPtr> PlayerManager::GetAll()
 //}
 void PlayerManager::UpdatePlayerPosition(unsigned int user_id, const PlayerPosition& pos)
 {
+    out_of_range_players_.erase(user_id);
+
     if (char_data_providers_.find(user_id) != char_data_providers_.end()) {
         char_data_providers_[user_id]->set_target_position(VGet(pos.x, pos.y, pos.z));
         char_data_providers_[user_id]->set_vy(pos.vy);
 		char_data_providers_[user_id]->set_theta(pos.theta);
+    } else {
+        spawn_positions_[user_id] = pos;
     }
 }
 // ※ ここまで
 
+void PlayerManager::HidePlayer(unsigned int user_id)
+{
+    // 0は自分のキャラクター
+    if (user_id == 0) {
+        return;
+    }
+
+    out_of_range_players_.insert(user_id);
+    spawn_positions_.erase(user_id);
+
+    if (char_data_providers_.find(user_id) != char_data_providers_.end()) {
+        RemoveCharacter(user_id);
+    }
+    if (auto player = GetFromId(user_id)) {
+        player->set_current_model_name("");
+    }
+}
+
 std::shared_ptr<CharacterManager> PlayerManager::charmgr() const
 {
     return charmgr_;
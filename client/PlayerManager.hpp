@@ -5,6 +5,7 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <vector>
 #include <array>
 #include "Player.hpp"
@@ -44,6 +45,9 @@ class PlayerManager : public std::enable_shared_from_this<PlayerManager> {
         // プレイヤーの位置を更新
         void UpdatePlayerPosition(unsigned int user_id, const PlayerPosition& pos);
 
+        // 関心範囲から出たプレイヤーを、次に位置を受信するまで表示しない
+        void HidePlayer(unsigned int user_id);
+
         std::shared_ptr<CharacterManager> charmgr() const;
         std::map<unsigned int, std::unique_ptr<CharacterDataProvider>>& char_data_providers();
 
@@ -58,6 +62,10 @@ class PlayerManager : public std::enable_shared_from_this<PlayerManager> {
         std::shared_ptr<CharacterManager> charmgr_;
         std::map<unsigned int, std::unique_ptr<CharacterDataProvider>> char_data_providers_;
 
+        // 関心範囲外のプレイヤーと、キャラクターを作る前に受信した位置
+        std::set<unsigned int> out_of_range_players_;
+        std::map<unsigned int, PlayerPosition> spawn_positions_;
+
 		const std::shared_ptr<StagePtr> stage_ptr_holder_;
 
         int font_handle_;
@@ -12,7 +12,7 @@
 //#define MMO_VERSION_REVISION 0
 #define MMO_VERSION_REVISION 1
 
-#define MMO_PROTOCOL_VERSION 3
+#define MMO_PROTOCOL_VERSION 4
 
 #ifdef MMO_VERSION_BUILD
 #define MMO_VERSION_BUILD_TEXT " Build " MMO_VERSION_TOSTRING(MMO_VERSION_BUILD)
@@ -4,45 +4,390 @@
 
 #pragma once
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <ctime>
+#include <stdint.h>
+#include <string.h>
 #include "unicode.hpp"
 #include <boost/algorithm/string.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/date_time/c_local_time_adjustor.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 
-#ifdef _WIN32
-#define WriteDebugString(str) OutputDebugString(str.c_str()), \
-			std::wcout << unicode::ToWString(str) << std::flush, \
-			ofs_ << unicode::ToString(str) << std::flush
+// 1メッセージの最大文字数 (超えた分は切り捨て)
+#define LOGGER_MESSAGE_LENGTH (480)
+#define LOGGER_RECORD_SIZE (LOGGER_MESSAGE_LENGTH * sizeof(TCHAR))
+
+// リングバッファの要素数 (2のべき乗)
+#define LOGGER_BUFFER_SIZE (1024)
+
+// 書き込みスレッドがバッファをまとめて書き出す間隔
+#define LOGGER_FLUSH_MILLISECONDS (100)
+
+// ログファイルを切り替えるサイズ
+#define LOGGER_MAX_FILE_SIZE (8 * 1024 * 1024)
+
+// 固定長の要素を持つ、複数の書き込み側から使えるロックフリーのリングバッファ
+// 各要素のシーケンス番号で、書き込み中・読み込み中の要素を区別する
+template<class T, size_t Size>
+class LogRingBuffer {
+    public:
+        LogRingBuffer() :
+            enqueue_pos_(0),
+            dequeue_pos_(0)
+        {
+            static_assert((Size & (Size - 1)) == 0, "Size must be a power of two");
+            for (size_t i = 0; i < Size; i++) {
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        // いっぱいの場合はfalse
+        template<class Func>
+        bool Push(const Func& func)
+        {
+            Cell* cell;
+            size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &cells_[pos & (Size - 1)];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if (diff == 0) {
+                    if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+
+            func(&cell->value);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // 空の場合はfalse
+        template<class Func>
+        bool Pop(const Func& func)
+        {
+            Cell* cell;
+            size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &cells_[pos & (Size - 1)];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0) {
+                    if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = dequeue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+
+            func(cell->value);
+            cell->sequence.store(pos + Size, std::memory_order_release);
+            return true;
+        }
+
+        size_t size() const
+        {
+            return enqueue_pos_.load(std::memory_order_relaxed) - dequeue_pos_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        Cell cells_[Size];
+        std::atomic<size_t> enqueue_pos_;
+        std::atomic<size_t> dequeue_pos_;
+};
+
+#define LOGGER_LEVEL_DEBUG (0)
+#define LOGGER_LEVEL_INFO (1)
+#define LOGGER_LEVEL_ERROR (2)
+#define LOGGER_LEVEL_FATAL (3)
+
+// この値より低いレベルのLOG_マクロはコンパイル時に取り除かれる
+#ifndef LOGGER_MIN_LEVEL
+#ifdef _DEBUG
+#define LOGGER_MIN_LEVEL LOGGER_LEVEL_DEBUG
 #else
-#define WriteDebugString(str) std::cout << unicode::ToString(out) << std::flush; \
-			ofs_ << unicode::ToString(out) << std::flush;
+#define LOGGER_MIN_LEVEL LOGGER_LEVEL_INFO
+#endif
+#endif
+
+// レベルを確認してから引数を評価する
+// 書式はリテラルのみ (ポインタのまま保持し、書き込みスレッドで整形する)
+#define LOGGER_WRITE(level, ...) \
+    do { \
+        if ((level) >= LOGGER_MIN_LEVEL && Logger::IsEnabled(level)) { \
+            Logger::Write((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(...) LOGGER_WRITE(LOGGER_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOGGER_WRITE(LOGGER_LEVEL_INFO, __VA_ARGS__)
+#define LOG_ERROR(...) LOGGER_WRITE(LOGGER_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_FATAL(...) LOGGER_WRITE(LOGGER_LEVEL_FATAL, __VA_ARGS__)
+
+// ログの引数を型の印とともにそのままの値で記録し、書き込みスレッドで書式に当てはめる
+// 数値と文字列以外の型は、呼び出し元で文字列に変換する
+namespace logger_detail {
+
+    enum ArgumentType {
+        ARG_INT32,
+        ARG_UINT32,
+        ARG_INT64,
+        ARG_UINT64,
+        ARG_DOUBLE,
+        ARG_CHAR,
+        ARG_BOOL,
+        ARG_STRING,
+        ARG_WSTRING,
+    };
+
+    // 入りきらない引数は、文字列なら切り詰め、それ以外は捨てる
+    class ArgumentWriter {
+        public:
+            ArgumentWriter(char* data, size_t size) :
+                data_(data), size_(size), offset_(0) {}
+
+            template<class T>
+            void Put(ArgumentType type, const T& value)
+            {
+                if (size_ - offset_ < 1 + sizeof(T)) {
+                    offset_ = size_;
+                    return;
+                }
+                data_[offset_++] = static_cast<char>(type);
+                memcpy(data_ + offset_, &value, sizeof(T));
+                offset_ += sizeof(T);
+            }
+
+            template<class Char>
+            void PutString(ArgumentType type, const Char* value, size_t length)
+            {
+                if (size_ - offset_ < 1 + sizeof(uint32_t)) {
+                    offset_ = size_;
+                    return;
+                }
+                length = std::min(length, (size_ - offset_ - 1 - sizeof(uint32_t)) / sizeof(Char));
+                uint32_t bytes = static_cast<uint32_t>(length * sizeof(Char));
+                data_[offset_++] = static_cast<char>(type);
+                memcpy(data_ + offset_, &bytes, sizeof(bytes));
+                memcpy(data_ + offset_ + sizeof(bytes), value, bytes);
+                offset_ += sizeof(bytes) + bytes;
+            }
+
+            size_t size() const { return offset_; }
+
+        private:
+            char* data_;
+            size_t size_;
+            size_t offset_;
+    };
+
+    inline void Encode(ArgumentWriter* w, bool value) { w->Put(ARG_BOOL, value); }
+    inline void Encode(ArgumentWriter* w, char value) { w->Put(ARG_CHAR, value); }
+    inline void Encode(ArgumentWriter* w, signed char value) { w->Put(ARG_CHAR, static_cast<char>(value)); }
+    inline void Encode(ArgumentWriter* w, unsigned char value) { w->Put(ARG_CHAR, static_cast<char>(value)); }
+    inline void Encode(ArgumentWriter* w, short value) { w->Put(ARG_INT32, static_cast<int32_t>(value)); }
+    inline void Encode(ArgumentWriter* w, unsigned short value) { w->Put(ARG_UINT32, static_cast<uint32_t>(value)); }
+    inline void Encode(ArgumentWriter* w, int value) { w->Put(ARG_INT32, static_cast<int32_t>(value)); }
+    inline void Encode(ArgumentWriter* w, unsigned int value) { w->Put(ARG_UINT32, static_cast<uint32_t>(value)); }
+    inline void Encode(ArgumentWriter* w, long value)
+    {
+        if (sizeof(long) == sizeof(int32_t)) {
+            w->Put(ARG_INT32, static_cast<int32_t>(value));
+        } else {
+            w->Put(ARG_INT64, static_cast<int64_t>(value));
+        }
+    }
+    inline void Encode(ArgumentWriter* w, unsigned long value)
+    {
+        if (sizeof(unsigned long) == sizeof(uint32_t)) {
+            w->Put(ARG_UINT32, static_cast<uint32_t>(value));
+        } else {
+            w->Put(ARG_UINT64, static_cast<uint64_t>(value));
+        }
+    }
+    inline void Encode(ArgumentWriter* w, long long value) { w->Put(ARG_INT64, static_cast<int64_t>(value)); }
+    inline void Encode(ArgumentWriter* w, unsigned long long value) { w->Put(ARG_UINT64, static_cast<uint64_t>(value)); }
+    inline void Encode(ArgumentWriter* w, float value) { w->Put(ARG_DOUBLE, static_cast<double>(value)); }
+    inline void Encode(ArgumentWriter* w, double value) { w->Put(ARG_DOUBLE, value); }
+
+    inline void Encode(ArgumentWriter* w, const char* value) { w->PutString(ARG_STRING, value, strlen(value)); }
+    inline void Encode(ArgumentWriter* w, char* value) { Encode(w, static_cast<const char*>(value)); }
+    inline void Encode(ArgumentWriter* w, const std::string& value) { w->PutString(ARG_STRING, value.data(), value.size()); }
+
+#ifdef _WIN32
+    inline void Encode(ArgumentWriter* w, const wchar_t* value) { w->PutString(ARG_WSTRING, value, wcslen(value)); }
+    inline void Encode(ArgumentWriter* w, wchar_t* value) { Encode(w, static_cast<const wchar_t*>(value)); }
+    inline void Encode(ArgumentWriter* w, const std::wstring& value) { w->PutString(ARG_WSTRING, value.data(), value.size()); }
+#endif
+
+    template<class T>
+    void EncodeValue(ArgumentWriter* w, const T& value, std::true_type)
+    {
+        Encode(w, static_cast<int>(value));
+    }
+
+    template<class T>
+    void EncodeValue(ArgumentWriter* w, const T& value, std::false_type)
+    {
+        std::basic_ostringstream<TCHAR> stream;
+        stream << value;
+        Encode(w, stream.str());
+    }
+
+    // 列挙型は整数、それ以外は文字列として記録する
+    template<class T>
+    void Encode(ArgumentWriter* w, const T& value)
+    {
+        EncodeValue(w, value, typename std::is_enum<T>::type());
+    }
+
+    // 記録した引数を書式に当てはめる
+    inline tstring Format(const TCHAR* format, const char* data, size_t size)
+    {
+        tformat formatter(format);
+        formatter.exceptions(boost::io::all_error_bits ^
+            (boost::io::too_many_args_bit | boost::io::too_few_args_bit));
+
+        size_t offset = 0;
+        while (offset < size) {
+            ArgumentType type = static_cast<ArgumentType>(data[offset++]);
+            const char* value = data + offset;
+            switch (type) {
+            case ARG_INT32:
+                { int32_t v; memcpy(&v, value, sizeof(v)); formatter % v; offset += sizeof(v); }
+                break;
+            case ARG_UINT32:
+                { uint32_t v; memcpy(&v, value, sizeof(v)); formatter % v; offset += sizeof(v); }
+                break;
+            case ARG_INT64:
+                { int64_t v; memcpy(&v, value, sizeof(v)); formatter % v; offset += sizeof(v); }
+                break;
+            case ARG_UINT64:
+                { uint64_t v; memcpy(&v, value, sizeof(v)); formatter % v; offset += sizeof(v); }
+                break;
+            case ARG_DOUBLE:
+                { double v; memcpy(&v, value, sizeof(v)); formatter % v; offset += sizeof(v); }
+                break;
+            case ARG_CHAR:
+                { char v; memcpy(&v, value, sizeof(v)); formatter % v; offset += sizeof(v); }
+                break;
+            case ARG_BOOL:
+                { bool v; memcpy(&v, value, sizeof(v)); formatter % v; offset += sizeof(v); }
+                break;
+            case ARG_STRING:
+                {
+                    uint32_t bytes;
+                    memcpy(&bytes, value, sizeof(bytes));
+                    formatter % unicode::ToTString(std::string(value + sizeof(bytes), bytes));
+                    offset += sizeof(bytes) + bytes;
+                }
+                break;
+#ifdef _WIN32
+            case ARG_WSTRING:
+                {
+                    uint32_t bytes;
+                    memcpy(&bytes, value, sizeof(bytes));
+                    formatter % unicode::ToTString(std::wstring(
+                        reinterpret_cast<const wchar_t*>(value + sizeof(bytes)), bytes / sizeof(wchar_t)));
+                    offset += sizeof(bytes) + bytes;
+                }
+                break;
 #endif
+            default:
+                offset = size;
+            }
+        }
 
+        return formatter.str();
+    }
+
+}
+
+// 呼び出し元のスレッドではバッファに積むだけで、書き込みスレッドがまとめて出力する
+// バッファがいっぱいの場合は破棄して件数を数え、後で出力する
+// Fatalは呼び出し元のスレッドで、溜まっている分も含めて書き出してから戻る
 class Logger {
         // Singleton
     private:
-        inline Logger() {
+        enum Level {
+            LEVEL_DEBUG = LOGGER_LEVEL_DEBUG,
+            LEVEL_INFO = LOGGER_LEVEL_INFO,
+            LEVEL_ERROR = LOGGER_LEVEL_ERROR,
+            LEVEL_FATAL = LOGGER_LEVEL_FATAL,
+        };
+
+        // formatがnullptrの場合、dataは整形済みの文字列
+        // それ以外はLOG_マクロの書式と、記録した引数
+        struct Record {
+            int level;
+            time_t time;
+            const TCHAR* format;
+            size_t size;
+            char data[LOGGER_RECORD_SIZE];
+        };
+
+        inline Logger() :
+            dropped_(0),
+            file_size_(0),
+            last_time_(0),
+            stop_(false)
+        {
 			using namespace boost::filesystem;
 
 			if (!exists("./log")) {
 				create_directory("./log");
 			}
 
-			ofs_.open("./log/" + GetLogFileName());
+			OpenLogFile();
 
 			#ifdef _WIN32
 				setlocale(LC_ALL, "japanese");
 			#endif
+
+            thread_ = boost::thread([this]() { Run(); });
 		}
 
         Logger(const Logger& logger) {}
-        virtual ~Logger() {}
 
-		inline tstring GetTimeString() const
+        virtual ~Logger() {
+            {
+                boost::mutex::scoped_lock lock(wait_mutex_);
+                stop_ = true;
+            }
+            condition_.notify_one();
+            thread_.join();
+            Drain();
+        }
+
+		inline const tstring& GetTimeString(time_t time)
 		{
-			using namespace boost::posix_time;
-			ptime now = second_clock::local_time();
-            return unicode::ToTString(to_iso_extended_string(now));
+            // 同じ秒の間は前回の文字列を使う
+            if (time != last_time_ || time_string_.empty()) {
+                using namespace boost::posix_time;
+                typedef boost::date_time::c_local_adjustor<ptime> local_adjustor;
+                ptime now = local_adjustor::utc_to_local(from_time_t(time));
+                time_string_ = unicode::ToTString(to_iso_extended_string(now));
+                last_time_ = time;
+            }
+            return time_string_;
 		}
 
 		inline std::string GetLogFileName() const
@@ -56,126 +401,355 @@ class Logger {
 
     public:
         static void Info(const tstring& format) {
-            getInstance().Log(_T("INFO: "), format);
+            getInstance().Log(LEVEL_INFO, format);
         }
 
         template<class T1>
         static void Info(const tstring& format, const T1& t1) {
-            getInstance().Log(_T("INFO: "), format, t1);
+            getInstance().Log(LEVEL_INFO, (tformat(format) % t1).str());
         }
 
         template<class T1, class T2>
         static void Info(const tstring& format, const T1& t1, const T2& t2) {
-            getInstance().Log(_T("INFO: "), format, t1, t2);
+            getInstance().Log(LEVEL_INFO, (tformat(format) % t1 % t2).str());
         }
 
         template<class T1, class T2, class T3>
         static void Info(const tstring& format, const T1& t1, const T2& t2, const T3& t3) {
-            getInstance().Log(_T("INFO: "), format, t1, t2, t3);
+            getInstance().Log(LEVEL_INFO, (tformat(format) % t1 % t2 % t3).str());
         }
 
         template<class T1, class T2, class T3, class T4>
         static void Info(const tstring& format, const T1& t1, const T2& t2, const T3& t3, const T4& t4) {
-            getInstance().Log(_T("INFO: "), format, t1, t2, t3, t4);
+            getInstance().Log(LEVEL_INFO, (tformat(format) % t1 % t2 % t3 % t4).str());
         }
 
 
         static void Error(const tstring& format) {
-            getInstance().Log(_T("ERROR: "), format);
+            getInstance().Log(LEVEL_ERROR, format);
         }
 
         template<class T1>
         static void Error(const tstring& format, const T1& t1) {
-            getInstance().Log(_T("ERROR: "), format, t1);
+            getInstance().Log(LEVEL_ERROR, (tformat(format) % t1).str());
         }
 
         template<class T1, class T2>
         static void Error(const tstring& format, const T1& t1, const T2& t2) {
-            getInstance().Log(_T("ERROR: "), format, t1, t2);
+            getInstance().Log(LEVEL_ERROR, (tformat(format) % t1 % t2).str());
         }
 
         template<class T1, class T2, class T3>
         static void Error(const tstring& format, const T1& t1, const T2& t2, const T3& t3) {
-            getInstance().Log(_T("ERROR: "), format, t1, t2, t3);
+            getInstance().Log(LEVEL_ERROR, (tformat(format) % t1 % t2 % t3).str());
         }
 
         template<class T1, class T2, class T3, class T4>
         static void Error(const tstring& format, const T1& t1, const T2& t2, const T3& t3, const T4& t4) {
-            getInstance().Log(_T("ERROR: "), format, t1, t2, t3, t4);
+            getInstance().Log(LEVEL_ERROR, (tformat(format) % t1 % t2 % t3 % t4).str());
+        }
+
+
+        static void Fatal(const tstring& format) {
+            getInstance().LogSync(format);
+        }
+
+        template<class T1>
+        static void Fatal(const tstring& format, const T1& t1) {
+            getInstance().LogSync((tformat(format) % t1).str());
+        }
+
+        template<class T1, class T2>
+        static void Fatal(const tstring& format, const T1& t1, const T2& t2) {
+            getInstance().LogSync((tformat(format) % t1 % t2).str());
+        }
+
+        template<class T1, class T2, class T3>
+        static void Fatal(const tstring& format, const T1& t1, const T2& t2, const T3& t3) {
+            getInstance().LogSync((tformat(format) % t1 % t2 % t3).str());
+        }
+
+        template<class T1, class T2, class T3, class T4>
+        static void Fatal(const tstring& format, const T1& t1, const T2& t2, const T3& t3, const T4& t4) {
+            getInstance().LogSync((tformat(format) % t1 % t2 % t3 % t4).str());
         }
 
 
         static void Debug(const tstring& format) {
 		#ifdef _DEBUG
-            getInstance().Log(_T("DEBUG: "), format);
+            getInstance().Log(LEVEL_DEBUG, format);
 		#endif
         }
 
         template<class T1>
         static void Debug(const tstring& format, const T1& t1) {
 		#ifdef _DEBUG
-            getInstance().Log(_T("DEBUG: "), format, t1);
+            getInstance().Log(LEVEL_DEBUG, (tformat(format) % t1).str());
 		#endif
         }
 
         template<class T1, class T2>
         static void Debug(const tstring& format, const T1& t1, const T2& t2) {
 		#ifdef _DEBUG
-            getInstance().Log(_T("DEBUG: "), format, t1, t2);
+            getInstance().Log(LEVEL_DEBUG, (tformat(format) % t1 % t2).str());
 		#endif
         }
 
         template<class T1, class T2, class T3>
         static void Debug(const tstring& format, const T1& t1, const T2& t2, const T3& t3) {
 		#ifdef _DEBUG
-            getInstance().Log(_T("DEBUG: "), format, t1, t2, t3);
+            getInstance().Log(LEVEL_DEBUG, (tformat(format) % t1 % t2 % t3).str());
 		#endif
         }
 
         template<class T1, class T2, class T3, class T4>
         static void Debug(const tstring& format, const T1& t1, const T2& t2, const T3& t3, const T4& t4) {
 		#ifdef _DEBUG
-            getInstance().Log(_T("DEBUG: "), format, t1, t2, t3, t4);
+            getInstance().Log(LEVEL_DEBUG, (tformat(format) % t1 % t2 % t3 % t4).str());
 		#endif
         }
 
+        // バッファに溜まっている分を書き出す
+        static void Flush() {
+            getInstance().Drain();
+        }
 
-    private:
-        typedef boost::basic_format<TCHAR, std::char_traits<TCHAR>, std::allocator<TCHAR>> tformat;
+        static bool IsEnabled(int level) {
+            return level >= RuntimeLevel().load(std::memory_order_relaxed);
+        }
 
-        static Logger& getInstance() {
-            static Logger instance;
-            return instance;
+        static void SetLevel(int level) {
+            RuntimeLevel().store(level, std::memory_order_relaxed);
         }
 
-        void Log(const tstring& prefix, const tstring& format) {
-            auto out = GetTimeString() + _T(">  ") + prefix + format + _T("\n");
-            WriteDebugString(out);
+        // LOG_マクロから呼ばれる
+        static void Write(int level, const TCHAR* format) {
+            getInstance().Push(level, format, [](logger_detail::ArgumentWriter* w) {});
         }
 
         template<class T1>
-        void Log(const tstring& prefix, const tstring& format, const T1& t1) {
-            auto out = GetTimeString() + _T(">  ") + prefix + (tformat(format) % t1).str() + _T("\n");
-			WriteDebugString(out);
+        static void Write(int level, const TCHAR* format, const T1& t1) {
+            getInstance().Push(level, format, [&](logger_detail::ArgumentWriter* w) {
+                logger_detail::Encode(w, t1);
+            });
         }
 
         template<class T1, class T2>
-        void Log(const tstring& prefix, const tstring& format, const T1& t1, const T2& t2) {
-            auto out = GetTimeString() + _T(">  ") + prefix + (tformat(format) % t1 % t2).str() + _T("\n");
-            WriteDebugString(out);
+        static void Write(int level, const TCHAR* format, const T1& t1, const T2& t2) {
+            getInstance().Push(level, format, [&](logger_detail::ArgumentWriter* w) {
+                logger_detail::Encode(w, t1);
+                logger_detail::Encode(w, t2);
+            });
         }
 
         template<class T1, class T2, class T3>
-        void Log(const tstring& prefix, const tstring& format, const T1& t1, const T2& t2, const T3& t3) {
-            auto out = GetTimeString() + _T(">  ") + prefix + (tformat(format) % t1 % t2 % t3).str() + _T("\n");
-            WriteDebugString(out);
+        static void Write(int level, const TCHAR* format, const T1& t1, const T2& t2, const T3& t3) {
+            getInstance().Push(level, format, [&](logger_detail::ArgumentWriter* w) {
+                logger_detail::Encode(w, t1);
+                logger_detail::Encode(w, t2);
+                logger_detail::Encode(w, t3);
+            });
         }
 
         template<class T1, class T2, class T3, class T4>
-        void Log(const tstring& prefix, const tstring& format, const T1& t1, const T2& t2, const T3& t3, const T4& t4) {
-            auto out = GetTimeString() + _T(">  ") + prefix + (tformat(format) % t1 % t2 % t3 % t4).str() + _T("\n");
-            WriteDebugString(out);
+        static void Write(int level, const TCHAR* format, const T1& t1, const T2& t2, const T3& t3, const T4& t4) {
+            getInstance().Push(level, format, [&](logger_detail::ArgumentWriter* w) {
+                logger_detail::Encode(w, t1);
+                logger_detail::Encode(w, t2);
+                logger_detail::Encode(w, t3);
+                logger_detail::Encode(w, t4);
+            });
+        }
+
+    private:
+        static Logger& getInstance() {
+            static Logger instance;
+            return instance;
+        }
+
+        static std::atomic<int>& RuntimeLevel() {
+            static std::atomic<int> level(LOGGER_MIN_LEVEL);
+            return level;
         }
 
-	std::ofstream ofs_;
+        void Log(Level level, const tstring& message) {
+            if (!IsEnabled(level)) {
+                return;
+            }
+
+            time_t now = std::time(nullptr);
+            bool pushed = buffer_.Push([&](Record* record) {
+                record->level = level;
+                record->time = now;
+                record->format = nullptr;
+                record->size = std::min(message.size(), static_cast<size_t>(LOGGER_MESSAGE_LENGTH)) * sizeof(TCHAR);
+                memcpy(record->data, message.data(), record->size);
+            });
+
+            Notify(pushed);
+        }
+
+        // 引数は書き込みスレッドで整形する
+        template<class Func>
+        void Push(int level, const TCHAR* format, const Func& encode) {
+            time_t now = std::time(nullptr);
+            auto fill = [&](Record* record) {
+                logger_detail::ArgumentWriter writer(record->data, sizeof(record->data));
+                encode(&writer);
+                record->level = level;
+                record->time = now;
+                record->format = format;
+                record->size = writer.size();
+            };
+
+            if (level >= LEVEL_FATAL) {
+                Record record;
+                fill(&record);
+                boost::mutex::scoped_lock lock(write_mutex_);
+                DrainLocked();
+                WriteRecord(record);
+                WriteOut();
+                return;
+            }
+
+            Notify(buffer_.Push(fill));
+        }
+
+        void Notify(bool pushed) {
+            if (!pushed) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // 半分を超えたら間隔を待たずに書き出させる
+            if (!pushed || buffer_.size() >= LOGGER_BUFFER_SIZE / 2) {
+                condition_.notify_one();
+            }
+        }
+
+        void LogSync(const tstring& message) {
+            boost::mutex::scoped_lock lock(write_mutex_);
+            DrainLocked();
+            WriteText(LEVEL_FATAL, std::time(nullptr), message.data(), message.size());
+            WriteOut();
+        }
+
+        void Run() {
+            for (;;) {
+                {
+                    boost::mutex::scoped_lock lock(wait_mutex_);
+                    if (!stop_) {
+                        condition_.timed_wait(lock,
+                            boost::posix_time::milliseconds(LOGGER_FLUSH_MILLISECONDS));
+                    }
+                }
+
+                Drain();
+
+                boost::mutex::scoped_lock lock(wait_mutex_);
+                if (stop_) {
+                    break;
+                }
+            }
+        }
+
+        void Drain() {
+            boost::mutex::scoped_lock lock(write_mutex_);
+            DrainLocked();
+        }
+
+        void DrainLocked() {
+            while (buffer_.Pop([this](const Record& record) {
+                WriteRecord(record);
+            }));
+
+            size_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0) {
+                tstring message = (tformat(_T("%d log messages were dropped")) % dropped).str();
+                WriteText(LEVEL_ERROR, std::time(nullptr), message.data(), message.size());
+            }
+
+            WriteOut();
+        }
+
+        void WriteRecord(const Record& record) {
+            if (!record.format) {
+                WriteText(record.level, record.time,
+                    reinterpret_cast<const TCHAR*>(record.data), record.size / sizeof(TCHAR));
+                return;
+            }
+
+            tstring message;
+            try {
+                message = logger_detail::Format(record.format, record.data, record.size);
+            } catch (const std::exception&) {
+                message = record.format;
+            }
+            WriteText(record.level, record.time, message.data(), message.size());
+        }
+
+        void WriteText(int level, time_t time, const TCHAR* text, size_t length) {
+            static const TCHAR* prefixes[] = {_T("DEBUG: "), _T("INFO: "), _T("ERROR: "), _T("FATAL: ")};
+
+            pending_ += GetTimeString(time);
+            pending_ += _T(">  ");
+            pending_ += prefixes[level];
+            pending_.append(text, length);
+            pending_ += _T("\n");
+        }
+
+        // まとめて出力し、1回だけフラッシュする
+        void WriteOut() {
+            if (pending_.empty()) {
+                return;
+            }
+
+            #ifdef _WIN32
+            OutputDebugString(pending_.c_str());
+            std::wcout << unicode::ToWString(pending_) << std::flush;
+            #else
+            std::cout << unicode::ToString(pending_) << std::flush;
+            #endif
+
+            std::string out = unicode::ToString(pending_);
+            if (file_size_ + out.size() > LOGGER_MAX_FILE_SIZE) {
+                OpenLogFile();
+            }
+            ofs_ << out << std::flush;
+            file_size_ += out.size();
+
+            pending_.clear();
+        }
+
+        void OpenLogFile() {
+            using namespace boost::filesystem;
+
+            // 同じ秒に切り替えた場合は番号を付ける
+            std::string name = GetLogFileName();
+            for (int i = 1; exists("./log/" + name); i++) {
+                name = GetLogFileName();
+                boost::algorithm::replace_last(name, ".txt", "_" + std::to_string(static_cast<long long>(i)) + ".txt");
+            }
+
+            ofs_.close();
+            ofs_.clear();
+            ofs_.open("./log/" + name);
+            file_size_ = 0;
+        }
+
+    private:
+        LogRingBuffer<Record, LOGGER_BUFFER_SIZE> buffer_;
+        std::atomic<size_t> dropped_;
+
+        // 書き出しは書き込みスレッドとFatalで排他する
+        boost::mutex write_mutex_;
+        std::ofstream ofs_;
+        size_t file_size_;
+        tstring pending_;
+        time_t last_time_;
+        tstring time_string_;
+
+        boost::mutex wait_mutex_;
+        boost::condition_variable condition_;
+        bool stop_;
+        boost::thread thread_;
 };
@@ -0,0 +1,448 @@
+//
+// Metrics.cpp
+//
+
+#include "Metrics.hpp"
+#include <stdio.h>
+#include <algorithm>
+#include <boost/foreach.hpp>
+
+#ifdef _MSC_VER
+#define METRICS_THREAD_LOCAL __declspec(thread)
+#else
+#define METRICS_THREAD_LOCAL __thread
+#endif
+
+namespace metrics {
+
+    namespace {
+        std::atomic<size_t> next_shard_index(0);
+        METRICS_THREAD_LOCAL size_t shard_index_plus_one = 0;
+
+        size_t GetBucket(uint64_t value)
+        {
+            size_t bucket = 0;
+            while (value > 0 && bucket < METRICS_HISTOGRAM_BUCKETS - 1) {
+                value >>= 1;
+                bucket++;
+            }
+            return bucket;
+        }
+
+        std::string FormatNumber(double value)
+        {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.9g", value);
+            return buffer;
+        }
+
+        std::string FormatHeaderLabel(size_t header)
+        {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "header=\"0x%02x\"", static_cast<unsigned int>(header));
+            return buffer;
+        }
+
+        // 値を表すのに必要なビット数
+        int GetBitWidth(uint64_t value)
+        {
+            int width = 0;
+            if (value >> 32) { value >>= 32; width += 32; }
+            if (value >> 16) { value >>= 16; width += 16; }
+            if (value >> 8) { value >>= 8; width += 8; }
+            if (value >> 4) { value >>= 4; width += 4; }
+            if (value >> 2) { value >>= 2; width += 2; }
+            if (value >> 1) { value >>= 1; width += 1; }
+            return width + static_cast<int>(value);
+        }
+
+        const uint64_t LATENCY_SUB_BUCKETS = 1 << METRICS_LATENCY_SUB_BUCKET_BITS;
+        const uint64_t LATENCY_HALF_SUB_BUCKETS = LATENCY_SUB_BUCKETS / 2;
+        const uint64_t LATENCY_MAX_VALUE = (static_cast<uint64_t>(1) << METRICS_LATENCY_MAX_BITS) - 1;
+    }
+
+    size_t GetShardIndex()
+    {
+        // スレッドごとに最初の呼び出しで順に割り当てる
+        if (shard_index_plus_one == 0) {
+            shard_index_plus_one = next_shard_index.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS + 1;
+        }
+        return shard_index_plus_one - 1;
+    }
+
+    Counter::Counter()
+    {
+        for (size_t i = 0; i < METRICS_SHARDS; i++) {
+            shards_[i].value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t Counter::Value() const
+    {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < METRICS_SHARDS; i++) {
+            sum += shards_[i].value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    Histogram::Histogram()
+    {
+        for (size_t i = 0; i < METRICS_SHARDS; i++) {
+            for (size_t j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++) {
+                shards_[i].counts[j].store(0, std::memory_order_relaxed);
+            }
+            shards_[i].sum.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Histogram::Record(uint64_t value)
+    {
+        Shard& shard = shards_[GetShardIndex()];
+        shard.counts[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void Histogram::GetSnapshot(Snapshot* snapshot) const
+    {
+        snapshot->count = 0;
+        snapshot->sum = 0;
+        for (size_t j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++) {
+            snapshot->counts[j] = 0;
+        }
+
+        for (size_t i = 0; i < METRICS_SHARDS; i++) {
+            for (size_t j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++) {
+                uint64_t count = shards_[i].counts[j].load(std::memory_order_relaxed);
+                snapshot->counts[j] += count;
+                snapshot->count += count;
+            }
+            snapshot->sum += shards_[i].sum.load(std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t Histogram::GetUpperBound(size_t bucket)
+    {
+        return bucket == 0 ? 0 : (static_cast<uint64_t>(1) << bucket) - 1;
+    }
+
+    void LatencyHistogram::Snapshot::Clear()
+    {
+        for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+            counts[i] = 0;
+        }
+        count = 0;
+        sum = 0;
+    }
+
+    void LatencyHistogram::Snapshot::Add(const Snapshot& snapshot)
+    {
+        for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+            counts[i] += snapshot.counts[i];
+        }
+        count += snapshot.count;
+        sum += snapshot.sum;
+    }
+
+    void LatencyHistogram::Snapshot::Subtract(const Snapshot& snapshot)
+    {
+        for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+            counts[i] -= snapshot.counts[i];
+        }
+        count -= snapshot.count;
+        sum -= snapshot.sum;
+    }
+
+    uint64_t LatencyHistogram::Snapshot::GetPercentile(double percentile) const
+    {
+        if (count == 0) {
+            return 0;
+        }
+
+        // 順位がこの値以上になる最初の区間
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count + 0.5);
+        rank = std::max<uint64_t>(1, std::min(rank, count));
+
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+            cumulative += counts[i];
+            if (cumulative >= rank) {
+                return GetUpperBound(i);
+            }
+        }
+        return GetUpperBound(METRICS_LATENCY_BUCKETS - 1);
+    }
+
+    LatencyHistogram::LatencyHistogram()
+    {
+        for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+            counts_[i].store(0, std::memory_order_relaxed);
+        }
+        sum_.store(0, std::memory_order_relaxed);
+    }
+
+    void LatencyHistogram::Record(uint64_t value)
+    {
+        counts_[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void LatencyHistogram::GetSnapshot(Snapshot* snapshot) const
+    {
+        snapshot->count = 0;
+        for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+            snapshot->counts[i] = counts_[i].load(std::memory_order_relaxed);
+            snapshot->count += snapshot->counts[i];
+        }
+        snapshot->sum = sum_.load(std::memory_order_relaxed);
+    }
+
+    size_t LatencyHistogram::GetBucket(uint64_t value)
+    {
+        value = std::min(value, LATENCY_MAX_VALUE);
+        if (value < LATENCY_SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+
+        // 上位 METRICS_LATENCY_SUB_BUCKET_BITS ビットで区間を決める (最上位ビットは常に1)
+        int shift = GetBitWidth(value) - METRICS_LATENCY_SUB_BUCKET_BITS;
+        return static_cast<size_t>(LATENCY_SUB_BUCKETS + (shift - 1) * LATENCY_HALF_SUB_BUCKETS +
+            ((value >> shift) - LATENCY_HALF_SUB_BUCKETS));
+    }
+
+    uint64_t LatencyHistogram::GetUpperBound(size_t bucket)
+    {
+        if (bucket < LATENCY_SUB_BUCKETS) {
+            return bucket;
+        }
+
+        int shift = static_cast<int>((bucket - LATENCY_SUB_BUCKETS) / LATENCY_HALF_SUB_BUCKETS) + 1;
+        uint64_t sub_bucket = (bucket - LATENCY_SUB_BUCKETS) % LATENCY_HALF_SUB_BUCKETS + LATENCY_HALF_SUB_BUCKETS;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+    LatencyHistogramArray::LatencyHistogramArray()
+    {
+        for (size_t i = 0; i < size(); i++) {
+            histograms_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyHistogramArray::~LatencyHistogramArray()
+    {
+        for (size_t i = 0; i < size(); i++) {
+            delete histograms_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void LatencyHistogramArray::Record(size_t index, uint64_t value)
+    {
+        if (index >= size()) {
+            return;
+        }
+
+        LatencyHistogram* histogram = histograms_[index].load(std::memory_order_acquire);
+        if (!histogram) {
+            // 同時に確保した場合は、先に登録された方を使う
+            LatencyHistogram* new_histogram = new LatencyHistogram();
+            if (histograms_[index].compare_exchange_strong(histogram, new_histogram,
+                    std::memory_order_acq_rel, std::memory_order_acquire)) {
+                histogram = new_histogram;
+            } else {
+                delete new_histogram;
+            }
+        }
+        histogram->Record(value);
+    }
+
+    bool LatencyHistogramArray::GetSnapshot(size_t index, LatencyHistogram::Snapshot* snapshot) const
+    {
+        LatencyHistogram* histogram = index < size() ?
+            histograms_[index].load(std::memory_order_acquire) : nullptr;
+        if (!histogram) {
+            return false;
+        }
+        histogram->GetSnapshot(snapshot);
+        return true;
+    }
+
+    Writer::Writer(std::string* out) :
+        out_(out)
+    {
+    }
+
+    void Writer::Counter(const char* name, const char* help, uint64_t value)
+    {
+        Type(name, help, "counter");
+        Sample(name, "", static_cast<double>(value));
+    }
+
+    void Writer::Gauge(const char* name, const char* help, double value)
+    {
+        Type(name, help, "gauge");
+        Sample(name, "", value);
+    }
+
+    void Writer::Histogram(const char* name, const char* help, const metrics::Histogram& histogram,
+        double scale)
+    {
+        metrics::Histogram::Snapshot snapshot;
+        histogram.GetSnapshot(&snapshot);
+
+        Type(name, help, "histogram");
+
+        // 最後の空でない区間まで累積値を出力する
+        size_t last = 0;
+        for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+            if (snapshot.counts[i] > 0) {
+                last = i;
+            }
+        }
+
+        const std::string bucket_name = std::string(name) + "_bucket";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i <= last; i++) {
+            cumulative += snapshot.counts[i];
+            Sample(bucket_name.c_str(),
+                "le=\"" + FormatNumber(metrics::Histogram::GetUpperBound(i) * scale) + "\"",
+                static_cast<double>(cumulative));
+        }
+        Sample(bucket_name.c_str(), "le=\"+Inf\"", static_cast<double>(snapshot.count));
+        Sample((std::string(name) + "_sum").c_str(), "", snapshot.sum * scale);
+        Sample((std::string(name) + "_count").c_str(), "", static_cast<double>(snapshot.count));
+    }
+
+    void Writer::Summary(const char* name, const char* help, const LatencyHistogramArray& histograms,
+        double scale)
+    {
+        static const double percentiles[] = {50.0, 99.0, 99.9};
+        static const char* const quantiles[] = {"0.5", "0.99", "0.999"};
+
+        Type(name, help, "summary");
+
+        const std::string sum_name = std::string(name) + "_sum";
+        const std::string count_name = std::string(name) + "_count";
+        LatencyHistogram::Snapshot snapshot;
+        for (size_t i = 0; i < histograms.size(); i++) {
+            if (!histograms.GetSnapshot(i, &snapshot)) {
+                continue;
+            }
+
+            const std::string label = FormatHeaderLabel(i);
+            for (size_t j = 0; j < sizeof(percentiles) / sizeof(percentiles[0]); j++) {
+                Sample(name, label + ",quantile=\"" + quantiles[j] + "\"",
+                    snapshot.GetPercentile(percentiles[j]) * scale);
+            }
+            Sample(sum_name.c_str(), label, snapshot.sum * scale);
+            Sample(count_name.c_str(), label, static_cast<double>(snapshot.count));
+        }
+    }
+
+    void Writer::Type(const char* name, const char* help, const char* type)
+    {
+        *out_ += "# HELP ";
+        *out_ += name;
+        *out_ += " ";
+        *out_ += help;
+        *out_ += "\n# TYPE ";
+        *out_ += name;
+        *out_ += " ";
+        *out_ += type;
+        *out_ += "\n";
+    }
+
+    void Writer::Sample(const char* name, const std::string& labels, double value)
+    {
+        *out_ += name;
+        if (!labels.empty()) {
+            *out_ += "{" + labels + "}";
+        }
+        *out_ += " " + FormatNumber(value) + "\n";
+    }
+
+    Metrics::Metrics() :
+        next_collector_id_(1)
+    {
+    }
+
+    Metrics& Metrics::getInstance()
+    {
+        static Metrics instance;
+        return instance;
+    }
+
+    int Metrics::AddCollector(const Collector& collector)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        int id = next_collector_id_++;
+        collectors_.push_back(std::make_pair(id, collector));
+        return id;
+    }
+
+    void Metrics::RemoveCollector(int id)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        for (auto it = collectors_.begin(); it != collectors_.end(); ++it) {
+            if (it->first == id) {
+                collectors_.erase(it);
+                break;
+            }
+        }
+    }
+
+    std::string Metrics::Export()
+    {
+        std::string out;
+        out.reserve(16 * 1024);
+        Writer writer(&out);
+
+        writer.Counter("mmo_session_received_bytes_total", "Bytes received over TCP.", bytes_received.Value());
+        writer.Counter("mmo_session_sent_bytes_total", "Bytes sent over TCP.", bytes_sent.Value());
+
+        writer.Type("mmo_session_received_commands_total", "Commands received per header.", "counter");
+        for (size_t i = 0; i < commands_received.size(); i++) {
+            if (uint64_t value = commands_received.Value(i)) {
+                writer.Sample("mmo_session_received_commands_total", FormatHeaderLabel(i), static_cast<double>(value));
+            }
+        }
+
+        writer.Type("mmo_session_sent_commands_total", "Commands sent per header.", "counter");
+        for (size_t i = 0; i < commands_sent.size(); i++) {
+            if (uint64_t value = commands_sent.Value(i)) {
+                writer.Sample("mmo_session_sent_commands_total", FormatHeaderLabel(i), static_cast<double>(value));
+            }
+        }
+
+        writer.Counter("mmo_session_compress_input_bytes_total",
+            "Bytes given to LZ4 compression.", compress_input_bytes.Value());
+        writer.Counter("mmo_session_compress_output_bytes_total",
+            "Bytes produced by LZ4 compression.", compress_output_bytes.Value());
+        writer.Histogram("mmo_session_send_queue_depth",
+            "Send queue length when a message is queued.", send_queue_depth);
+
+        writer.Counter("mmo_server_accepted_sessions_total", "Accepted TCP sessions.", sessions_accepted.Value());
+        writer.Counter("mmo_server_blocked_sessions_total", "Sessions refused by the address filter.",
+            sessions_blocked.Value());
+        writer.Counter("mmo_server_closed_sessions_total", "Sessions closed by a connection error.",
+            sessions_closed.Value());
+        writer.Counter("mmo_server_udp_packets_total", "UDP packets received.", udp_packets_received.Value());
+        writer.Histogram("mmo_server_handshake_seconds",
+            "Time from accept to the start of the encrypted session.", handshake_time, 1e-6);
+        writer.Histogram("mmo_server_event_loop_lag_seconds",
+            "Delay of the tick timer behind its deadline.", event_loop_lag, 1e-6);
+        writer.Histogram("mmo_dispatch_seconds",
+            "Time spent in command handlers.", dispatch_time, 1e-6);
+        writer.Summary("mmo_command_receive_latency_seconds",
+            "Time from frame arrival to the end of its handler.", receive_latency, 1e-6);
+        writer.Summary("mmo_command_send_latency_seconds",
+            "Time from Send to the completion of the socket write.", send_latency, 1e-6);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        BOOST_FOREACH(const auto& collector, collectors_) {
+            collector.second(&writer);
+        }
+
+        return out;
+    }
+
+}
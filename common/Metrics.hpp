@@ -0,0 +1,255 @@
+//
+// Metrics.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <boost/thread.hpp>
+
+// カウンタを分ける数 (スレッドごとに別の要素へ加算する)
+#define METRICS_SHARDS (8)
+
+// ヒストグラムの区間数 (区間iは 2^(i-1) 以上 2^i 未満、区間0は0)
+#define METRICS_HISTOGRAM_BUCKETS (40)
+
+#define METRICS_CACHE_LINE (64)
+
+// 遅延ヒストグラムの精度 (2のべき乗の区間をそれぞれ 2^(bits-1) 等分する、相対誤差は 1/16 以下)
+#define METRICS_LATENCY_SUB_BUCKET_BITS (5)
+// 遅延ヒストグラムで区別する最大値のビット数 (これより大きい値は最後の区間に入れる)
+#define METRICS_LATENCY_MAX_BITS (32)
+#define METRICS_LATENCY_BUCKETS ((1 << METRICS_LATENCY_SUB_BUCKET_BITS) + \
+    (METRICS_LATENCY_MAX_BITS - METRICS_LATENCY_SUB_BUCKET_BITS) * (1 << (METRICS_LATENCY_SUB_BUCKET_BITS - 1)))
+
+namespace metrics {
+
+    // 呼び出し元スレッドの要素番号
+    size_t GetShardIndex();
+
+    // 単調増加するカウンタ
+    class Counter {
+        public:
+            Counter();
+
+            void Add(uint64_t value = 1)
+            {
+                shards_[GetShardIndex()].value.fetch_add(value, std::memory_order_relaxed);
+            }
+
+            uint64_t Value() const;
+
+        private:
+            struct Shard {
+                std::atomic<uint64_t> value;
+                char padding[METRICS_CACHE_LINE - sizeof(std::atomic<uint64_t>)];
+            };
+            Shard shards_[METRICS_SHARDS];
+    };
+
+    // コマンドヘッダーなど、番号ごとのカウンタ
+    template<size_t Size>
+    class CounterArray {
+        public:
+            CounterArray()
+            {
+                for (size_t i = 0; i < METRICS_SHARDS; i++) {
+                    for (size_t j = 0; j < Size; j++) {
+                        shards_[i].values[j].store(0, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            void Add(size_t index, uint64_t value = 1)
+            {
+                if (index < Size) {
+                    shards_[GetShardIndex()].values[index].fetch_add(value, std::memory_order_relaxed);
+                }
+            }
+
+            uint64_t Value(size_t index) const
+            {
+                uint64_t sum = 0;
+                for (size_t i = 0; i < METRICS_SHARDS; i++) {
+                    sum += shards_[i].values[index].load(std::memory_order_relaxed);
+                }
+                return sum;
+            }
+
+            size_t size() const { return Size; }
+
+        private:
+            struct Shard {
+                std::atomic<uint64_t> values[Size];
+                char padding[METRICS_CACHE_LINE];
+            };
+            Shard shards_[METRICS_SHARDS];
+    };
+
+    class Gauge {
+        public:
+            Gauge() : value_(0) {}
+
+            void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+            void Add(int64_t value) { value_.fetch_add(value, std::memory_order_relaxed); }
+            int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+        private:
+            std::atomic<int64_t> value_;
+    };
+
+    // 2のべき乗の区間で数えるヒストグラム
+    class Histogram {
+        public:
+            struct Snapshot {
+                uint64_t counts[METRICS_HISTOGRAM_BUCKETS];
+                uint64_t count;
+                uint64_t sum;
+            };
+
+            Histogram();
+
+            void Record(uint64_t value);
+            void GetSnapshot(Snapshot* snapshot) const;
+
+            // 区間iに入る値の上限 (この値を含む)
+            static uint64_t GetUpperBound(size_t bucket);
+
+        private:
+            struct Shard {
+                std::atomic<uint64_t> counts[METRICS_HISTOGRAM_BUCKETS];
+                std::atomic<uint64_t> sum;
+                char padding[METRICS_CACHE_LINE];
+            };
+            Shard shards_[METRICS_SHARDS];
+    };
+
+    // 対数線形の区間で数える遅延ヒストグラム (HDRヒストグラムと同じ区間の分け方)
+    // 小さい値は1刻み、それ以上は2のべき乗ごとに同じ数の区間に分けるので、大きさによらず相対誤差が一定になる
+    // 使用するメモリは固定で、記録はロックを使わない
+    class LatencyHistogram {
+        public:
+            struct Snapshot {
+                uint64_t counts[METRICS_LATENCY_BUCKETS];
+                uint64_t count;
+                uint64_t sum;
+
+                void Clear();
+                void Add(const Snapshot& snapshot);
+                void Subtract(const Snapshot& snapshot);
+
+                // percentileは0～100、結果は区間の上限
+                uint64_t GetPercentile(double percentile) const;
+            };
+
+            LatencyHistogram();
+
+            void Record(uint64_t value);
+            void GetSnapshot(Snapshot* snapshot) const;
+
+            static size_t GetBucket(uint64_t value);
+            static uint64_t GetUpperBound(size_t bucket);
+
+        private:
+            std::atomic<uint64_t> counts_[METRICS_LATENCY_BUCKETS];
+            std::atomic<uint64_t> sum_;
+    };
+
+    // コマンドヘッダーごとの遅延ヒストグラム
+    // 各ヒストグラムは最初に記録した時に確保し、以後は解放しない
+    class LatencyHistogramArray {
+        public:
+            LatencyHistogramArray();
+            ~LatencyHistogramArray();
+
+            void Record(size_t index, uint64_t value);
+
+            // 一度も記録していない場合はfalse
+            bool GetSnapshot(size_t index, LatencyHistogram::Snapshot* snapshot) const;
+
+            size_t size() const { return 256; }
+
+        private:
+            LatencyHistogramArray(const LatencyHistogramArray&);
+
+            std::atomic<LatencyHistogram*> histograms_[256];
+    };
+
+    // Prometheusのテキスト形式で書き出す
+    class Writer {
+        public:
+            Writer(std::string* out);
+
+            void Counter(const char* name, const char* help, uint64_t value);
+            void Gauge(const char* name, const char* help, double value);
+
+            // scaleは記録した値を出力の単位に直す係数 (マイクロ秒を秒にする場合は 1e-6)
+            void Histogram(const char* name, const char* help, const metrics::Histogram& histogram,
+                double scale = 1.0);
+
+            // ヘッダーごとに p50, p99, p99.9 をsummaryとして出力する
+            void Summary(const char* name, const char* help, const LatencyHistogramArray& histograms,
+                double scale = 1.0);
+
+            // ラベル付きの系列は、TYPE行の後に値を並べる
+            void Type(const char* name, const char* help, const char* type);
+            void Sample(const char* name, const std::string& labels, double value);
+
+        private:
+            std::string* out_;
+    };
+
+    // プロセス全体の計測値
+    // 値の更新はどのスレッドからでも良いが、Collectorは書き出すスレッドで呼ばれる
+    class Metrics {
+        public:
+            typedef std::function<void(Writer*)> Collector;
+
+            static Metrics& getInstance();
+
+            // Collectorの登録と解除 (登録側が先に破棄される場合は解除すること)
+            int AddCollector(const Collector& collector);
+            void RemoveCollector(int id);
+
+            std::string Export();
+
+        public:
+            // セッション
+            Counter bytes_received;
+            Counter bytes_sent;
+            CounterArray<256> commands_received;
+            CounterArray<256> commands_sent;
+            Counter compress_input_bytes;
+            Counter compress_output_bytes;
+            Histogram send_queue_depth;
+
+            // サーバー
+            Counter sessions_accepted;
+            Counter sessions_blocked;
+            Counter sessions_closed;
+            Counter udp_packets_received;
+            Histogram handshake_time;
+            Histogram event_loop_lag;
+            Histogram dispatch_time;
+
+            // コマンドヘッダーごとの遅延 (マイクロ秒)
+            // receive_latency: フレームの受信から、ハンドラの処理が終わるまで
+            // send_latency: Sendの呼び出しから、async_writeが完了するまで
+            LatencyHistogramArray receive_latency;
+            LatencyHistogramArray send_latency;
+
+        private:
+            Metrics();
+            Metrics(const Metrics&);
+
+            boost::mutex mutex_;
+            int next_collector_id_;
+            std::vector<std::pair<int, Collector>> collectors_;
+    };
+
+}
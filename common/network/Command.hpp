@@ -105,8 +105,8 @@ typedef boost::weak_ptr<Session> SessionWeakPtr;
 	typedef CommandTemplate0<header::ClientRequestedPublicKey>				ClientRequestedPublicKey;
 	typedef CommandTemplate0<header::ClientRequestedClientInfo>				ClientRequestedClientInfo;
 	typedef CommandTemplate0<header::ClientReceiveServerCrowdedError>		ClientReceiveServerCrowdedError;
-	typedef CommandTemplate0<header::ServerRequestedFullServerInfo>			ServerRequestedFullServerInfo;
 	typedef CommandTemplate0<header::ServerRequestedPlainFullServerInfo>	ServerRequestedPlainFullServerInfo;
+	typedef CommandTemplate0<header::ServerRequestedPositionKeyframe>		ServerRequestedPositionKeyframe;
 
 	typedef CommandTemplate1<header::ServerReceivePublicKey,
 		const std::string&>	ServerReceivePublicKey;
@@ -117,6 +117,34 @@ typedef boost::weak_ptr<Session> SessionWeakPtr;
 	typedef CommandTemplate6<header::ClientUpdatePlayerPosition,
 		uint32_t, int16_t, int16_t, int16_t, uint8_t, uint8_t> ClientUpdatePlayerPosition;
 
+	typedef CommandTemplate1<header::ClientUpdatePlayerPositionSnapshot,
+		const std::string&> ClientUpdatePlayerPositionSnapshot;
+
+	// 関心範囲から出たプレイヤーのID (uint32_tの並び)
+	typedef CommandTemplate1<header::ClientLeaveInterestRange,
+		const std::string&> ClientLeaveInterestRange;
+
+	typedef CommandTemplate1<header::ClientRequestedPing,
+		uint32_t> ClientRequestedPing;
+
+	typedef CommandTemplate1<header::ServerReceivePong,
+		uint32_t> ServerReceivePong;
+
+	typedef CommandTemplate3<header::ClientReceiveWorldSnapshot,
+		uint32_t, const std::string&, const std::string&> ClientReceiveWorldSnapshot;
+
+	typedef CommandTemplate2<header::ClientReceiveAccountRevisionPatchBatch,
+		uint32_t, const std::string&> ClientReceiveAccountRevisionPatchBatch;
+
+	typedef CommandTemplate1<header::ClientReceiveAccountRevisionUpdateNotifyBatch,
+		const std::string&> ClientReceiveAccountRevisionUpdateNotifyBatch;
+
+	typedef CommandTemplate3<header::ServerRequestedChatLog,
+		uint8_t, uint32_t, uint16_t> ServerRequestedChatLog;
+
+	typedef CommandTemplate4<header::ClientReceiveChatLog,
+		uint8_t, uint32_t, uint32_t, const std::string&> ClientReceiveChatLog;
+
 	typedef CommandTemplate5<header::ServerUpdatePlayerPosition,
 		int16_t, int16_t, int16_t, uint8_t, uint8_t> ServerUpdatePlayerPosition;
 
@@ -141,8 +169,8 @@ typedef boost::weak_ptr<Session> SessionWeakPtr;
 	typedef CommandTemplate1<header::ClientReceiveUnsupportVersionError,
 		uint32_t> ClientReceiveUnsupportVersionError;
 
-	typedef CommandTemplate1<header::ServerReceiveAccountInitializeData,
-		const std::string&> ServerReceiveAccountInitializeData;
+	typedef CommandTemplate2<header::ServerReceiveAccountInitializeData,
+		const std::string&, uint32_t> ServerReceiveAccountInitializeData;
 
 	typedef CommandTemplate1<header::ServerReceiveJSON,
 		const std::string&> ServerReceiveJSON;
@@ -153,6 +181,10 @@ typedef boost::weak_ptr<Session> SessionWeakPtr;
 	typedef CommandTemplate1<header::ClientReceiveServerInfo,
 		const std::string&> ClientReceiveServerInfo;
 
+	// 要求するサーバー情報の形式バージョン (古いクライアントは省略し、text_archive 形式を受け取る)
+	typedef CommandTemplate1<header::ServerRequestedFullServerInfo,
+		uint16_t> ServerRequestedFullServerInfo;
+
 	typedef CommandTemplate1<header::ClientReceiveFullServerInfo,
 		const std::string&> ClientReceiveFullServerInfo;
 
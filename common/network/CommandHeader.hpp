@@ -32,8 +32,18 @@ namespace header {
         ClientReceiveJSON =                         0x15,
         ServerRequestedFullServerInfo =             0x16,
         ClientReceiveFullServerInfo =               0x17,
+        ClientUpdatePlayerPositionSnapshot =        0x18,
+        ClientRequestedPing =                       0x19,
+        ServerReceivePong =                         0x1A,
+        ClientReceiveWorldSnapshot =                0x1B,
+        ClientReceiveAccountRevisionPatchBatch =    0x1C,
+        ClientReceiveAccountRevisionUpdateNotifyBatch = 0x1D,
+        ServerRequestedChatLog =                    0x1E,
+        ClientReceiveChatLog =                      0x1F,
 		
 		ServerReceiveWriteLimit =					0x20,
+        ServerRequestedPositionKeyframe =           0x21,
+        ClientLeaveInterestRange =                  0x22,
 		
         ServerRequestedPlainFullServerInfo =        0x40,
         ClientReceivePlainFullServerInfo =			0x41,
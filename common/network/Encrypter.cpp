@@ -6,9 +6,17 @@
 #include <sha.h>
 #include <whrlpool.h>
 #include <osrng.h>
+#include <misc.h>
+#include <string.h>
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <boost/thread.hpp>
 #include "Encrypter.hpp"
 #include "Utils.hpp"
 
+#define TRIP_CACHE_SIZE (1024)
+
 #ifdef _WIN32
 #pragma comment(lib, "cryptlib.lib")
 #endif
@@ -19,6 +27,87 @@ const int Encrypter::TRIP_LENGTH = 12;
 
 using namespace CryptoPP;
 
+namespace {
+
+    // 計算済みトリップのキャッシュ
+    // パスワードそのものは保持せず、起動ごとのソルトを加えたハッシュで引く
+    class TripCache {
+        public:
+            TripCache() : salt_(16, '\0')
+            {
+                AutoSeededRandomPool rnd;
+                rnd.GenerateBlock((byte*)&salt_[0], salt_.size());
+            }
+
+            std::string GetKey(const std::string& in) const
+            {
+                return Encrypter::GetHash(salt_ + in);
+            }
+
+            bool Find(const std::string& key, std::string* trip)
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+
+                auto it = index_.find(GetIndex(key));
+                if (it == index_.end()) {
+                    return false;
+                }
+
+                // 比較にかかる時間から一致した長さを推測されないようにする
+                auto entry = it->second;
+                if (entry->key.size() != key.size() ||
+                    !VerifyBufsEqual((const byte*)entry->key.data(), (const byte*)key.data(), key.size())) {
+                    return false;
+                }
+
+                entries_.splice(entries_.begin(), entries_, entry);
+                *trip = entry->trip;
+                return true;
+            }
+
+            void Add(const std::string& key, const std::string& trip)
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+
+                uint64_t index = GetIndex(key);
+                auto it = index_.find(index);
+                if (it != index_.end()) {
+                    entries_.erase(it->second);
+                    index_.erase(it);
+                }
+
+                Entry entry = {index, key, trip};
+                entries_.push_front(entry);
+                index_[index] = entries_.begin();
+
+                if (entries_.size() > TRIP_CACHE_SIZE) {
+                    index_.erase(entries_.back().index);
+                    entries_.pop_back();
+                }
+            }
+
+        private:
+            static uint64_t GetIndex(const std::string& key)
+            {
+                uint64_t index = 0;
+                memcpy(&index, key.data(), std::min(key.size(), sizeof(index)));
+                return index;
+            }
+
+            struct Entry {
+                uint64_t index;
+                std::string key;
+                std::string trip;
+            };
+
+            std::string salt_;
+            boost::mutex mutex_;
+            std::list<Entry> entries_;
+            std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    };
+
+}
+
 Encrypter::Encrypter()
 {
     AutoSeededRandomPool rnd;
@@ -179,7 +268,21 @@ std::string Encrypter::GetTripHash(const std::string& in)
     return std::string((char*)outbuf.get(), 64);
 }
 
+// CalculateTrip は20回の反復でSHA-512とWhirlpoolを計41回計算するので、結果をキャッシュする
 std::string Encrypter::GetTrip(const std::string& in)
+{
+    static TripCache cache;
+
+    std::string key = cache.GetKey(in);
+    std::string trip;
+    if (!cache.Find(key, &trip)) {
+        trip = CalculateTrip(in);
+        cache.Add(key, trip);
+    }
+    return trip;
+}
+
+std::string Encrypter::CalculateTrip(const std::string& in)
 {
     static const uint8_t trip_chars[] =
             "opt0uXE{WZABCcdvi&_gMrsmn9)<"
@@ -43,6 +43,7 @@ class Encrypter {
     private:
         std::string GetCommonKey();
         static std::string GetTripHash(const std::string&);
+        static std::string CalculateTrip(const std::string&);
 
     private:
         const static int TRIP_LENGTH;
@@ -0,0 +1,263 @@
+//
+// PositionCodec.cpp
+//
+
+#include "PositionCodec.hpp"
+#include <boost/foreach.hpp>
+
+namespace network {
+
+    namespace {
+        enum {
+            FRAME_KEYFRAME =    0x01,
+
+            FIELD_X =           0x01,
+            FIELD_Y =           0x02,
+            FIELD_Z =           0x04,
+            FIELD_THETA =       0x08,
+            FIELD_VY =          0x10,
+        };
+
+        // 登録済みのインデックスの場合は最下位ビットが0
+        const uint32_t NEW_INDEX_FLAG = 0x01;
+
+        void WriteVarint(std::string* out, uint32_t value)
+        {
+            while (value >= 0x80) {
+                *out += static_cast<char>((value & 0x7F) | 0x80);
+                value >>= 7;
+            }
+            *out += static_cast<char>(value);
+        }
+
+        bool ReadVarint(const std::string& in, size_t* offset, uint32_t* value)
+        {
+            uint32_t result = 0;
+            for (int shift = 0; shift < 35; shift += 7) {
+                if (*offset >= in.size()) {
+                    return false;
+                }
+                uint8_t byte = static_cast<uint8_t>(in[(*offset)++]);
+                result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    *value = result;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        uint32_t ZigZag(int32_t value)
+        {
+            return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+        }
+
+        int32_t UnZigZag(uint32_t value)
+        {
+            return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+        }
+
+        uint8_t GetChangedFields(const PlayerPosition& a, const PlayerPosition& b)
+        {
+            return (a.x != b.x ? FIELD_X : 0) |
+                (a.y != b.y ? FIELD_Y : 0) |
+                (a.z != b.z ? FIELD_Z : 0) |
+                (a.theta != b.theta ? FIELD_THETA : 0) |
+                (a.vy != b.vy ? FIELD_VY : 0);
+        }
+
+        // 差分は元の型の幅で折り返すので、どの値でも可逆
+        void WriteDelta16(std::string* out, int16_t value, int16_t base)
+        {
+            WriteVarint(out, ZigZag(static_cast<int16_t>(static_cast<uint16_t>(value - base))));
+        }
+
+        void WriteDelta8(std::string* out, uint8_t value, uint8_t base)
+        {
+            WriteVarint(out, ZigZag(static_cast<int8_t>(static_cast<uint8_t>(value - base))));
+        }
+
+        bool ReadDelta16(const std::string& in, size_t* offset, int16_t* value)
+        {
+            uint32_t delta;
+            if (!ReadVarint(in, offset, &delta)) {
+                return false;
+            }
+            *value = static_cast<int16_t>(static_cast<uint16_t>(*value + UnZigZag(delta)));
+            return true;
+        }
+
+        template<class T>
+        bool ReadDelta8(const std::string& in, size_t* offset, T* value)
+        {
+            uint32_t delta;
+            if (!ReadVarint(in, offset, &delta)) {
+                return false;
+            }
+            *value = static_cast<T>(static_cast<uint8_t>(*value + UnZigZag(delta)));
+            return true;
+        }
+    }
+
+    PositionEncoder::PositionEncoder(int keyframe_interval) :
+        keyframe_interval_(keyframe_interval),
+        frame_count_(0),
+        next_index_(0),
+        last_timestamp_(0)
+    {
+    }
+
+    void PositionEncoder::Reset()
+    {
+        frame_count_ = 0;
+        next_index_ = 0;
+        last_timestamp_ = 0;
+        baselines_.clear();
+    }
+
+    std::string PositionEncoder::Encode(const std::vector<UserPosition>& positions, uint32_t timestamp)
+    {
+        uint8_t frame_flags = 0;
+        if (frame_count_ % keyframe_interval_ == 0) {
+            Reset();
+            frame_flags |= FRAME_KEYFRAME;
+        }
+        frame_count_++;
+
+        std::string out;
+        out.reserve(2 + positions.size() * 6);
+        out += static_cast<char>(frame_flags);
+        WriteVarint(&out, timestamp - last_timestamp_);
+        WriteVarint(&out, positions.size());
+        last_timestamp_ = timestamp;
+
+        BOOST_FOREACH(const auto& item, positions) {
+            const uint32_t user_id = item.first;
+            const PlayerPosition& pos = item.second;
+
+            auto it = baselines_.find(user_id);
+            if (it == baselines_.end()) {
+                Baseline baseline;
+                baseline.index = next_index_++;
+                it = baselines_.insert(std::make_pair(user_id, baseline)).first;
+
+                WriteVarint(&out, (it->second.index << 1) | NEW_INDEX_FLAG);
+                WriteVarint(&out, user_id);
+            } else {
+                WriteVarint(&out, it->second.index << 1);
+            }
+
+            PlayerPosition& base = it->second.pos;
+            uint8_t fields = GetChangedFields(pos, base);
+            out += static_cast<char>(fields);
+
+            if (fields & FIELD_X)       WriteDelta16(&out, pos.x, base.x);
+            if (fields & FIELD_Y)       WriteDelta16(&out, pos.y, base.y);
+            if (fields & FIELD_Z)       WriteDelta16(&out, pos.z, base.z);
+            if (fields & FIELD_THETA)   WriteDelta8(&out, pos.theta, base.theta);
+            if (fields & FIELD_VY)      WriteDelta8(&out, pos.vy, base.vy);
+
+            base = pos;
+        }
+
+        return out;
+    }
+
+    PositionDecoder::PositionDecoder() :
+        synchronized_(false),
+        last_timestamp_(0)
+    {
+    }
+
+    void PositionDecoder::Reset()
+    {
+        synchronized_ = false;
+        last_timestamp_ = 0;
+        baselines_.clear();
+    }
+
+    bool PositionDecoder::synchronized() const
+    {
+        return synchronized_;
+    }
+
+    bool PositionDecoder::Decode(const std::string& data, std::vector<UserPosition>* positions,
+        uint32_t* timestamp)
+    {
+        if (data.empty()) {
+            Reset();
+            return false;
+        }
+
+        if (static_cast<uint8_t>(data[0]) & FRAME_KEYFRAME) {
+            Reset();
+            synchronized_ = true;
+        } else if (!synchronized_) {
+            return false;
+        }
+
+        // 途中で失敗した場合は、復号済みの分も信用できないので取り消す
+        const size_t size = positions->size();
+        if (!DecodeFrame(data, positions, timestamp)) {
+            positions->resize(size);
+            Reset();
+            return false;
+        }
+        return true;
+    }
+
+    bool PositionDecoder::DecodeFrame(const std::string& data, std::vector<UserPosition>* positions,
+        uint32_t* timestamp)
+    {
+        size_t offset = 1;
+
+        uint32_t timestamp_delta, count;
+        if (!ReadVarint(data, &offset, &timestamp_delta) || !ReadVarint(data, &offset, &count)) {
+            return false;
+        }
+
+        last_timestamp_ += timestamp_delta;
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t index;
+            if (!ReadVarint(data, &offset, &index)) {
+                return false;
+            }
+
+            const bool new_index = (index & NEW_INDEX_FLAG) != 0;
+            index >>= 1;
+
+            if (new_index) {
+                uint32_t user_id;
+                if (!ReadVarint(data, &offset, &user_id) || index != baselines_.size()) {
+                    return false;
+                }
+                baselines_.push_back(UserPosition(user_id, PlayerPosition()));
+            } else if (index >= baselines_.size()) {
+                return false;
+            }
+
+            if (offset >= data.size()) {
+                return false;
+            }
+            uint8_t fields = static_cast<uint8_t>(data[offset++]);
+
+            PlayerPosition& pos = baselines_[index].second;
+            if (((fields & FIELD_X)     && !ReadDelta16(data, &offset, &pos.x)) ||
+                ((fields & FIELD_Y)     && !ReadDelta16(data, &offset, &pos.y)) ||
+                ((fields & FIELD_Z)     && !ReadDelta16(data, &offset, &pos.z)) ||
+                ((fields & FIELD_THETA) && !ReadDelta8(data, &offset, &pos.theta)) ||
+                ((fields & FIELD_VY)    && !ReadDelta8(data, &offset, &pos.vy))) {
+                return false;
+            }
+
+            positions->push_back(baselines_[index]);
+        }
+
+        if (timestamp) {
+            *timestamp = last_timestamp_;
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,69 @@
+//
+// PositionCodec.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "../database/AccountProperty.hpp"
+
+#define POSITION_KEYFRAME_INTERVAL (64)
+
+namespace network {
+
+    typedef std::pair<uint32_t, PlayerPosition> UserPosition;
+
+    // 位置情報スナップショットの差分符号化
+    //
+    // ユーザーIDは受信側ごとのインデックスに置き換え、各フィールドは
+    // 前回送信した値との差分を変更ビットマスクとともに可変長整数で送る。
+    // TCP上で順序どおりに届くため、前回送信した値を受信側の確定値とみなす。
+    // 一定間隔でキーフレームを送り、基準値をリセットする。
+    // 各フレームにはサーバー時刻 (ミリ秒) を前フレームとの差分で付加する。
+    class PositionEncoder {
+        public:
+            PositionEncoder(int keyframe_interval = POSITION_KEYFRAME_INTERVAL);
+
+            std::string Encode(const std::vector<UserPosition>& positions, uint32_t timestamp);
+            void Reset();
+
+        private:
+            struct Baseline {
+                uint32_t index;
+                PlayerPosition pos;
+            };
+
+            int keyframe_interval_;
+            int frame_count_;
+            uint32_t next_index_;
+            uint32_t last_timestamp_;
+            std::unordered_map<uint32_t, Baseline> baselines_;
+    };
+
+    // 復号に失敗した場合は基準値が送信側とずれているので、次のキーフレームまでのフレームは捨てる
+    class PositionDecoder {
+        public:
+            PositionDecoder();
+
+            // 失敗した場合と、キーフレームを待っている間はfalseを返し、positionsには何も追加しない
+            bool Decode(const std::string& data, std::vector<UserPosition>* positions,
+                uint32_t* timestamp = nullptr);
+            void Reset();
+
+            // キーフレームを受信済みで、以後の復号に失敗していない
+            bool synchronized() const;
+
+        private:
+            bool DecodeFrame(const std::string& data, std::vector<UserPosition>* positions,
+                uint32_t* timestamp);
+
+        private:
+            bool synchronized_;
+            uint32_t last_timestamp_;
+            std::vector<UserPosition> baselines_;
+    };
+
+}
@@ -0,0 +1,356 @@
+//
+// ServerInfo.cpp
+//
+
+#include "ServerInfo.hpp"
+#include <sstream>
+#include <string.h>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/property_tree/ptree_serialization.hpp>
+
+namespace network {
+
+    namespace {
+        const char MAGIC[] = "MMOI";
+        const size_t MAGIC_SIZE = 4;
+
+        enum {
+            WARP_DESTINATION = 0x01,
+        };
+
+        class Writer {
+            public:
+                void Varint(uint32_t value)
+                {
+                    while (value >= 0x80) {
+                        out_ += static_cast<char>((value & 0x7F) | 0x80);
+                        value >>= 7;
+                    }
+                    out_ += static_cast<char>(value);
+                }
+
+                void Int(int value)
+                {
+                    Varint((static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+                }
+
+                void Byte(uint8_t value)
+                {
+                    out_ += static_cast<char>(value);
+                }
+
+                void Float(float value)
+                {
+                    uint32_t bits;
+                    memcpy(&bits, &value, sizeof(bits));
+                    for (int shift = 24; shift >= 0; shift -= 8) {
+                        out_ += static_cast<char>((bits >> shift) & 0xFF);
+                    }
+                }
+
+                void String(const std::string& value)
+                {
+                    Varint(value.size());
+                    out_ += value;
+                }
+
+                std::string& out() { return out_; }
+
+            private:
+                std::string out_;
+        };
+
+        // 範囲外を読もうとした場合はfalseを返す
+        class Reader {
+            public:
+                Reader(const std::string& data, size_t offset) :
+                    data_(data), offset_(offset) {}
+
+                bool Varint(uint32_t* value)
+                {
+                    uint32_t result = 0;
+                    for (int shift = 0; shift < 35; shift += 7) {
+                        if (offset_ >= data_.size()) {
+                            return false;
+                        }
+                        uint8_t byte = static_cast<uint8_t>(data_[offset_++]);
+                        result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                        if (!(byte & 0x80)) {
+                            *value = result;
+                            return true;
+                        }
+                    }
+                    return false;
+                }
+
+                bool Int(int* value)
+                {
+                    uint32_t raw;
+                    if (!Varint(&raw)) {
+                        return false;
+                    }
+                    *value = static_cast<int>(static_cast<int32_t>(raw >> 1) ^ -static_cast<int32_t>(raw & 1));
+                    return true;
+                }
+
+                bool Byte(uint8_t* value)
+                {
+                    if (offset_ >= data_.size()) {
+                        return false;
+                    }
+                    *value = static_cast<uint8_t>(data_[offset_++]);
+                    return true;
+                }
+
+                bool Float(float* value)
+                {
+                    if (data_.size() - offset_ < sizeof(uint32_t)) {
+                        return false;
+                    }
+                    uint32_t bits = 0;
+                    for (int i = 0; i < 4; i++) {
+                        bits = (bits << 8) | static_cast<uint8_t>(data_[offset_++]);
+                    }
+                    memcpy(value, &bits, sizeof(bits));
+                    return true;
+                }
+
+                bool String(std::string* value)
+                {
+                    uint32_t size;
+                    if (!Varint(&size) || data_.size() - offset_ < size) {
+                        return false;
+                    }
+                    value->assign(data_, offset_, size);
+                    offset_ += size;
+                    return true;
+                }
+
+                // 要素数は残りのバイト数を超えない
+                bool Count(uint32_t* count)
+                {
+                    return Varint(count) && *count <= data_.size() - offset_;
+                }
+
+            private:
+                const std::string& data_;
+                size_t offset_;
+        };
+    }
+
+    std::string ServerInfo::Serialize() const
+    {
+        Writer writer;
+        writer.out().reserve(256 + players.size() * 32);
+        writer.out().append(MAGIC, MAGIC_SIZE);
+        writer.Byte(SERVER_INFO_FORMAT_VERSION >> 8);
+        writer.Byte(SERVER_INFO_FORMAT_VERSION & 0xFF);
+
+        writer.String(name);
+        writer.String(note);
+        writer.String(stage);
+        writer.Int(capacity);
+        writer.String(version);
+        writer.Int(protocol_version);
+        writer.Int(rtt_50);
+        writer.Int(rtt_90);
+        writer.Int(rtt_99);
+
+        writer.Varint(channels.size());
+        BOOST_FOREACH(const auto& channel, channels) {
+            writer.Varint(channel.id);
+            writer.String(channel.name);
+            writer.String(channel.stage);
+            writer.Int(channel.capacity);
+
+            writer.Varint(channel.warp_points.size());
+            BOOST_FOREACH(const auto& point, channel.warp_points) {
+                writer.Byte(point.channel);
+                writer.Byte(point.has_destination ? WARP_DESTINATION : 0);
+                writer.Float(point.x);
+                writer.Float(point.y);
+                writer.Float(point.z);
+                if (point.has_destination) {
+                    writer.Float(point.dest_x);
+                    writer.Float(point.dest_y);
+                    writer.Float(point.dest_z);
+                }
+            }
+        }
+
+        writer.Varint(players.size());
+        BOOST_FOREACH(const auto& player, players) {
+            writer.String(player.name);
+            writer.String(player.model_name);
+        }
+
+        return writer.out();
+    }
+
+    bool ServerInfo::Deserialize(const std::string& data)
+    {
+        if (!IsBinary(data)) {
+            return false;
+        }
+
+        // 上位バージョンの形式は末尾に項目が追加されたものとして読む
+        uint16_t format_version = (static_cast<uint8_t>(data[MAGIC_SIZE]) << 8) |
+            static_cast<uint8_t>(data[MAGIC_SIZE + 1]);
+        if (format_version < 1) {
+            return false;
+        }
+
+        Reader reader(data, MAGIC_SIZE + 2);
+        ServerInfo info;
+
+        if (!reader.String(&info.name) ||
+            !reader.String(&info.note) ||
+            !reader.String(&info.stage) ||
+            !reader.Int(&info.capacity) ||
+            !reader.String(&info.version) ||
+            !reader.Int(&info.protocol_version) ||
+            !reader.Int(&info.rtt_50) ||
+            !reader.Int(&info.rtt_90) ||
+            !reader.Int(&info.rtt_99)) {
+            return false;
+        }
+
+        uint32_t channel_count;
+        if (!reader.Count(&channel_count)) {
+            return false;
+        }
+        info.channels.resize(channel_count);
+        BOOST_FOREACH(auto& channel, info.channels) {
+            uint32_t point_count;
+            if (!reader.Varint(&channel.id) ||
+                !reader.String(&channel.name) ||
+                !reader.String(&channel.stage) ||
+                !reader.Int(&channel.capacity) ||
+                !reader.Count(&point_count)) {
+                return false;
+            }
+
+            channel.warp_points.resize(point_count);
+            BOOST_FOREACH(auto& point, channel.warp_points) {
+                uint8_t flags;
+                if (!reader.Byte(&point.channel) ||
+                    !reader.Byte(&flags) ||
+                    !reader.Float(&point.x) ||
+                    !reader.Float(&point.y) ||
+                    !reader.Float(&point.z)) {
+                    return false;
+                }
+                point.has_destination = (flags & WARP_DESTINATION) != 0;
+                if (point.has_destination) {
+                    if (!reader.Float(&point.dest_x) ||
+                        !reader.Float(&point.dest_y) ||
+                        !reader.Float(&point.dest_z)) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        uint32_t player_count;
+        if (!reader.Count(&player_count)) {
+            return false;
+        }
+        info.players.resize(player_count);
+        BOOST_FOREACH(auto& player, info.players) {
+            if (!reader.String(&player.name) || !reader.String(&player.model_name)) {
+                return false;
+            }
+        }
+
+        *this = info;
+        return true;
+    }
+
+    void ServerInfo::Load(const boost::property_tree::ptree& pt)
+    {
+        using namespace boost::property_tree;
+
+        name = pt.get<std::string>("config.server_name", "");
+        note = pt.get<std::string>("config.server_note", "");
+        stage = pt.get<std::string>("config.stage", "");
+        capacity = pt.get<int>("config.capacity", 0);
+        version = pt.get<std::string>("version", "");
+        protocol_version = pt.get<int>("protocol_version", 0);
+        rtt_50 = pt.get<int>("rtt.p50", 0);
+        rtt_90 = pt.get<int>("rtt.p90", 0);
+        rtt_99 = pt.get<int>("rtt.p99", 0);
+
+        LoadChannels(pt.get_child("channels", ptree()));
+
+        players.clear();
+        BOOST_FOREACH(const auto& item, pt.get_child("players", ptree())) {
+            Player player;
+            player.name = item.second.get<std::string>("name", "");
+            player.model_name = item.second.get<std::string>("model_name", "");
+            players.push_back(player);
+        }
+    }
+
+    void ServerInfo::LoadChannels(const boost::property_tree::ptree& pt)
+    {
+        using namespace boost::property_tree;
+
+        channels.clear();
+        BOOST_FOREACH(const auto& item, pt) {
+            // チャンネルのキーは "ch000" 形式
+            Channel channel;
+            try {
+                channel.id = boost::lexical_cast<uint32_t>(item.first.substr(2));
+            } catch (const std::exception&) {
+                continue;
+            }
+            channel.name = item.second.get<std::string>("name", "");
+            channel.stage = item.second.get<std::string>("stage", "");
+            channel.capacity = item.second.get<int>("capacity", 0);
+
+            BOOST_FOREACH(const auto& warp_point, item.second.get_child("warp_points", ptree())) {
+                WarpPoint point;
+                point.channel = warp_point.second.get<unsigned char>("channel", 0);
+                point.x = warp_point.second.get<float>("position.x", 0);
+                point.y = warp_point.second.get<float>("position.y", 0);
+                point.z = warp_point.second.get<float>("position.z", 0);
+                if (!warp_point.second.get_child("destination", ptree()).empty()) {
+                    point.has_destination = true;
+                    point.dest_x = warp_point.second.get<float>("destination.x", 0);
+                    point.dest_y = warp_point.second.get<float>("destination.y", 0);
+                    point.dest_z = warp_point.second.get<float>("destination.z", 0);
+                }
+                channel.warp_points.push_back(point);
+            }
+            channels.push_back(channel);
+        }
+    }
+
+    bool ServerInfo::LoadText(const std::string& data)
+    {
+        boost::property_tree::ptree pt;
+        try {
+            std::stringstream stream(data);
+            boost::archive::text_iarchive ia(stream);
+            ia >> pt;
+        } catch (const std::exception&) {
+            return false;
+        }
+        Load(pt);
+        return true;
+    }
+
+    bool ServerInfo::Parse(const std::string& data)
+    {
+        return IsBinary(data) ? Deserialize(data) : LoadText(data);
+    }
+
+    bool ServerInfo::IsBinary(const std::string& data)
+    {
+        return data.size() >= MAGIC_SIZE + 2 && data.compare(0, MAGIC_SIZE, MAGIC) == 0;
+    }
+
+}
@@ -0,0 +1,73 @@
+//
+// ServerInfo.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/property_tree/ptree.hpp>
+
+#define SERVER_INFO_FORMAT_VERSION (1)
+
+namespace network {
+
+    // ClientReceiveFullServerInfo の内容
+    //
+    // バイナリ形式は "MMOI" + 形式バージョン (2byte) に続けて、
+    // 整数を可変長整数、文字列を長さ付き、座標をfloatのビッグエンディアンで並べる。
+    // 形式バージョンを要求しない古いクライアントには、従来どおり
+    // property_tree の text_archive を送るので、その読み込みにも対応する。
+    struct ServerInfo {
+        struct WarpPoint {
+            WarpPoint() : channel(0), x(0), y(0), z(0), has_destination(false),
+                dest_x(0), dest_y(0), dest_z(0) {}
+
+            uint8_t channel;
+            float x, y, z;
+            bool has_destination;
+            float dest_x, dest_y, dest_z;
+        };
+
+        struct Channel {
+            Channel() : id(0), capacity(0) {}
+
+            uint32_t id;
+            std::string name;
+            std::string stage;
+            int capacity;
+            std::vector<WarpPoint> warp_points;
+        };
+
+        struct Player {
+            std::string name;
+            std::string model_name;
+        };
+
+        ServerInfo() : capacity(0), protocol_version(0), rtt_50(0), rtt_90(0), rtt_99(0) {}
+
+        std::string name;
+        std::string note;
+        std::string stage;
+        int capacity;
+        std::string version;
+        int protocol_version;
+        int rtt_50, rtt_90, rtt_99;
+        std::vector<Channel> channels;
+        std::vector<Player> players;
+
+        std::string Serialize() const;
+        bool Deserialize(const std::string& data);
+
+        // text_archive 形式の property_tree から読み込む
+        void Load(const boost::property_tree::ptree& pt);
+        void LoadChannels(const boost::property_tree::ptree& pt);
+        bool LoadText(const std::string& data);
+
+        // バイナリ形式ならDeserialize、それ以外はLoadTextで読み込む
+        bool Parse(const std::string& data);
+        static bool IsBinary(const std::string& data);
+    };
+
+}
@@ -7,8 +7,11 @@
 #include "Session.hpp"
 #include "Utils.hpp"
 #include "../Logger.hpp"
+#include "../Metrics.hpp"
 #include <boost/make_shared.hpp>
 #include <string>
+#include <cmath>
+#include <algorithm>
 
 namespace network {
 
@@ -25,6 +28,8 @@ namespace network {
       serialized_byte_sum_(0),
       compressed_byte_sum_(0),
 	  write_average_limit_(999999),
+	  round_trip_time_(0),
+	  round_trip_jitter_(0),
       id_(0),
 	  channel_(0)
     {
@@ -49,7 +54,13 @@ namespace network {
 
 		// Logger::Debug(_T("%d byte/s"), GetWriteByteAverage()); ※ 
 
-        io_service_tcp_.post(boost::bind(&Session::DoWriteTCP, this, msg, shared_from_this()));
+        auto& stats = metrics::Metrics::getInstance();
+        stats.bytes_sent.Add(msg.size());
+        stats.commands_sent.Add(command.header());
+
+        io_service_tcp_.post(boost::bind(&Session::DoWriteTCP, this, msg,
+            static_cast<uint8_t>(command.header()), boost::posix_time::microsec_clock::universal_time(),
+            shared_from_this()));
     }
 
     void Session::SyncSend(const Command& command)
@@ -58,10 +69,17 @@ namespace network {
         write_byte_sum_ += msg.size();
         UpdateWriteByteAverage();
 
+        auto& stats = metrics::Metrics::getInstance();
+        stats.bytes_sent.Add(msg.size());
+        stats.commands_sent.Add(command.header());
+
         try {
+            auto send_time = boost::posix_time::microsec_clock::universal_time();
             boost::asio::write(
                     socket_tcp_, boost::asio::buffer(msg.data(), msg.size()),
                 boost::asio::transfer_all());
+            auto elapsed = boost::posix_time::microsec_clock::universal_time() - send_time;
+            stats.send_latency.Record(command.header(), std::max<int64_t>(0, elapsed.total_microseconds()));
         } catch (std::exception& e) {
             std::cout << e.what() << std::endl;
         }
@@ -108,6 +126,11 @@ namespace network {
     void Session::EnableEncryption()
     {
         encryption_ = true;
+
+        if (!accepted_time_.is_not_a_date_time()) {
+            auto elapsed = boost::posix_time::microsec_clock::universal_time() - accepted_time_;
+            metrics::Metrics::getInstance().handshake_time.Record(elapsed.total_microseconds());
+        }
     }
 
     Encrypter& Session::encrypter()
@@ -194,6 +217,33 @@ namespace network {
 		write_average_limit_ = limit;
 	}
 
+	size_t Session::send_queue_size() const
+	{
+		return send_queue_.size();
+	}
+
+	void Session::UpdateRoundTripTime(double rtt)
+	{
+		// RFC 6298 と同じ係数の指数移動平均
+		if (round_trip_time_ <= 0) {
+			round_trip_time_ = rtt;
+			round_trip_jitter_ = rtt / 2;
+		} else {
+			round_trip_jitter_ = 0.75 * round_trip_jitter_ + 0.25 * std::abs(round_trip_time_ - rtt);
+			round_trip_time_ = 0.875 * round_trip_time_ + 0.125 * rtt;
+		}
+	}
+
+	double Session::round_trip_time() const
+	{
+		return round_trip_time_;
+	}
+
+	double Session::round_trip_jitter() const
+	{
+		return round_trip_jitter_;
+	}
+
     std::string Session::Serialize(const Command& command, bool plain)
     {
         assert(command.header() < 0xFF);
@@ -209,6 +259,9 @@ namespace network {
 			// 圧縮
 			if (body.size() >= COMPRESS_MIN_LENGTH) {
 				auto compressed = Utils::LZ4Compress(msg);
+				auto& stats = metrics::Metrics::getInstance();
+				stats.compress_input_bytes.Add(msg.size());
+				stats.compress_output_bytes.Add(compressed.size());
 				if (msg.size() > compressed.size() + sizeof(uint8_t)) {
 					assert(msg.size() < 65535);
 					msg = Utils::Serialize(static_cast<uint8_t>(header::LZ4_COMPRESS_HEADER),
@@ -258,6 +311,8 @@ namespace network {
     void Session::ReceiveTCP(const boost::system::error_code& error)
     {
         if (!error) {
+            // 同時に届いたフレームは同じ時刻に受信したものとする
+            auto arrival_time = boost::posix_time::microsec_clock::universal_time();
             std::string buffer(boost::asio::buffer_cast<const char*>(receive_buf_.data()),receive_buf_.size());
             auto length = buffer.find_last_of(NETWORK_UTILS_DELIMITOR);
 
@@ -279,8 +334,9 @@ namespace network {
 
                     read_byte_sum_ += msg.size();
                     UpdateReadByteAverage();
+                    metrics::Metrics::getInstance().bytes_received.Add(msg.size());
 
-                    FetchTCP(msg);
+                    FetchTCP(msg, arrival_time);
                 }
 
                 boost::asio::async_read_until(socket_tcp_,
@@ -296,10 +352,13 @@ namespace network {
         }
     }
 
-    void Session::DoWriteTCP(const std::string msg, SessionPtr session_holder)
+    void Session::DoWriteTCP(const std::string msg, uint8_t header, const boost::posix_time::ptime& send_time,
+        SessionPtr session_holder)
     {
         bool write_in_progress = !send_queue_.empty();
-        send_queue_.push(msg);
+        PendingWrite pending = {msg, header, send_time};
+        send_queue_.push(pending);
+        metrics::Metrics::getInstance().send_queue_depth.Record(send_queue_.size());
         if (!write_in_progress && !send_queue_.empty())
         {
            
@@ -317,12 +376,18 @@ namespace network {
     {
         if (!error) {
             if (!send_queue_.empty()) {
+                  const PendingWrite& written = send_queue_.front();
+                  auto elapsed = boost::posix_time::microsec_clock::universal_time() - written.send_time;
+                  metrics::Metrics::getInstance().send_latency.Record(written.header,
+                      std::max<int64_t>(0, elapsed.total_microseconds()));
+
                   send_queue_.pop();
                   if (!send_queue_.empty())
                   {
 
+                    const std::string& data = send_queue_.front().data;
                     boost::shared_ptr<std::string> s = 
-                        boost::make_shared<std::string>(send_queue_.front().data(), send_queue_.front().size());
+                        boost::make_shared<std::string>(data.data(), data.size());
 
                     boost::asio::async_write(socket_tcp_,
                         boost::asio::buffer(s->data(), s->size()),
@@ -335,11 +400,17 @@ namespace network {
         }
     }
 
-    void Session::FetchTCP(const std::string& msg)
+    void Session::FetchTCP(const std::string& msg, const boost::posix_time::ptime& arrival_time)
     {
         if (msg.size() >= sizeof(uint8_t)) {
             if (on_receive_) {
-                (*on_receive_)(Deserialize(msg));
+                auto command = Deserialize(msg);
+                auto& stats = metrics::Metrics::getInstance();
+                stats.commands_received.Add(command.header());
+                (*on_receive_)(command);
+
+                auto elapsed = boost::posix_time::microsec_clock::universal_time() - arrival_time;
+                stats.receive_latency.Record(command.header(), std::max<int64_t>(0, elapsed.total_microseconds()));
             }
         } else {
             Logger::Error(_T("Too short data"));
@@ -350,6 +421,7 @@ namespace network {
     {
         if (online_) {
             online_ = false;
+            metrics::Metrics::getInstance().sessions_closed.Add();
             if (on_receive_) {
                 if (id_ > 0) {
                     (*on_receive_)(UserFatalConnectionError(id_));
@@ -9,6 +9,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/timer.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <stdint.h>
 #include <string>
 #include <queue>
@@ -74,6 +75,12 @@ namespace network {
 			int write_average_limit() const;
 			void set_write_average_limit(int limit);
 
+			size_t send_queue_size() const;
+
+			void UpdateRoundTripTime(double rtt);
+			double round_trip_time() const;
+			double round_trip_jitter() const;
+
             bool operator==(const Session&);
             bool operator!=(const Session&);
 
@@ -85,10 +92,11 @@ namespace network {
             Command Deserialize(const std::string& msg);
 
             void ReceiveTCP(const boost::system::error_code& error);
-            void DoWriteTCP(const std::string, SessionPtr session_holder);
+            void DoWriteTCP(const std::string, uint8_t header, const boost::posix_time::ptime& send_time,
+                     SessionPtr session_holder);
             void WriteTCP(const boost::system::error_code& error,
 					 boost::shared_ptr<std::string> holder, SessionPtr session_holder);
-            void FetchTCP(const std::string&);
+            void FetchTCP(const std::string&, const boost::posix_time::ptime& arrival_time);
 
             void FatalError(SessionPtr session_holder = SessionPtr());
 
@@ -103,7 +111,14 @@ namespace network {
 
             // 送受信のためのバッファ
             boost::asio::streambuf receive_buf_;
-            std::queue<std::string> send_queue_;
+
+            // 送信待ちのデータと、遅延の計測用のヘッダー・Sendを呼んだ時刻
+            struct PendingWrite {
+                std::string data;
+                uint8_t header;
+                boost::posix_time::ptime send_time;
+            };
+            std::queue<PendingWrite> send_queue_;
 
             CallbackFuncPtr on_receive_;
 
@@ -120,6 +135,13 @@ namespace network {
 			
 			int write_average_limit_;
 
+			// 往復遅延の平滑値と揺らぎ (ミリ秒)
+			double round_trip_time_;
+			double round_trip_jitter_;
+
+			// 接続を受け付けた時刻 (暗号化開始までの時間の計測用、クライアントでは未設定)
+			boost::posix_time::ptime accepted_time_;
+
             UserID id_;
 			unsigned char channel_;
     };
@@ -7,19 +7,57 @@
 #include <iostream>
 #include <string.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/foreach.hpp>
 #include <assert.h>
+#include <random>
 
-Account::Account() :
+#define STRING_POOL_MIN_LIMIT (1024)
+
+Account::Account(const std::string& store_directory) :
+string_pool_limit_(STRING_POOL_MIN_LIMIT),
+store_(store_directory),
+change_log_(ACCOUNT_CHANGE_LOG_SIZE),
 revision_(0),
-max_user_id_(0)
+max_user_id_(0),
+metrics_collector_(0)
 {
+    // 再起動前のカーソルを誤って受け付けないよう、起動ごとに開始値を変える
+    revision_ = std::random_device()();
+
+    store_.Load();
+    max_user_id_ = store_.max_user_id();
+
+    metrics_collector_ = metrics::Metrics::getInstance().AddCollector(
+        [this](metrics::Writer* writer) { CollectMetrics(writer); });
 }
 
 Account::~Account()
 {
+    metrics::Metrics::getInstance().RemoveCollector(metrics_collector_);
 }
 
-void Account::LoadInitializeData(UserID user_id, std::string data)
+void Account::CollectMetrics(metrics::Writer* writer)
+{
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+
+    size_t users = 0, logins = 0;
+    for (UserID user_id = 1; user_id < exists_.size(); user_id++) {
+        if (exists_[user_id]) {
+            users++;
+            if (logins_[user_id]) {
+                logins++;
+            }
+        }
+    }
+
+    writer->Gauge("mmo_account_users", "Accounts loaded in memory.", users);
+    writer->Gauge("mmo_account_logged_in_users", "Accounts marked as logged in.", logins);
+    writer->Gauge("mmo_account_string_pool_size", "Interned names, model names and trips.", string_pool_.size());
+    writer->Gauge("mmo_account_change_log_size", "Entries in the revision change log.", change_log_.size());
+}
+
+void Account::LoadInitializeData(UserID user_id, std::string data,
+    boost::optional<std::string>* trip)
 {
     std::string buffer(data);
 
@@ -42,7 +80,11 @@ void Account::LoadInitializeData(UserID user_id, std::string data)
             {
                 std::string value;
                 buffer.erase(0, network::Utils::Deserialize(buffer, &value));
-                SetUserTrip(user_id, value);
+                if (trip) {
+                    *trip = value;
+                } else {
+                    SetUserTrip(user_id, value);
+                }
             }
                 break;
 
@@ -62,47 +104,229 @@ void Account::LoadInitializeData(UserID user_id, std::string data)
 
 uint32_t Account::GetCurrentRevision()
 {
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
     return revision_;
 }
 
+const std::string& Account::ToString(const SharedString& value)
+{
+    static const std::string empty;
+    return value ? *value : empty;
+}
+
+Account::SharedString Account::Intern(const std::string& value)
+{
+    auto it = string_pool_.find(value);
+    if (it != string_pool_.end()) {
+        if (auto shared = it->second.lock()) {
+            return shared;
+        }
+    }
+
+    SharedString shared = std::make_shared<const std::string>(value);
+    string_pool_[value] = shared;
+
+    // 参照されなくなった文字列を掃除
+    if (string_pool_.size() > string_pool_limit_) {
+        for (auto pool_it = string_pool_.begin(); pool_it != string_pool_.end();) {
+            if (pool_it->second.expired()) {
+                pool_it = string_pool_.erase(pool_it);
+            } else {
+                ++pool_it;
+            }
+        }
+        string_pool_limit_ = std::max<size_t>(STRING_POOL_MIN_LIMIT, string_pool_.size() * 2);
+    }
+
+    return shared;
+}
+
+bool Account::Exists(UserID user_id) const
+{
+    return user_id < exists_.size() && exists_[user_id];
+}
+
+void Account::EnsureSlot(UserID user_id)
+{
+    if (user_id >= exists_.size()) {
+        size_t size = std::max<size_t>(user_id + 1, exists_.size() * 2);
+        exists_.resize(size, false);
+        user_revisions_.resize(size, 0);
+        property_revisions_.resize(size, std::array<uint32_t, FIELD_COUNT>());
+        logins_.resize(size, 0);
+        channels_.resize(size, 0);
+        udp_ports_.resize(size, 0);
+        names_.resize(size);
+        model_names_.resize(size);
+        trips_.resize(size);
+        ip_addresses_.resize(size);
+        public_keys_.resize(size);
+        positions_.resize(size);
+        patch_caches_.resize(size);
+    }
+}
+
+uint32_t Account::NextRevision(UserID user_id, Field field)
+{
+    uint32_t new_revision = ++user_revisions_[user_id];
+    property_revisions_[user_id][field] = new_revision;
+    patch_caches_[user_id].patches.clear();
+
+    Change change = {user_id, static_cast<uint8_t>(field)};
+    change_log_.push_back(change);
+    revision_++;
+
+    return new_revision;
+}
+
+void Account::AppendPatchValue(std::string* patch, UserID user_id, Field field) const
+{
+    using network::Utils::Serialize;
+
+    switch (field) {
+    case FIELD_LOGIN:
+        *patch += Serialize((uint16_t)LOGIN, logins_[user_id]);
+        break;
+    case FIELD_CHANNEL:
+        *patch += Serialize((uint16_t)CHANNEL, channels_[user_id]);
+        break;
+    case FIELD_NAME:
+        *patch += Serialize((uint16_t)NAME, ToString(names_[user_id]));
+        break;
+    case FIELD_MODEL_NAME:
+        *patch += Serialize((uint16_t)MODEL_NAME, ToString(model_names_[user_id]));
+        break;
+    case FIELD_TRIP:
+        *patch += Serialize((uint16_t)TRIP, ToString(trips_[user_id]));
+        break;
+    case FIELD_IP_ADDRESS:
+        *patch += Serialize((uint16_t)IP_ADDRESS, ip_addresses_[user_id]);
+        break;
+    case FIELD_UDP_PORT:
+        *patch += Serialize((uint16_t)UDP_PORT, udp_ports_[user_id]);
+        break;
+    default:
+        ;
+    }
+}
+
+uint8_t Account::GetChangedFields(UserID user_id, uint32_t revision) const
+{
+    uint8_t fields = 0;
+    const auto& revisions = property_revisions_[user_id];
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (revisions[field] > revision) {
+            fields |= 1 << field;
+        }
+    }
+    return fields;
+}
+
 std::string Account::GetUserRevisionPatch(UserID user_id, uint32_t revision)
 {
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+
     auto user_revison = GetUserRevision(user_id);
-    std::string patch;
+    if (user_revison <= revision) {
+        return std::string();
+    }
 
-    if (user_revison > revision) {
-        patch += network::Utils::Serialize(user_id, user_revison);
+    return BuildPatch(user_id, GetChangedFields(user_id, revision));
+}
 
-        UserMap::iterator usermap_it;
-        if ((usermap_it = user_map_.find(user_id)) != user_map_.end()) {
+bool Account::GetChangesSince(uint32_t cursor, std::map<UserID, uint8_t>* changes) const
+{
+    // 履歴から外れたカーソルは全体を送り直す
+    uint32_t behind = revision_ - cursor;
+    if (cursor == 0 || behind > change_log_.size()) {
+        return false;
+    }
 
-            PropertyMap& property_map = usermap_it->second;
+    for (auto it = change_log_.end() - behind; it != change_log_.end(); ++it) {
+        if (Exists(it->user_id)) {
+            (*changes)[it->user_id] |= 1 << it->field;
+        }
+    }
+    return true;
+}
 
-            BOOST_FOREACH (auto& property, property_map) {
-                if (property.second.revision > revision) {
-                    patch += network::Utils::Serialize((uint16_t)property.first) + property.second.value;
-                }
-            }
+bool Account::GetRevisionPatchesSince(uint32_t cursor, std::vector<std::string>* patches,
+    std::vector<UserID>* user_ids)
+{
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+
+    std::map<UserID, uint8_t> changes;
+    if (!GetChangesSince(cursor, &changes)) {
+        return false;
+    }
+
+    BOOST_FOREACH(const auto& change, changes) {
+        patches->push_back(BuildPatch(change.first, change.second));
+        if (user_ids) {
+            user_ids->push_back(change.first);
         }
     }
+    return true;
+}
 
-    return patch;
+bool Account::GetChangedUsersSince(uint32_t cursor, std::vector<UserID>* user_ids)
+{
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+
+    std::map<UserID, uint8_t> changes;
+    if (!GetChangesSince(cursor, &changes)) {
+        return false;
+    }
+
+    BOOST_FOREACH(const auto& change, changes) {
+        user_ids->push_back(change.first);
+    }
+    return true;
 }
 
-void Account::Remove(UserID user_id)
+std::string Account::BuildPatch(UserID user_id, uint8_t fields)
 {
-	// 30分後に削除
-	boost::thread t([this, user_id](){
+    auto user_revison = GetUserRevision(user_id);
+    auto& cache = patch_caches_[user_id];
+    if (cache.user_revision != user_revison) {
+        cache.user_revision = user_revison;
+        cache.patches.clear();
+    }
+
+    // 同じ変更に対する要求は生成済みのパッチを返す
+    BOOST_FOREACH(const auto& cached, cache.patches) {
+        if (cached.first == fields) {
+            return cached.second;
+        }
+    }
 
-		boost::this_thread::sleep(boost::posix_time::minutes(30));
+    std::string patch = network::Utils::Serialize(user_id, user_revison);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (fields & (1 << field)) {
+            AppendPatchValue(&patch, user_id, static_cast<Field>(field));
+        }
+    }
 
-		char login;
-		Get(user_id, LOGIN, &login);
-		if (!login) {
-			boost::unique_lock<boost::recursive_mutex> lock(mutex_);
-			user_map_.erase(user_id);
-		}
-	});
+    cache.patches.push_back(std::make_pair(fields, patch));
+    return patch;
+}
+
+void Account::Remove(UserID user_id)
+{
+	// ログイン中のユーザーは削除しない
+	// 再ログイン時に復元するので、リビジョンは巻き戻さない
+	boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+	if (Exists(user_id) && !logins_[user_id]) {
+		exists_[user_id] = false;
+		property_revisions_[user_id].fill(0);
+		names_[user_id].reset();
+		model_names_[user_id].reset();
+		trips_[user_id].reset();
+		public_keys_[user_id].clear();
+		ip_addresses_[user_id].clear();
+		positions_[user_id] = PlayerPosition();
+		patch_caches_[user_id] = PatchCache();
+	}
 }
 
 /*
@@ -137,48 +361,102 @@ void Account::ApplyRevisionPatch(const std::string& patch)
 
 UserID Account::GetUserIdFromFingerPrint(const std::string& finger_print)
 {
-	return 0;
-    //FingerprintMap::iterator it;
-    //if ((it = fingerprint_map_.find(finger_print)) != fingerprint_map_.end()) {
-    //    return it->second;
-    //} else {
-    //    return 0;
-    //}
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+
+    // 同じ鍵で既にログインしている場合は新しいIDを発行させる
+    UserID user_id = store_.FindUserId(finger_print);
+    if (user_id > 0 && Get(user_id, logins_)) {
+        return 0;
+    }
+    return user_id;
 }
 
 std::string Account::GetPublicKey(UserID user_id)
 {
-    std::string value;
-    Get(user_id, PUBLIC_KEY, &value);
-    return value;
+    return Get(user_id, public_keys_);
 }
 
 UserID Account::RegisterPublicKey(const std::string& public_key)
 {
-    UserID user_id = 0;
     std::string finger_print = network::Encrypter::GetHash(public_key);
 
-    if (GetUserIdFromFingerPrint(finger_print) == 0) {
-        // ユーザーIDを発行
-        user_id = ++max_user_id_;
-        fingerprint_map_[finger_print] = user_id;
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+
+    UserID user_id = GetUserIdFromFingerPrint(finger_print);
+    if (user_id > 0) {
+        Restore(user_id);
+        return user_id;
+    }
 
-        SetUserName(user_id, "???");
-        Set(user_id, PUBLIC_KEY, public_key, false);
-        Set(user_id, REVISION, (uint32_t)1, false);
+    // ユーザーIDを発行
+    user_id = ++max_user_id_;
+
+    SetUserName(user_id, "???");
+    public_keys_[user_id] = public_key;
+    user_revisions_[user_id] = 1;
+
+    // 同じ鍵で重複してログインした場合は、元のIDの索引を残す
+    if (store_.FindUserId(finger_print) == 0) {
+        AccountStore::Record record;
+        record.user_id = user_id;
+        record.finger_print = finger_print;
+        record.public_key = public_key;
+        record.name = GetUserName(user_id);
+        store_.Put(record);
     }
 
     return user_id;
 }
 
+void Account::Restore(UserID user_id)
+{
+    if (Exists(user_id)) {
+        return;
+    }
+
+    if (auto record = store_.Find(user_id)) {
+        EnsureSlot(user_id);
+        public_keys_[user_id] = record->public_key;
+
+        Set(user_id, FIELD_NAME, names_, record->name);
+        Set(user_id, FIELD_TRIP, trips_, record->trip);
+        Set(user_id, FIELD_MODEL_NAME, model_names_, record->model_name);
+    }
+}
+
+void Account::Persist(UserID user_id)
+{
+    auto stored = store_.Find(user_id);
+    if (!stored) {
+        return;
+    }
+
+    AccountStore::Record record(*stored);
+    record.name = Get(user_id, names_);
+    record.trip = Get(user_id, trips_);
+    record.model_name = Get(user_id, model_names_);
+
+    if (record.name != stored->name || record.trip != stored->trip ||
+        record.model_name != stored->model_name) {
+        store_.Put(record);
+    }
+}
+
 void Account::LogIn(UserID user_id)
 {
-    Set(user_id, LOGIN, (char)1);
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+    Restore(user_id);
+    Set(user_id, FIELD_LOGIN, logins_, (char)1);
 }
 
 void Account::LogOut(UserID user_id)
 {
-    Set(user_id, LOGIN, (char)0);
+    Set(user_id, FIELD_LOGIN, logins_, (char)0);
+}
+
+bool Account::IsLoggedIn(UserID user_id) const
+{
+    return Get(user_id, logins_) != 0;
 }
 
 void Account::LogOutAll()
@@ -190,114 +468,109 @@ void Account::LogOutAll()
 
 std::string Account::GetUserName(UserID user_id) const
 {
-    std::string name;
-    Get(user_id, NAME, &name);
-    return name;
+    return Get(user_id, names_);
 }
 
 void Account::SetUserName(UserID user_id, const std::string& name)
 {
     if (name.size() > 0 && name.size() <= 32) {
-        Set(user_id, NAME, name);
+        boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+        Set(user_id, FIELD_NAME, names_, name);
+        Persist(user_id);
     }
 }
 
 std::string Account::GetUserTrip(UserID user_id) const
 {
-    std::string trip;
-    Get(user_id, TRIP, &trip);
-    return trip;
+    return Get(user_id, trips_);
 }
 
 void Account::SetUserTrip(UserID user_id, const std::string& trip)
 {
-    if (trip.size() > 0 && trip.size() <= 256) {
-        Set(user_id, TRIP, network::Encrypter::GetTrip(trip));
-    } else {
-		Set(user_id, TRIP, std::string());
-	}
+    SetUserHashedTrip(user_id, HashTrip(trip));
+}
+
+void Account::SetUserHashedTrip(UserID user_id, const std::string& trip)
+{
+    boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+    Set(user_id, FIELD_TRIP, trips_, trip);
+    Persist(user_id);
+}
+
+std::string Account::HashTrip(const std::string& trip)
+{
+    return (trip.size() > 0 && trip.size() <= 256) ?
+        network::Encrypter::GetTrip(trip) : std::string();
 }
 
 std::string Account::GetUserModelName(UserID user_id) const
 {
-    std::string name;
-    Get(user_id, MODEL_NAME, &name);
-    return name;
+    return Get(user_id, model_names_);
 }
 
 void Account::SetUserModelName(UserID user_id, const std::string& name)
 {
     if (name.size() > 0 && name.size() <= 64) {
-        Set(user_id, MODEL_NAME, name);
+        boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+        Set(user_id, FIELD_MODEL_NAME, model_names_, name);
+        Persist(user_id);
     }
 }
 
 std::string Account::GetUserIPAddress(UserID user_id) const
 {
-    std::string ip_address;
-    Get(user_id, IP_ADDRESS, &ip_address);
-    return ip_address;
+    return Get(user_id, ip_addresses_);
 }
 void Account::SetUserIPAddress(UserID user_id, const std::string& ip_address)
 {
-    Set(user_id, IP_ADDRESS, ip_address);
+    Set(user_id, FIELD_IP_ADDRESS, ip_addresses_, ip_address);
 }
 
 uint16_t Account::GetUserUDPPort(UserID user_id) const
 {
-    uint16_t udp_port = 0;
-    Get(user_id, UDP_PORT, &udp_port);
-    return udp_port;
+    return Get(user_id, udp_ports_);
 }
 
 void Account::SetUserUDPPort(UserID user_id, uint16_t udp_port)
 {
-    Set(user_id, UDP_PORT, udp_port);
+    Set(user_id, FIELD_UDP_PORT, udp_ports_, udp_port);
 }
 
 uint32_t Account::GetUserRevision(UserID user_id) const
 {
-    uint32_t revision = 0;
-    Get(user_id, REVISION, &revision);
-    return revision;
+    return Get(user_id, user_revisions_);
 }
 
 void Account::SetUserChannel(UserID user_id, unsigned char channel)
 {
-    Set(user_id, CHANNEL, channel);
+    Set(user_id, FIELD_CHANNEL, channels_, channel);
 }
 
 unsigned char Account::GetUserChannel(UserID user_id) const
 {
-    unsigned char channel = 0;
-    Get(user_id, CHANNEL, &channel);
-    return channel;
+    return Get(user_id, channels_);
 }
 
 void Account::SetUserPosition(UserID user_id, const PlayerPosition& pos)
 {
-    auto it = position_map_.find(user_id);
-    if (it == position_map_.end()) {
-        position_map_[user_id] = PlayerPosition();
-    }
-    position_map_[user_id] = pos;
+    EnsureSlot(user_id);
+    positions_[user_id] = pos;
 }
 
 PlayerPosition Account::GetUserPosition(UserID user_id) const
 {
-    auto it = position_map_.find(user_id);
-    if (it == position_map_.end()) {
+    if (user_id >= positions_.size()) {
         return PlayerPosition();
     }
-    return it->second;
+    return positions_[user_id];
 }
 
 std::vector<UserID> Account::GetIDList() const
 {
     std::vector<UserID> list;
-    for (auto it = user_map_.begin(); it != user_map_.end(); ++it) {
-		if (it->first != 0) {
-			list.push_back(it->first);
+    for (UserID user_id = 1; user_id < exists_.size(); user_id++) {
+		if (exists_[user_id]) {
+			list.push_back(user_id);
 		}
     }
     return list;
@@ -8,24 +8,39 @@
 #include <map>
 #include <list>
 #include <unordered_map>
+#include <vector>
+#include <array>
+#include <memory>
 #include <stdint.h>
 #include "../common/database/AccountProperty.hpp"
 #include "../common/network/Utils.hpp"
 #include "../common/Logger.hpp"
+#include "../common/Metrics.hpp"
+#include "AccountStore.hpp"
 #include <boost/thread.hpp>
+#include <boost/circular_buffer.hpp>
+#include <boost/optional.hpp>
+
+#define ACCOUNT_CHANGE_LOG_SIZE (4096)
 
 typedef uint32_t UserID;
 #undef GetUserName
 
 class Account {
     public:
-        Account();
+        Account(const std::string& store_directory = ACCOUNT_STORE_DIRECTORY);
         ~Account();
 
-        void LoadInitializeData(UserID user_id, std::string data);
+        // tripを渡した場合、トリップは計算せずにパスワードを返す
+        void LoadInitializeData(UserID user_id, std::string data,
+            boost::optional<std::string>* trip = nullptr);
 
         uint32_t GetCurrentRevision();
         std::string GetUserRevisionPatch(UserID user_id, uint32_t revision);
+        // user_idsを渡した場合、パッチを作ったユーザーを順に返す
+        bool GetRevisionPatchesSince(uint32_t cursor, std::vector<std::string>* patches,
+            std::vector<UserID>* user_ids = nullptr);
+        bool GetChangedUsersSince(uint32_t cursor, std::vector<UserID>* user_ids);
 
         UserID GetUserIdFromFingerPrint(const std::string&);
         std::string GetPublicKey(UserID);
@@ -34,6 +49,7 @@ class Account {
         void LogIn(UserID);
         void LogOut(UserID);
         void LogOutAll();
+        bool IsLoggedIn(UserID) const;
 
 		void Remove(UserID);
 
@@ -41,6 +57,8 @@ class Account {
         void SetUserName(UserID, const std::string&);
         std::string GetUserTrip(UserID) const;
         void SetUserTrip(UserID, const std::string&);
+        void SetUserHashedTrip(UserID, const std::string&);
+        static std::string HashTrip(const std::string&);
         std::string GetUserModelName(UserID) const;
         void SetUserModelName(UserID, const std::string&);
 
@@ -59,67 +77,134 @@ class Account {
         std::vector<UserID> GetIDList() const;
 
     private:
+        // プロパティごとのリビジョンを持つ列
+        // パッチはこの順に並べるので、AccountPropertyの値の順序と合わせる
+        enum Field {
+            FIELD_LOGIN,
+            FIELD_CHANNEL,
+            FIELD_NAME,
+            FIELD_MODEL_NAME,
+            FIELD_TRIP,
+            FIELD_IP_ADDRESS,
+            FIELD_UDP_PORT,
+            FIELD_COUNT
+        };
+
+        typedef std::shared_ptr<const std::string> SharedString;
+
+        void CollectMetrics(metrics::Writer* writer);
+
+        static const std::string& ToString(const SharedString& value);
+        SharedString Intern(const std::string& value);
+
+        bool Exists(UserID user_id) const;
+        void Restore(UserID user_id);
+        void Persist(UserID user_id);
+        void EnsureSlot(UserID user_id);
+        uint32_t NextRevision(UserID user_id, Field field);
+        bool GetChangesSince(uint32_t cursor, std::map<UserID, uint8_t>* changes) const;
+
         template <class T>
-        void Set(UserID user_id, AccountProperty property, T value, bool revision = true)
+        static bool Equals(const T& a, const T& b)
         {
-			if (user_id == 0) {
-				Logger::Error(_T("Invalid session id"));
-				return;
-			}
+            return a == b;
+        }
 
-            T old_value;
-            if (!Get(user_id, property, &old_value) || old_value != value) {
-				boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+        static bool Equals(const SharedString& a, const std::string& b)
+        {
+            return ToString(a) == b;
+        }
 
-                if (user_map_.find(user_id) == user_map_.end()) {
-                    user_map_[user_id] = PropertyMap();
-                }
+        template <class T, class U>
+        void Set(UserID user_id, Field field, std::vector<T>& column, const U& value)
+        {
+            if (user_id == 0) {
+                Logger::Error(_T("Invalid session id"));
+                return;
+            }
 
-                user_map_[user_id][property].value = network::Utils::Serialize(value);
+            boost::unique_lock<boost::recursive_mutex> lock(mutex_);
+            EnsureSlot(user_id);
 
-                if (revision) {
-                    uint32_t new_revision = GetUserRevision(user_id) + 1;
-                    Logger::Debug("Userdata Update %d %d Revision: %d",
-                              user_id, property, new_revision);
+            // 未設定のプロパティは同じ値でもリビジョンを上げる
+            auto& revisions = property_revisions_[user_id];
+            if (revisions[field] == 0 || !Equals(column[user_id], value)) {
+                exists_[user_id] = true;
+                Store(&column[user_id], value);
 
-                    user_map_[user_id][property].revision = new_revision;
-                    Set(user_id, REVISION, new_revision, false);
-                }
+                uint32_t new_revision = NextRevision(user_id, field);
+                LOG_DEBUG("Userdata Update %d %d Revision: %d", user_id, field, new_revision);
             }
         }
 
         template <class T>
-        bool Get(UserID user_id, AccountProperty property, T* value) const
+        static void Store(T* dst, const T& value)
         {
-            UserMap::const_iterator usermap_it;
-            if ((usermap_it = user_map_.find(user_id)) != user_map_.end()) {
-                PropertyMap::const_iterator property_it;
-                if ((property_it = usermap_it->second.find(property)) != usermap_it->second.end()) {
-                    network::Utils::Deserialize(property_it->second.value, value);
-                    return true;
-                }
-            }
-            return false;
+            *dst = value;
         }
 
-        struct PropertyValue {
-            PropertyValue() : revision(0) {}
-            uint32_t revision;
-            std::string value;
-        };
+        void Store(SharedString* dst, const std::string& value)
+        {
+            *dst = Intern(value);
+        }
 
-        typedef std::map<AccountProperty, PropertyValue> PropertyMap;
-        typedef std::map<UserID, PropertyMap> UserMap;
-        UserMap user_map_;
+        template <class T>
+        T Get(UserID user_id, const std::vector<T>& column) const
+        {
+            return Exists(user_id) ? column[user_id] : T();
+        }
 
-        typedef std::unordered_map<std::string, UserID> FingerprintMap;
-        FingerprintMap fingerprint_map_;
+        std::string Get(UserID user_id, const std::vector<SharedString>& column) const
+        {
+            return Exists(user_id) ? ToString(column[user_id]) : std::string();
+        }
+
+        void AppendPatchValue(std::string* patch, UserID user_id, Field field) const;
+        uint8_t GetChangedFields(UserID user_id, uint32_t revision) const;
+        std::string BuildPatch(UserID user_id, uint8_t fields);
+
+        // 生成済みのパッチ
+        // 内容は差分に含まれるプロパティの組で決まるので、その組をキーにする
+        struct PatchCache {
+            uint32_t user_revision;
+            std::vector<std::pair<uint8_t, std::string>> patches;
+        };
 
-        typedef std::map<UserID, PlayerPosition> PositionMap;
-        PositionMap position_map_;
+        // ユーザーIDで引く列指向のテーブル
+        std::vector<char> exists_;
+        std::vector<uint32_t> user_revisions_;
+        std::vector<std::array<uint32_t, FIELD_COUNT>> property_revisions_;
+
+        std::vector<char> logins_;
+        std::vector<unsigned char> channels_;
+        std::vector<uint16_t> udp_ports_;
+        std::vector<SharedString> names_;
+        std::vector<SharedString> model_names_;
+        std::vector<SharedString> trips_;
+        std::vector<std::string> ip_addresses_;
+        std::vector<std::string> public_keys_;
+        std::vector<PlayerPosition> positions_;
+        std::vector<PatchCache> patch_caches_;
+
+        // 名前・モデル名・トリップは同じ文字列を共有する
+        typedef std::unordered_map<std::string, std::weak_ptr<const std::string>> StringPool;
+        StringPool string_pool_;
+        size_t string_pool_limit_;
+
+        // 公開鍵・名前などの永続化と、フィンガープリントの索引
+        AccountStore store_;
+
+        // サーバー全体の変更履歴 (リビジョンは1件ごとに連番)
+        struct Change {
+            UserID user_id;
+            uint8_t field;
+        };
+        boost::circular_buffer<Change> change_log_;
 
         uint32_t revision_;
         UserID max_user_id_;
 
+        int metrics_collector_;
+
 		boost::recursive_mutex mutex_;
 };
@@ -0,0 +1,388 @@
+//
+// AccountStore.cpp
+//
+
+#include "AccountStore.hpp"
+#include <algorithm>
+#include <string.h>
+#include "../common/network/Utils.hpp"
+#include "../common/Logger.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace boost::filesystem;
+
+namespace {
+    const char SNAPSHOT_MAGIC[] = "MMOA";
+    const uint32_t SNAPSHOT_VERSION = 1;
+    const size_t SNAPSHOT_HEADER_SIZE = 8;
+    const size_t RECORD_HEADER_SIZE = 8;
+
+    // FNV-1a
+    uint32_t GetChecksum(const char* data, size_t size)
+    {
+        uint32_t hash = 2166136261U;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= static_cast<uint8_t>(data[i]);
+            hash *= 16777619U;
+        }
+        return hash;
+    }
+
+    // 書き込んだ内容をディスクに反映させる
+    // フォルダを指定すると、その中で行った作成や名前の変更を反映させる
+    bool SyncFile(const std::string& path, bool directory)
+    {
+#ifdef _WIN32
+        // Windowsではフォルダを開けないが、名前の変更はファイルの内容を反映させてから行われる
+        if (directory) {
+            return true;
+        }
+        int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+        if (fd < 0) {
+            return false;
+        }
+        bool result = _commit(fd) == 0;
+        _close(fd);
+#else
+        int fd = open(path.c_str(), directory ? O_RDONLY : O_WRONLY);
+        if (fd < 0) {
+            return false;
+        }
+        bool result = fsync(fd) == 0;
+        close(fd);
+#endif
+        return result;
+    }
+}
+
+AccountStore::AccountStore(const std::string& directory) :
+    directory_(directory),
+    snapshot_path_(directory + "/accounts.dat"),
+    log_path_(directory + "/accounts.log"),
+    compacting_log_path_(directory + "/accounts.log.1"),
+    corrupted_path_(directory + "/accounts.dat.corrupted"),
+    log_records_(0),
+    max_user_id_(0),
+    compaction_blocked_(false),
+    compacting_(false)
+{
+}
+
+AccountStore::~AccountStore()
+{
+    WaitCompaction();
+    if (log_records_ > 0 || exists(compacting_log_path_)) {
+        Compact();
+    }
+}
+
+void AccountStore::Load()
+{
+    try {
+        if (!exists(directory_)) {
+            create_directory(directory_);
+        }
+    } catch (const std::exception& e) {
+        Logger::Error(unicode::ToTString(e.what()));
+    }
+
+    // 以前退避したスナップショットも、読める部分までは読み込む
+    LoadFile(corrupted_path_, SNAPSHOT_HEADER_SIZE);
+
+    // 読めないスナップショットをまとめ直すと、読めなかったアカウントが失われる
+    // 既に退避したファイルがある場合は、上書きせずにその場に残す
+    const bool snapshot_loaded = LoadFile(snapshot_path_, SNAPSHOT_HEADER_SIZE);
+    if (!snapshot_loaded && !exists(corrupted_path_)) {
+        try {
+            rename(snapshot_path_, corrupted_path_);
+        } catch (const std::exception& e) {
+            Logger::Error(unicode::ToTString(e.what()));
+        }
+    }
+
+    compaction_blocked_ = !snapshot_loaded || exists(corrupted_path_);
+    if (compaction_blocked_) {
+        Logger::Error(_T("Account snapshot is corrupted; compaction is disabled until %s is removed"),
+            unicode::ToTString(corrupted_path_));
+    }
+
+    // まとめる途中で終了した場合は、切り替え前のログが残っている
+    bool clean = LoadLog(compacting_log_path_);
+    clean = LoadLog(log_path_) && clean;
+
+    Logger::Info(_T("Loaded %d accounts"), records_.size());
+
+    // 途中で壊れたログは、続けて追記すると読めなくなるのでまとめ直す
+    if (!clean && !compaction_blocked_) {
+        Logger::Error(_T("Account log is corrupted; compacting"));
+        Compact();
+    } else if (exists(compacting_log_path_) && !compaction_blocked_) {
+        Compact();
+    } else {
+        OpenLog(false);
+    }
+}
+
+bool AccountStore::LoadLog(const std::string& path)
+{
+    size_t valid_size = 0;
+    if (LoadFile(path, 0, &valid_size)) {
+        return true;
+    }
+
+    // まとめられない間は、壊れた末尾を切り詰めてから追記する
+    if (compaction_blocked_) {
+        try {
+            resize_file(path, valid_size);
+        } catch (const std::exception& e) {
+            Logger::Error(unicode::ToTString(e.what()));
+        }
+    }
+    return false;
+}
+
+bool AccountStore::LoadFile(const std::string& path, size_t header_size, size_t* valid_size)
+{
+    using namespace boost::interprocess;
+
+    if (valid_size) {
+        *valid_size = header_size;
+    }
+
+    if (!exists(path) || file_size(path) <= header_size) {
+        return true;
+    }
+
+    try {
+        file_mapping file(path.c_str(), read_only);
+        mapped_region region(file, read_only);
+
+        const char* data = static_cast<const char*>(region.get_address());
+        size_t size = region.get_size();
+
+        if (header_size > 0) {
+            uint32_t version = 0;
+            network::Utils::Deserialize(std::string(data + 4, 4), &version);
+            if (memcmp(data, SNAPSHOT_MAGIC, 4) != 0 || version != SNAPSHOT_VERSION) {
+                Logger::Error(_T("Unknown account snapshot format"));
+                return false;
+            }
+        }
+
+        size_t offset = header_size;
+        while (offset < size) {
+            Record record;
+            if (!Decode(data, size, &offset, &record)) {
+                return false;
+            }
+            Apply(record);
+            if (header_size == 0) {
+                log_records_++;
+            }
+            if (valid_size) {
+                *valid_size = offset;
+            }
+        }
+    } catch (const std::exception& e) {
+        Logger::Error(unicode::ToTString(e.what()));
+        return false;
+    }
+
+    return true;
+}
+
+void AccountStore::Put(const Record& record)
+{
+    Apply(record);
+
+    // 書き込みが失敗してもメモリ上の値は保持する
+    std::string data = Encode(record);
+    log_.write(data.data(), data.size());
+    log_.flush();
+    log_records_++;
+
+    if (log_records_ >= ACCOUNT_STORE_COMPACTION_THRESHOLD) {
+        StartCompaction();
+    }
+}
+
+void AccountStore::Compact()
+{
+    WaitCompaction();
+    if (compaction_blocked_) {
+        return;
+    }
+
+    if (!WriteSnapshot(records_)) {
+        return;
+    }
+
+    // スナップショットの置き換えがディスクに反映されてからログを空にする
+    boost::system::error_code error;
+    remove(compacting_log_path_, error);
+    OpenLog(true);
+    log_records_ = 0;
+}
+
+void AccountStore::StartCompaction()
+{
+    // 前回の書き込みが終わっていないか、失敗して切り替え前のログが残っている間は追記を続ける
+    if (compaction_blocked_ || compacting_ || exists(compacting_log_path_)) {
+        return;
+    }
+    WaitCompaction();
+
+    // 以後の変更は新しいログに書き、切り替え前のログはスナップショットを書き終えるまで残す
+    log_.close();
+    try {
+        rename(log_path_, compacting_log_path_);
+    } catch (const std::exception& e) {
+        Logger::Error(unicode::ToTString(e.what()));
+        OpenLog(false);
+        return;
+    }
+    OpenLog(true);
+    log_records_ = 0;
+
+    // ファイルへの書き込みはI/Oスレッドを止めないよう別スレッドで行う
+    auto records = std::make_shared<RecordMap>(records_);
+    compacting_ = true;
+    compaction_thread_ = boost::thread([this, records](){
+        if (WriteSnapshot(*records)) {
+            boost::system::error_code error;
+            remove(compacting_log_path_, error);
+        }
+        compacting_ = false;
+    });
+}
+
+void AccountStore::WaitCompaction()
+{
+    if (compaction_thread_.joinable()) {
+        compaction_thread_.join();
+    }
+}
+
+bool AccountStore::WriteSnapshot(const RecordMap& records)
+{
+    const std::string temp_path = snapshot_path_ + ".tmp";
+
+    {
+        std::ofstream ofs(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+        ofs.write(SNAPSHOT_MAGIC, 4);
+        std::string version = network::Utils::Serialize(SNAPSHOT_VERSION);
+        ofs.write(version.data(), version.size());
+
+        for (auto it = records.begin(); it != records.end(); ++it) {
+            std::string data = Encode(it->second);
+            ofs.write(data.data(), data.size());
+        }
+
+        ofs.close();
+        if (!ofs) {
+            Logger::Error(_T("Failed to write account snapshot"));
+            return false;
+        }
+    }
+
+    // 内容を反映させる前に置き換えると、電源断で中身のないスナップショットが残る
+    if (!SyncFile(temp_path, false) || !SyncFile(directory_, true)) {
+        Logger::Error(_T("Failed to sync account snapshot"));
+        return false;
+    }
+
+    try {
+        rename(temp_path, snapshot_path_);
+    } catch (const std::exception& e) {
+        Logger::Error(unicode::ToTString(e.what()));
+        return false;
+    }
+
+    // 名前の変更が反映されるまでは、呼び出し側で古いログを消さない
+    if (!SyncFile(directory_, true)) {
+        Logger::Error(_T("Failed to sync account directory"));
+        return false;
+    }
+    return true;
+}
+
+const AccountStore::Record* AccountStore::Find(uint32_t user_id) const
+{
+    auto it = records_.find(user_id);
+    return it != records_.end() ? &it->second : nullptr;
+}
+
+uint32_t AccountStore::FindUserId(const std::string& finger_print) const
+{
+    auto it = fingerprint_index_.find(finger_print);
+    return it != fingerprint_index_.end() ? it->second : 0;
+}
+
+uint32_t AccountStore::max_user_id() const
+{
+    return max_user_id_;
+}
+
+std::string AccountStore::Encode(const Record& record)
+{
+    std::string payload =
+        network::Utils::Serialize(record.user_id, record.finger_print, record.public_key) +
+        network::Utils::Serialize(record.name, record.trip, record.model_name);
+
+    return network::Utils::Serialize(static_cast<uint32_t>(payload.size()),
+        GetChecksum(payload.data(), payload.size())) + payload;
+}
+
+bool AccountStore::Decode(const char* data, size_t size, size_t* offset, Record* record)
+{
+    if (size - *offset < RECORD_HEADER_SIZE) {
+        return false;
+    }
+
+    uint32_t payload_size, checksum;
+    network::Utils::Deserialize(std::string(data + *offset, RECORD_HEADER_SIZE),
+        &payload_size, &checksum);
+
+    const char* payload = data + *offset + RECORD_HEADER_SIZE;
+    if (size - *offset - RECORD_HEADER_SIZE < payload_size ||
+        GetChecksum(payload, payload_size) != checksum) {
+        return false;
+    }
+
+    std::string buffer(payload, payload_size);
+    buffer.erase(0, network::Utils::Deserialize(buffer,
+        &record->user_id, &record->finger_print, &record->public_key));
+    network::Utils::Deserialize(buffer, &record->name, &record->trip, &record->model_name);
+
+    *offset += RECORD_HEADER_SIZE + payload_size;
+    return true;
+}
+
+void AccountStore::Apply(const Record& record)
+{
+    records_[record.user_id] = record;
+    max_user_id_ = std::max(max_user_id_, record.user_id);
+
+    if (!record.finger_print.empty()) {
+        fingerprint_index_[record.finger_print] = record.user_id;
+    }
+}
+
+void AccountStore::OpenLog(bool truncate)
+{
+    if (log_.is_open()) {
+        log_.close();
+    }
+    log_.clear();
+    log_.open(log_path_.c_str(), std::ios::binary | (truncate ? std::ios::trunc : std::ios::app));
+}
@@ -0,0 +1,83 @@
+//
+// AccountStore.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+#include <boost/thread.hpp>
+
+#define ACCOUNT_STORE_DIRECTORY "./accounts"
+#define ACCOUNT_STORE_COMPACTION_THRESHOLD (4096)
+
+// アカウントの永続化
+// 変更はログファイルに追記し、一定数たまるとスナップショットにまとめる
+// 起動時はスナップショットをメモリマップして読み込み、ログを再生する
+//
+// まとめる処理はログを切り替えてから別スレッドで行い、書き終えるまで古いログを残す
+// 読めないスナップショットは退避し、退避したファイルが残っている間はまとめない
+class AccountStore {
+    public:
+        struct Record {
+            Record() : user_id(0) {}
+
+            uint32_t user_id;
+            std::string finger_print;
+            std::string public_key;
+            std::string name;
+            std::string trip;
+            std::string model_name;
+        };
+
+        AccountStore(const std::string& directory = ACCOUNT_STORE_DIRECTORY);
+        ~AccountStore();
+
+        void Load();
+        void Put(const Record& record);
+
+        // 呼び出したスレッドでまとめる (起動時と終了時用)
+        void Compact();
+
+        const Record* Find(uint32_t user_id) const;
+        uint32_t FindUserId(const std::string& finger_print) const;
+        uint32_t max_user_id() const;
+
+    private:
+        typedef std::unordered_map<uint32_t, Record> RecordMap;
+
+        static std::string Encode(const Record& record);
+        static bool Decode(const char* data, size_t size, size_t* offset, Record* record);
+
+        // valid_sizeには、読み込めた部分の末尾の位置を返す
+        bool LoadFile(const std::string& path, size_t header_size, size_t* valid_size = nullptr);
+        bool LoadLog(const std::string& path);
+        void Apply(const Record& record);
+        void OpenLog(bool truncate);
+
+        void StartCompaction();
+        void WaitCompaction();
+        bool WriteSnapshot(const RecordMap& records);
+
+    private:
+        std::string directory_;
+        std::string snapshot_path_;
+        std::string log_path_;
+        std::string compacting_log_path_;
+        std::string corrupted_path_;
+
+        std::ofstream log_;
+        size_t log_records_;
+        uint32_t max_user_id_;
+
+        RecordMap records_;
+        std::unordered_map<std::string, uint32_t> fingerprint_index_;
+
+        bool compaction_blocked_;
+        std::atomic<bool> compacting_;
+        boost::thread compaction_thread_;
+};
@@ -0,0 +1,171 @@
+//
+// AddressFilter.cpp
+//
+
+#include "AddressFilter.hpp"
+#include <boost/lexical_cast.hpp>
+#include "../common/network/Utils.hpp"
+#include "../common/Logger.hpp"
+
+namespace {
+    const int IPV4_MAPPED_PREFIX_LENGTH = 96;
+}
+
+AddressFilter::AddressFilter() :
+    nodes_(1)
+{
+}
+
+void AddressFilter::Add(const std::string& pattern)
+{
+    Bytes bytes;
+    int prefix_length;
+    if (ParsePrefix(pattern, &bytes, &prefix_length) ||
+        ParseWildcardPrefix(pattern, &bytes, &prefix_length)) {
+        Insert(bytes, prefix_length);
+    } else {
+        wildcard_patterns_.push_back(pattern);
+    }
+}
+
+bool AddressFilter::Match(const boost::asio::ip::address& address) const
+{
+    const Bytes bytes = ToBytes(address);
+
+    uint32_t index = 0;
+    for (int bit = 0; ; bit++) {
+        if (nodes_[index].terminal) {
+            return true;
+        }
+        if (bit >= 128) {
+            break;
+        }
+        index = nodes_[index].children[(bytes[bit / 8] >> (7 - bit % 8)) & 1];
+        if (index == 0) {
+            break;
+        }
+    }
+
+    // プレフィックスで表せないパターンがある場合のみ文字列に変換する
+    // IPv4射影アドレスは、木での照合と同じくIPv4アドレスとして照合する
+    if (!wildcard_patterns_.empty()) {
+        const std::string text = address.is_v6() && address.to_v6().is_v4_mapped() ?
+            address.to_v6().to_v4().to_string() : address.to_string();
+        for (auto it = wildcard_patterns_.begin(); it != wildcard_patterns_.end(); ++it) {
+            if (network::Utils::MatchWithWildcard(*it, text)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool AddressFilter::ParsePrefix(const std::string& pattern, Bytes* bytes, int* prefix_length)
+{
+    using namespace boost::asio::ip;
+
+    const size_t slash = pattern.find('/');
+    boost::system::error_code error;
+    auto address = address::from_string(pattern.substr(0, slash), error);
+    if (error) {
+        return false;
+    }
+
+    const int max_length = address.is_v4() ? 32 : 128;
+    int length = max_length;
+    if (slash != std::string::npos) {
+        try {
+            length = boost::lexical_cast<int>(pattern.substr(slash + 1));
+        } catch (const boost::bad_lexical_cast&) {
+            return false;
+        }
+        if (length < 0 || length > max_length) {
+            return false;
+        }
+    }
+
+    *bytes = ToBytes(address);
+    *prefix_length = address.is_v4() ? IPV4_MAPPED_PREFIX_LENGTH + length : length;
+    return true;
+}
+
+bool AddressFilter::ParseWildcardPrefix(const std::string& pattern, Bytes* bytes, int* prefix_length)
+{
+    // "*" はすべてのアドレスに一致する
+    if (pattern == "*") {
+        bytes->fill(0);
+        *prefix_length = 0;
+        return true;
+    }
+
+    // "192.168.*" や "10.*.*.*" のように、数字のオクテットの後にワイルドカードだけが続く形式
+    std::vector<std::string> octets;
+    size_t begin = 0;
+    while (true) {
+        size_t end = pattern.find('.', begin);
+        octets.push_back(pattern.substr(begin, end - begin));
+        if (end == std::string::npos) {
+            break;
+        }
+        begin = end + 1;
+    }
+
+    if (octets.size() > 4 || octets.back() != "*") {
+        return false;
+    }
+
+    boost::asio::ip::address_v4::bytes_type v4_bytes = {{0, 0, 0, 0}};
+    size_t digits = 0;
+    for (; digits < octets.size() && octets[digits] != "*"; digits++) {
+        const std::string& octet = octets[digits];
+        if (octet.empty() || octet.size() > 3 ||
+            octet.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        int value = boost::lexical_cast<int>(octet);
+        if (value > 255) {
+            return false;
+        }
+        v4_bytes[digits] = static_cast<unsigned char>(value);
+    }
+
+    for (size_t i = digits; i < octets.size(); i++) {
+        if (octets[i] != "*") {
+            return false;
+        }
+    }
+
+    *bytes = ToBytes(boost::asio::ip::address_v4(v4_bytes));
+    *prefix_length = IPV4_MAPPED_PREFIX_LENGTH + static_cast<int>(digits) * 8;
+    return true;
+}
+
+AddressFilter::Bytes AddressFilter::ToBytes(const boost::asio::ip::address& address)
+{
+    using namespace boost::asio::ip;
+
+    if (address.is_v4()) {
+        return address_v6::v4_mapped(address.to_v4()).to_bytes();
+    } else {
+        return address.to_v6().to_bytes();
+    }
+}
+
+void AddressFilter::Insert(const Bytes& bytes, int prefix_length)
+{
+    uint32_t index = 0;
+    for (int bit = 0; bit < prefix_length; bit++) {
+        // より短いプレフィックスが登録済みであれば、それ以上は不要
+        if (nodes_[index].terminal) {
+            return;
+        }
+        const int branch = (bytes[bit / 8] >> (7 - bit % 8)) & 1;
+        if (nodes_[index].children[branch] == 0) {
+            nodes_[index].children[branch] = static_cast<uint32_t>(nodes_.size());
+            nodes_.push_back(Node());
+        }
+        index = nodes_[index].children[branch];
+    }
+    nodes_[index].terminal = true;
+}
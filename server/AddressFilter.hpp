@@ -0,0 +1,43 @@
+//
+// AddressFilter.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <stdint.h>
+#include <boost/asio/ip/address.hpp>
+
+// IPアドレスのパターン照合
+// CIDR表記と、末尾のオクテットをワイルドカードにしたIPv4アドレスは二分木のプレフィックス木で照合する
+// IPv4アドレスはIPv4射影アドレス(::ffff:0:0/96)としてIPv6と同じ木に格納する
+// それ以外のワイルドカードは従来どおり文字列で照合する
+class AddressFilter {
+    public:
+        AddressFilter();
+
+        void Add(const std::string& pattern);
+        bool Match(const boost::asio::ip::address& address) const;
+
+    private:
+        typedef boost::asio::ip::address_v6::bytes_type Bytes;
+
+        static bool ParsePrefix(const std::string& pattern, Bytes* bytes, int* prefix_length);
+        static bool ParseWildcardPrefix(const std::string& pattern, Bytes* bytes, int* prefix_length);
+        static Bytes ToBytes(const boost::asio::ip::address& address);
+
+        void Insert(const Bytes& bytes, int prefix_length);
+
+    private:
+        struct Node {
+            Node() : terminal(false) { children[0] = children[1] = 0; }
+
+            uint32_t children[2];
+            bool terminal;
+        };
+
+        std::vector<Node> nodes_;
+        std::list<std::string> wildcard_patterns_;
+};
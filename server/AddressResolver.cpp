@@ -0,0 +1,83 @@
+//
+// AddressResolver.cpp
+//
+
+#include "AddressResolver.hpp"
+#include <boost/foreach.hpp>
+#include "../common/Logger.hpp"
+
+namespace network {
+
+    AddressResolver::AddressResolver(boost::asio::io_service& io_service) :
+        resolver_(io_service)
+    {
+    }
+
+    void AddressResolver::Resolve(const std::string& host, uint16_t port, const Callback& callback)
+    {
+        using namespace boost::posix_time;
+
+        boost::system::error_code error;
+        auto address = boost::asio::ip::address::from_string(host, error);
+        if (!error) {
+            callback(error, udp::endpoint(address, port));
+            return;
+        }
+
+        Entry& entry = entries_[host];
+        Request request = {port, callback};
+
+        if (entry.resolving) {
+            entry.requests.push_back(request);
+            return;
+        }
+
+        if (!entry.expires.is_not_a_date_time() && second_clock::universal_time() < entry.expires) {
+            callback(entry.error, entry.error ? udp::endpoint() : udp::endpoint(entry.address, port));
+            return;
+        }
+
+        entry.resolving = true;
+        entry.requests.push_back(request);
+
+        udp::resolver::query query(udp::v4(), host, "0", udp::resolver::query::numeric_service);
+        resolver_.async_resolve(query,
+            [this, host](const boost::system::error_code& error, udp::resolver::iterator iterator) {
+                HandleResolve(host, error, iterator);
+            });
+    }
+
+    void AddressResolver::HandleResolve(const std::string& host, const boost::system::error_code& error,
+        udp::resolver::iterator iterator)
+    {
+        using namespace boost::posix_time;
+
+        Entry& entry = entries_[host];
+        entry.resolving = false;
+        entry.error = error;
+
+        if (!error && iterator != udp::resolver::iterator()) {
+            entry.address = iterator->endpoint().address();
+            entry.expires = second_clock::universal_time() + seconds(ADDRESS_RESOLVER_TTL_SECONDS);
+        } else {
+            if (!entry.error) {
+                entry.error = boost::asio::error::host_not_found;
+            }
+            entry.expires = second_clock::universal_time() + seconds(ADDRESS_RESOLVER_NEGATIVE_TTL_SECONDS);
+            Logger::Error(_T("Failed to resolve %s: %s"), unicode::ToTString(host),
+                unicode::ToTString(entry.error.message()));
+        }
+
+        // コールバック中に同じホストが要求されても良いように、先に取り出す
+        std::vector<Request> requests;
+        requests.swap(entry.requests);
+        const auto result_error = entry.error;
+        const auto address = entry.address;
+
+        BOOST_FOREACH(const auto& request, requests) {
+            request.callback(result_error,
+                result_error ? udp::endpoint() : udp::endpoint(address, request.port));
+        }
+    }
+
+}
@@ -0,0 +1,58 @@
+//
+// AddressResolver.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#define ADDRESS_RESOLVER_TTL_SECONDS (300)
+#define ADDRESS_RESOLVER_NEGATIVE_TTL_SECONDS (10)
+
+namespace network {
+
+    // UDP宛先の非同期名前解決
+    // 数値のアドレスはその場で変換し、ホスト名は結果を一定時間キャッシュする
+    // 解決中の同じホストへの要求はまとめて1回の問い合わせで済ませる
+    // io_serviceのスレッドからのみ呼び出すこと
+    class AddressResolver {
+        public:
+            typedef boost::asio::ip::udp udp;
+            typedef std::function<void(const boost::system::error_code&, const udp::endpoint&)> Callback;
+
+            AddressResolver(boost::asio::io_service& io_service);
+
+            // 数値のアドレスやキャッシュが有効な場合、callbackはこの中で呼ばれる
+            void Resolve(const std::string& host, uint16_t port, const Callback& callback);
+
+        private:
+            struct Request {
+                uint16_t port;
+                Callback callback;
+            };
+
+            struct Entry {
+                Entry() : resolving(false) {}
+
+                bool resolving;
+                boost::system::error_code error;
+                boost::asio::ip::address address;
+                boost::posix_time::ptime expires;
+                std::vector<Request> requests;
+            };
+
+            void HandleResolve(const std::string& host, const boost::system::error_code& error,
+                udp::resolver::iterator iterator);
+
+        private:
+            udp::resolver resolver_;
+            std::unordered_map<std::string, Entry> entries_;
+    };
+
+}
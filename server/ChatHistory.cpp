@@ -0,0 +1,205 @@
+//
+// ChatHistory.cpp
+//
+
+#include "ChatHistory.hpp"
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <string.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
+#include "../common/network/Utils.hpp"
+#include "../common/Logger.hpp"
+
+using namespace boost::filesystem;
+
+namespace {
+    const size_t RECORD_HEADER_SIZE = 8;
+
+    // FNV-1a
+    uint32_t GetChecksum(const char* data, size_t size)
+    {
+        uint32_t hash = 2166136261U;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= static_cast<uint8_t>(data[i]);
+            hash *= 16777619U;
+        }
+        return hash;
+    }
+}
+
+ChatHistory::ChatHistory(const std::string& directory) :
+    directory_(directory)
+{
+}
+
+uint32_t ChatHistory::Append(unsigned char channel, uint32_t user_id, const std::string& message)
+{
+    Log& log = GetLog(channel);
+    if (!log.current) {
+        return 0;
+    }
+
+    const uint32_t sequence = log.last_sequence + 1;
+    std::string payload = network::Utils::Serialize(sequence,
+        static_cast<uint32_t>(std::time(nullptr)), user_id, message);
+    std::string data = network::Utils::Serialize(static_cast<uint32_t>(payload.size()),
+        GetChecksum(payload.data(), payload.size())) + payload;
+
+    // 終端の目印を書く余白も含めて確認する
+    if (data.size() + RECORD_HEADER_SIZE > CHAT_HISTORY_SEGMENT_SIZE) {
+        Logger::Error(_T("Chat message is too large to record"));
+        return 0;
+    }
+    if (log.current->size + data.size() + RECORD_HEADER_SIZE > CHAT_HISTORY_SEGMENT_SIZE) {
+        Rotate(channel, &log);
+        if (!log.current) {
+            return 0;
+        }
+    }
+
+    Segment& segment = *log.current;
+    char* address = static_cast<char*>(segment.region.get_address());
+    memcpy(address + segment.size, data.data(), data.size());
+    memset(address + segment.size + data.size(), 0, RECORD_HEADER_SIZE);
+
+    IndexItem item = {sequence, &segment, segment.size, data.size()};
+    log.index.push_back(item);
+    log.last_sequence = sequence;
+    segment.size += data.size();
+
+    return sequence;
+}
+
+void ChatHistory::Get(unsigned char channel, uint32_t sequence, size_t max_count, size_t max_bytes,
+    std::vector<Entry>* entries)
+{
+    const Log& log = GetLog(channel);
+    size_t bytes = 0;
+
+    auto accept = [&](const IndexItem& item) -> bool {
+        if (entries->size() >= max_count || bytes + item.size > max_bytes) {
+            return false;
+        }
+        Entry entry;
+        Decode(*item.segment, item, &entry);
+        entries->push_back(entry);
+        bytes += item.size;
+        return true;
+    };
+
+    if (sequence == 0) {
+        for (auto it = log.index.rbegin(); it != log.index.rend() && accept(*it); ++it);
+        std::reverse(entries->begin(), entries->end());
+    } else {
+        auto begin = std::upper_bound(log.index.begin(), log.index.end(), sequence,
+            [](uint32_t value, const IndexItem& item) { return value < item.sequence; });
+        for (auto it = begin; it != log.index.end() && accept(*it); ++it);
+    }
+}
+
+ChatHistory::Log& ChatHistory::GetLog(unsigned char channel)
+{
+    auto it = logs_.find(channel);
+    if (it != logs_.end()) {
+        return it->second;
+    }
+
+    try {
+        if (!exists(directory_)) {
+            create_directory(directory_);
+        }
+    } catch (const std::exception& e) {
+        Logger::Error(unicode::ToTString(e.what()));
+    }
+
+    Log& log = logs_[channel];
+    if (exists(GetPath(channel, true))) {
+        log.previous = OpenSegment(GetPath(channel, true), &log);
+    }
+    log.current = OpenSegment(GetPath(channel, false), &log);
+
+    return log;
+}
+
+ChatHistory::SegmentPtr ChatHistory::OpenSegment(const std::string& path, Log* log)
+{
+    using namespace boost::interprocess;
+
+    auto segment = std::make_shared<Segment>();
+    try {
+        if (!exists(path)) {
+            std::ofstream ofs(path.c_str(), std::ios::binary);
+        }
+        if (file_size(path) != CHAT_HISTORY_SEGMENT_SIZE) {
+            resize_file(path, CHAT_HISTORY_SEGMENT_SIZE);
+        }
+
+        file_mapping file(path.c_str(), read_write);
+        mapped_region region(file, read_write);
+        segment->file.swap(file);
+        segment->region.swap(region);
+    } catch (const std::exception& e) {
+        Logger::Error(unicode::ToTString(e.what()));
+        return SegmentPtr();
+    }
+
+    // 長さが0か、チェックサムが合わない記録までを有効とする
+    const char* data = static_cast<const char*>(segment->region.get_address());
+    size_t offset = 0;
+    while (offset + RECORD_HEADER_SIZE <= CHAT_HISTORY_SEGMENT_SIZE) {
+        uint32_t payload_size, checksum;
+        network::Utils::Deserialize(std::string(data + offset, RECORD_HEADER_SIZE),
+            &payload_size, &checksum);
+
+        const char* payload = data + offset + RECORD_HEADER_SIZE;
+        if (payload_size < sizeof(uint32_t) ||
+            CHAT_HISTORY_SEGMENT_SIZE - offset - RECORD_HEADER_SIZE < payload_size ||
+            GetChecksum(payload, payload_size) != checksum) {
+            break;
+        }
+
+        IndexItem item = {0, segment.get(), offset, RECORD_HEADER_SIZE + payload_size};
+        network::Utils::Deserialize(std::string(payload, sizeof(uint32_t)), &item.sequence);
+        log->index.push_back(item);
+        log->last_sequence = std::max(log->last_sequence, item.sequence);
+
+        offset += item.size;
+    }
+    segment->size = offset;
+
+    return segment;
+}
+
+void ChatHistory::Rotate(unsigned char channel, Log* log)
+{
+    // マップを解除してから、現在のセグメントを1世代前に置き換える
+    log->index.clear();
+    log->previous.reset();
+    log->current.reset();
+
+    try {
+        rename(GetPath(channel, false), GetPath(channel, true));
+    } catch (const std::exception& e) {
+        Logger::Error(unicode::ToTString(e.what()));
+        return;
+    }
+
+    log->previous = OpenSegment(GetPath(channel, true), log);
+    log->current = OpenSegment(GetPath(channel, false), log);
+}
+
+std::string ChatHistory::GetPath(unsigned char channel, bool previous) const
+{
+    return directory_ + "/channel_" + boost::lexical_cast<std::string>(static_cast<int>(channel)) +
+        (previous ? ".old.log" : ".log");
+}
+
+void ChatHistory::Decode(const Segment& segment, const IndexItem& item, Entry* entry)
+{
+    const char* data = static_cast<const char*>(segment.region.get_address());
+    network::Utils::Deserialize(
+        std::string(data + item.offset + RECORD_HEADER_SIZE, item.size - RECORD_HEADER_SIZE),
+        &entry->sequence, &entry->time, &entry->user_id, &entry->message);
+}
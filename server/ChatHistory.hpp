@@ -0,0 +1,75 @@
+//
+// ChatHistory.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <stdint.h>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#define CHAT_HISTORY_DIRECTORY "./chat"
+#define CHAT_HISTORY_SEGMENT_SIZE (1024 * 1024)
+#define CHAT_HISTORY_MAX_COUNT (100)
+#define CHAT_HISTORY_MAX_BATCH_SIZE (48 * 1024)
+
+// チャンネルごとのチャット履歴
+// 固定長のセグメントファイルをメモリマップして追記し、いっぱいになると1世代だけ残して切り替える
+// シーケンス番号から記録位置を引く索引はメモリ上に持ち、起動時にセグメントを走査して作り直す
+class ChatHistory {
+    public:
+        struct Entry {
+            uint32_t sequence;
+            uint32_t time;
+            uint32_t user_id;
+            std::string message;
+        };
+
+        ChatHistory(const std::string& directory = CHAT_HISTORY_DIRECTORY);
+
+        uint32_t Append(unsigned char channel, uint32_t user_id, const std::string& message);
+
+        // sequenceが0の場合は最新のものから、それ以外はsequenceより後のものを古い順に返す
+        void Get(unsigned char channel, uint32_t sequence, size_t max_count, size_t max_bytes,
+            std::vector<Entry>* entries);
+
+    private:
+        struct Segment {
+            boost::interprocess::file_mapping file;
+            boost::interprocess::mapped_region region;
+            size_t size;
+        };
+        typedef std::shared_ptr<Segment> SegmentPtr;
+
+        struct IndexItem {
+            uint32_t sequence;
+            Segment* segment;
+            size_t offset;
+            size_t size;
+        };
+
+        struct Log {
+            Log() : last_sequence(0) {}
+
+            SegmentPtr previous;
+            SegmentPtr current;
+            std::deque<IndexItem> index;
+            uint32_t last_sequence;
+        };
+
+        Log& GetLog(unsigned char channel);
+        SegmentPtr OpenSegment(const std::string& path, Log* log);
+        void Rotate(unsigned char channel, Log* log);
+        std::string GetPath(unsigned char channel, bool previous) const;
+
+        static void Decode(const Segment& segment, const IndexItem& item, Entry* entry);
+
+    private:
+        std::string directory_;
+        std::unordered_map<unsigned char, Log> logs_;
+};
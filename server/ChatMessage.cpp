@@ -0,0 +1,402 @@
+//
+// ChatMessage.cpp
+//
+
+#include "ChatMessage.hpp"
+#include <ctime>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace {
+
+    class Scanner {
+        public:
+            Scanner(const std::string& json) :
+                it_(json.data()),
+                end_(json.data() + json.size()) {}
+
+            bool ScanMessage(ChatMessage* message)
+            {
+                bool has_private = false;
+
+                SkipSpace();
+                if (!Consume('{')) {
+                    return false;
+                }
+
+                SkipSpace();
+                if (!Consume('}')) {
+                    do {
+                        std::string key;
+                        SkipSpace();
+                        if (!ScanString(&key)) {
+                            return false;
+                        }
+                        SkipSpace();
+                        if (!Consume(':')) {
+                            return false;
+                        }
+                        SkipSpace();
+
+                        // 重複したキーは最初の値を使う
+                        if (key == "private" && !has_private) {
+                            has_private = true;
+                            if (!ScanPrivate(&message->private_ids)) {
+                                return false;
+                            }
+                        } else if (!SkipValue(0)) {
+                            return false;
+                        }
+                        SkipSpace();
+                    } while (Consume(','));
+
+                    if (!Consume('}')) {
+                        return false;
+                    }
+                }
+
+                SkipSpace();
+                return it_ == end_;
+            }
+
+        private:
+            enum {
+                MAX_DEPTH = 64
+            };
+
+            bool Consume(char c)
+            {
+                if (it_ < end_ && *it_ == c) {
+                    ++it_;
+                    return true;
+                }
+                return false;
+            }
+
+            void SkipSpace()
+            {
+                while (it_ < end_ && (*it_ == ' ' || *it_ == '\t' || *it_ == '\r' || *it_ == '\n')) {
+                    ++it_;
+                }
+            }
+
+            // 数値の配列か、数値を表す文字列の配列
+            // 配列以外の値は宛先なしとみなす
+            bool ScanPrivate(std::vector<uint32_t>* ids)
+            {
+                if (!Consume('[')) {
+                    return SkipValue(0);
+                }
+
+                SkipSpace();
+                if (Consume(']')) {
+                    return true;
+                }
+
+                do {
+                    SkipSpace();
+                    std::string text;
+                    if (!ScanText(&text) || !ToUserId(text, ids)) {
+                        return false;
+                    }
+                    SkipSpace();
+                } while (Consume(','));
+
+                return Consume(']');
+            }
+
+            static bool ToUserId(const std::string& text, std::vector<uint32_t>* ids)
+            {
+                if (text.empty() || text.size() > 10) {
+                    return false;
+                }
+
+                uint64_t value = 0;
+                for (auto it = text.begin(); it != text.end(); ++it) {
+                    if (*it < '0' || *it > '9') {
+                        return false;
+                    }
+                    value = value * 10 + (*it - '0');
+                }
+
+                if (value > UINT32_MAX) {
+                    return false;
+                }
+                ids->push_back(static_cast<uint32_t>(value));
+                return true;
+            }
+
+            // 文字列はデコードした値、数値・リテラルはそのままの文字列
+            // オブジェクトと配列は空文字列
+            bool ScanText(std::string* text)
+            {
+                if (it_ >= end_) {
+                    return false;
+                }
+
+                if (*it_ == '"') {
+                    return ScanString(text);
+                }
+
+                const char* begin = it_;
+                if (!SkipValue(0)) {
+                    return false;
+                }
+                if (*begin != '{' && *begin != '[') {
+                    text->assign(begin, it_);
+                }
+                return true;
+            }
+
+            bool SkipValue(int depth)
+            {
+                if (it_ >= end_ || depth > MAX_DEPTH) {
+                    return false;
+                }
+
+                switch (*it_) {
+                case '"':
+                    return ScanString(nullptr);
+                case '{':
+                    ++it_;
+                    SkipSpace();
+                    if (Consume('}')) {
+                        return true;
+                    }
+                    do {
+                        SkipSpace();
+                        if (!ScanString(nullptr)) {
+                            return false;
+                        }
+                        SkipSpace();
+                        if (!Consume(':')) {
+                            return false;
+                        }
+                        SkipSpace();
+                        if (!SkipValue(depth + 1)) {
+                            return false;
+                        }
+                        SkipSpace();
+                    } while (Consume(','));
+                    return Consume('}');
+                case '[':
+                    ++it_;
+                    SkipSpace();
+                    if (Consume(']')) {
+                        return true;
+                    }
+                    do {
+                        SkipSpace();
+                        if (!SkipValue(depth + 1)) {
+                            return false;
+                        }
+                        SkipSpace();
+                    } while (Consume(','));
+                    return Consume(']');
+                case 't':
+                    return ConsumeLiteral("true");
+                case 'f':
+                    return ConsumeLiteral("false");
+                case 'n':
+                    return ConsumeLiteral("null");
+                default:
+                    return SkipNumber();
+                }
+            }
+
+            bool ConsumeLiteral(const char* literal)
+            {
+                for (; *literal; ++literal) {
+                    if (!Consume(*literal)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            bool ConsumeDigits()
+            {
+                const char* begin = it_;
+                while (it_ < end_ && *it_ >= '0' && *it_ <= '9') {
+                    ++it_;
+                }
+                return it_ > begin;
+            }
+
+            bool SkipNumber()
+            {
+                Consume('-');
+                if (!Consume('0') && !ConsumeDigits()) {
+                    return false;
+                }
+                if (Consume('.') && !ConsumeDigits()) {
+                    return false;
+                }
+                if (Consume('e') || Consume('E')) {
+                    if (!Consume('+')) {
+                        Consume('-');
+                    }
+                    if (!ConsumeDigits()) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            bool ReadHex4(uint32_t* value)
+            {
+                if (end_ - it_ < 4) {
+                    return false;
+                }
+                *value = 0;
+                for (int i = 0; i < 4; i++, ++it_) {
+                    char c = *it_;
+                    *value <<= 4;
+                    if (c >= '0' && c <= '9') {
+                        *value |= c - '0';
+                    } else if (c >= 'a' && c <= 'f') {
+                        *value |= c - 'a' + 10;
+                    } else if (c >= 'A' && c <= 'F') {
+                        *value |= c - 'A' + 10;
+                    } else {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            static void AppendUTF8(std::string* out, uint32_t code)
+            {
+                if (code < 0x80) {
+                    *out += static_cast<char>(code);
+                } else if (code < 0x800) {
+                    *out += static_cast<char>(0xC0 | (code >> 6));
+                    *out += static_cast<char>(0x80 | (code & 0x3F));
+                } else if (code < 0x10000) {
+                    *out += static_cast<char>(0xE0 | (code >> 12));
+                    *out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    *out += static_cast<char>(0x80 | (code & 0x3F));
+                } else {
+                    *out += static_cast<char>(0xF0 | (code >> 18));
+                    *out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                    *out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    *out += static_cast<char>(0x80 | (code & 0x3F));
+                }
+            }
+
+            // outがnullptrの場合は検証のみ
+            bool ScanString(std::string* out)
+            {
+                if (!Consume('"')) {
+                    return false;
+                }
+
+                while (it_ < end_) {
+                    // エスケープのない区間はまとめてコピーする
+                    const char* begin = it_;
+                    while (it_ < end_ && *it_ != '"' && *it_ != '\\' &&
+                        static_cast<unsigned char>(*it_) >= 0x20) {
+                        ++it_;
+                    }
+                    if (out) {
+                        out->append(begin, it_);
+                    }
+
+                    if (it_ >= end_ || static_cast<unsigned char>(*it_) < 0x20) {
+                        return false;
+                    }
+                    if (*it_++ == '"') {
+                        return true;
+                    }
+
+                    if (it_ >= end_) {
+                        return false;
+                    }
+                    char escaped = *it_++;
+                    char c;
+                    switch (escaped) {
+                    case '"':   c = '"';    break;
+                    case '\\':  c = '\\';   break;
+                    case '/':   c = '/';    break;
+                    case 'b':   c = '\b';   break;
+                    case 'f':   c = '\f';   break;
+                    case 'n':   c = '\n';   break;
+                    case 'r':   c = '\r';   break;
+                    case 't':   c = '\t';   break;
+                    case 'u':
+                        {
+                            uint32_t code;
+                            if (!ReadHex4(&code)) {
+                                return false;
+                            }
+                            // サロゲートペア
+                            if (code >= 0xD800 && code <= 0xDBFF) {
+                                uint32_t low;
+                                if (!Consume('\\') || !Consume('u') || !ReadHex4(&low) ||
+                                    low < 0xDC00 || low > 0xDFFF) {
+                                    return false;
+                                }
+                                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                            }
+                            if (out) {
+                                AppendUTF8(out, code);
+                            }
+                        }
+                        continue;
+                    default:
+                        return false;
+                    }
+                    if (out) {
+                        *out += c;
+                    }
+                }
+                return false;
+            }
+
+        private:
+            const char* it_;
+            const char* end_;
+    };
+
+}
+
+bool ChatMessage::Parse(const std::string& json)
+{
+    private_ids.clear();
+
+    Scanner scanner(json);
+    return scanner.ScanMessage(this);
+}
+
+ChatInfoEnvelope::ChatInfoEnvelope() :
+    last_time_(0)
+{
+}
+
+const std::string& ChatInfoEnvelope::Build(uint32_t user_id, uint32_t sequence)
+{
+    using namespace boost::posix_time;
+
+    time_t now = std::time(nullptr);
+    if (now != last_time_) {
+        last_time_ = now;
+        time_suffix_ = "\",\"time\":\"" + to_iso_extended_string(from_time_t(now)) + "\"}";
+    }
+
+    json_.assign("{\"id\":\"");
+    json_ += std::to_string(static_cast<unsigned long long>(user_id));
+    if (sequence > 0) {
+        json_ += "\",\"seq\":\"";
+        json_ += std::to_string(static_cast<unsigned long long>(sequence));
+    }
+    json_ += time_suffix_;
+    return json_;
+}
+
+std::string ChatInfoEnvelope::Format(uint32_t user_id, uint32_t sequence, time_t time)
+{
+    using namespace boost::posix_time;
+
+    return "{\"id\":\"" + std::to_string(static_cast<unsigned long long>(user_id)) +
+        "\",\"seq\":\"" + std::to_string(static_cast<unsigned long long>(sequence)) +
+        "\",\"time\":\"" + to_iso_extended_string(from_time_t(time)) + "\"}";
+}
@@ -0,0 +1,35 @@
+//
+// ChatMessage.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+// チャットメッセージのJSON
+// 全体の文法を検証しながら、privateだけを1回の走査で取り出す
+// 本文はそのまま転送するので取り出さない
+struct ChatMessage {
+    std::vector<uint32_t> private_ids;
+
+    bool Parse(const std::string& json);
+};
+
+// 受信したメッセージに付加する送信者情報
+// 時刻の文字列は秒が変わったときだけ作り直す
+// チャット履歴に記録したメッセージにはシーケンス番号を付ける
+class ChatInfoEnvelope {
+    public:
+        ChatInfoEnvelope();
+        const std::string& Build(uint32_t user_id, uint32_t sequence = 0);
+
+        static std::string Format(uint32_t user_id, uint32_t sequence, time_t time);
+
+    private:
+        time_t last_time_;
+        std::string time_suffix_;
+        std::string json_;
+};
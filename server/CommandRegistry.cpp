@@ -0,0 +1,104 @@
+//
+// CommandRegistry.cpp
+//
+
+#include "CommandRegistry.hpp"
+#include <stdio.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace network {
+
+    CommandRegistry::CommandRegistry() :
+        entries_(0x100)
+    {
+        // Collectorはサーバーのio_serviceのスレッドで呼ばれるので、Dispatchと競合しない
+        metrics_collector_ = metrics::Metrics::getInstance().AddCollector(
+            [this](metrics::Writer* writer) { CollectMetrics(writer); });
+    }
+
+    CommandRegistry::~CommandRegistry()
+    {
+        metrics::Metrics::getInstance().RemoveCollector(metrics_collector_);
+    }
+
+    void CommandRegistry::RegisterRaw(header::CommandHeader header, const Handler& handler, bool log)
+    {
+        assert(header < 0x100);
+        entries_[header].handler = handler;
+        entries_[header].log = log;
+    }
+
+    bool CommandRegistry::Dispatch(Command& c)
+    {
+        using namespace boost::posix_time;
+
+        if (c.header() >= entries_.size() || !entries_[c.header()].handler) {
+            return false;
+        }
+
+        Entry& entry = entries_[c.header()];
+        auto start = microsec_clock::universal_time();
+
+        entry.handler(c);
+
+        uint64_t time = (microsec_clock::universal_time() - start).total_microseconds();
+        entry.count++;
+        entry.total_time += time;
+        entry.max_time = std::max(entry.max_time, time);
+        metrics::Metrics::getInstance().dispatch_time.Record(time);
+
+        // ログの文字列は出力するハンドラでのみ作る
+        if (entry.log) {
+            if (auto session = c.session().lock()) {
+                LOG_INFO(_T("Receive: 0x%02x %dbyte from %s"), c.header(), c.body().size(),
+                    session->global_ip());
+            } else {
+                LOG_INFO(_T("Receive: 0x%02x %dbyte"), c.header(), c.body().size());
+            }
+        }
+
+        return true;
+    }
+
+    void CommandRegistry::CollectMetrics(metrics::Writer* writer) const
+    {
+        writer->Type("mmo_dispatch_calls_total", "Handler calls per header.", "counter");
+        for (size_t header = 0; header < entries_.size(); header++) {
+            if (entries_[header].count > 0) {
+                char label[32];
+                snprintf(label, sizeof(label), "header=\"0x%02x\"", static_cast<unsigned int>(header));
+                writer->Sample("mmo_dispatch_calls_total", label, static_cast<double>(entries_[header].count));
+            }
+        }
+
+        writer->Type("mmo_dispatch_handler_seconds_total", "Time spent in handlers per header.", "counter");
+        for (size_t header = 0; header < entries_.size(); header++) {
+            if (entries_[header].count > 0) {
+                char label[32];
+                snprintf(label, sizeof(label), "header=\"0x%02x\"", static_cast<unsigned int>(header));
+                writer->Sample("mmo_dispatch_handler_seconds_total", label, entries_[header].total_time * 1e-6);
+            }
+        }
+
+        writer->Type("mmo_dispatch_handler_max_seconds", "Longest handler call per header.", "gauge");
+        for (size_t header = 0; header < entries_.size(); header++) {
+            if (entries_[header].count > 0) {
+                char label[32];
+                snprintf(label, sizeof(label), "header=\"0x%02x\"", static_cast<unsigned int>(header));
+                writer->Sample("mmo_dispatch_handler_max_seconds", label, entries_[header].max_time * 1e-6);
+            }
+        }
+    }
+
+    void CommandRegistry::LogStats() const
+    {
+        for (size_t header = 0; header < entries_.size(); header++) {
+            const Entry& entry = entries_[header];
+            if (entry.count > 0) {
+                Logger::Info(_T("Command 0x%02x: %d calls, avg %dus, max %dus"), header, entry.count,
+                    entry.total_time / entry.count, entry.max_time);
+            }
+        }
+    }
+
+}
@@ -0,0 +1,185 @@
+//
+// CommandRegistry.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <stdint.h>
+#include "../common/network/Command.hpp"
+#include "../common/network/Session.hpp"
+#include "../common/Logger.hpp"
+#include "../common/Metrics.hpp"
+
+namespace network {
+
+    // CommandTemplateNの引数型から、デコード処理を生成する
+    namespace detail {
+
+        template<class T>
+        struct ArgumentValue {
+            typedef typename std::remove_const<typename std::remove_reference<T>::type>::type type;
+        };
+
+        // 本体に必要な最小のバイト数 (文字列は長さの分のみ)
+        template<class T>
+        struct ArgumentSize {
+            static const size_t value = sizeof(typename ArgumentValue<T>::type);
+        };
+
+        template<>
+        struct ArgumentSize<const std::string&> {
+            static const size_t value = sizeof(int);
+        };
+
+        template<class T>
+        struct CommandArguments;
+
+        template<header::CommandHeader Header>
+        struct CommandArguments<CommandTemplate0<Header>> {
+            static const header::CommandHeader header = Header;
+            static const size_t min_size = 0;
+
+            template<class Func>
+            static void Invoke(const Func& func, const SessionPtr& session, const std::string& body)
+            {
+                func(session);
+            }
+        };
+
+        template<header::CommandHeader Header, class T1>
+        struct CommandArguments<CommandTemplate1<Header, T1>> {
+            static const header::CommandHeader header = Header;
+            static const size_t min_size = ArgumentSize<T1>::value;
+
+            template<class Func>
+            static void Invoke(const Func& func, const SessionPtr& session, const std::string& body)
+            {
+                typename ArgumentValue<T1>::type t1 = typename ArgumentValue<T1>::type();
+                Utils::Deserialize(body, &t1);
+                func(session, t1);
+            }
+        };
+
+        template<header::CommandHeader Header, class T1, class T2>
+        struct CommandArguments<CommandTemplate2<Header, T1, T2>> {
+            static const header::CommandHeader header = Header;
+            static const size_t min_size = ArgumentSize<T1>::value + ArgumentSize<T2>::value;
+
+            template<class Func>
+            static void Invoke(const Func& func, const SessionPtr& session, const std::string& body)
+            {
+                typename ArgumentValue<T1>::type t1 = typename ArgumentValue<T1>::type();
+                typename ArgumentValue<T2>::type t2 = typename ArgumentValue<T2>::type();
+                Utils::Deserialize(body, &t1, &t2);
+                func(session, t1, t2);
+            }
+        };
+
+        template<header::CommandHeader Header, class T1, class T2, class T3>
+        struct CommandArguments<CommandTemplate3<Header, T1, T2, T3>> {
+            static const header::CommandHeader header = Header;
+            static const size_t min_size = ArgumentSize<T1>::value + ArgumentSize<T2>::value +
+                ArgumentSize<T3>::value;
+
+            template<class Func>
+            static void Invoke(const Func& func, const SessionPtr& session, const std::string& body)
+            {
+                typename ArgumentValue<T1>::type t1 = typename ArgumentValue<T1>::type();
+                typename ArgumentValue<T2>::type t2 = typename ArgumentValue<T2>::type();
+                typename ArgumentValue<T3>::type t3 = typename ArgumentValue<T3>::type();
+                Utils::Deserialize(body, &t1, &t2, &t3);
+                func(session, t1, t2, t3);
+            }
+        };
+
+        template<header::CommandHeader Header, class T1, class T2, class T3, class T4>
+        struct CommandArguments<CommandTemplate4<Header, T1, T2, T3, T4>> {
+            static const header::CommandHeader header = Header;
+            static const size_t min_size = ArgumentSize<T1>::value + ArgumentSize<T2>::value +
+                ArgumentSize<T3>::value + ArgumentSize<T4>::value;
+
+            template<class Func>
+            static void Invoke(const Func& func, const SessionPtr& session, const std::string& body)
+            {
+                typename ArgumentValue<T1>::type t1 = typename ArgumentValue<T1>::type();
+                typename ArgumentValue<T2>::type t2 = typename ArgumentValue<T2>::type();
+                typename ArgumentValue<T3>::type t3 = typename ArgumentValue<T3>::type();
+                typename ArgumentValue<T4>::type t4 = typename ArgumentValue<T4>::type();
+                Utils::Deserialize(body, &t1, &t2, &t3, &t4);
+                func(session, t1, t2, t3, t4);
+            }
+        };
+
+        template<header::CommandHeader Header, class T1, class T2, class T3, class T4, class T5>
+        struct CommandArguments<CommandTemplate5<Header, T1, T2, T3, T4, T5>> {
+            static const header::CommandHeader header = Header;
+            static const size_t min_size = ArgumentSize<T1>::value + ArgumentSize<T2>::value +
+                ArgumentSize<T3>::value + ArgumentSize<T4>::value + ArgumentSize<T5>::value;
+
+            template<class Func>
+            static void Invoke(const Func& func, const SessionPtr& session, const std::string& body)
+            {
+                typename ArgumentValue<T1>::type t1 = typename ArgumentValue<T1>::type();
+                typename ArgumentValue<T2>::type t2 = typename ArgumentValue<T2>::type();
+                typename ArgumentValue<T3>::type t3 = typename ArgumentValue<T3>::type();
+                typename ArgumentValue<T4>::type t4 = typename ArgumentValue<T4>::type();
+                typename ArgumentValue<T5>::type t5 = typename ArgumentValue<T5>::type();
+                Utils::Deserialize(body, &t1, &t2, &t3, &t4, &t5);
+                func(session, t1, t2, t3, t4, t5);
+            }
+        };
+
+    }
+
+    // ヘッダーごとのコマンドハンドラ
+    // 呼び出し回数と処理時間を記録する
+    class CommandRegistry {
+        public:
+            typedef std::function<void(Command&)> Handler;
+
+            CommandRegistry();
+            ~CommandRegistry();
+
+            // 型付きハンドラ (セッションが有効な場合のみ、デコードした引数で呼び出す)
+            template<class CommandType, class Func>
+            void Register(const Func& func, bool log = false)
+            {
+                typedef detail::CommandArguments<CommandType> Arguments;
+                RegisterRaw(Arguments::header, [func](Command& c) {
+                    if (c.body().size() < Arguments::min_size) {
+                        Logger::Error(_T("Too short command body: 0x%02x %dbyte"), c.header(), c.body().size());
+                        return;
+                    }
+                    if (auto session = c.session().lock()) {
+                        Arguments::Invoke(func, session, c.body());
+                    }
+                }, log);
+            }
+
+            void RegisterRaw(header::CommandHeader header, const Handler& handler, bool log = false);
+
+            bool Dispatch(Command& c);
+            void LogStats() const;
+
+        private:
+            void CollectMetrics(metrics::Writer* writer) const;
+
+            struct Entry {
+                Entry() : log(false), count(0), total_time(0), max_time(0) {}
+
+                Handler handler;
+                bool log;
+                uint64_t count;
+                uint64_t total_time;
+                uint64_t max_time;
+            };
+
+            std::vector<Entry> entries_;
+            int metrics_collector_;
+    };
+
+}
@@ -3,16 +3,30 @@
 //
 
 #include "Config.hpp"
-#include <boost/filesystem.hpp>
 #include <stdint.h>
 
-using namespace boost::filesystem;
-
 const char* Config::CONFIG_JSON = "./config.json";
 
 namespace {
     using boost::property_tree::ptree;
 
+    // 値の型が合わない場合は既定値にせず、ptree_bad_dataを投げる
+    template<class T>
+    T GetValue(const ptree& pt, const char* path, const T& default_value)
+    {
+        auto child = pt.get_child_optional(path);
+        if (!child) {
+            return default_value;
+        }
+
+        auto value = child->get_value_optional<T>();
+        if (!value) {
+            throw boost::property_tree::ptree_bad_data(
+                std::string("invalid value for \"") + path + "\": " + child->data(), child->data());
+        }
+        return *value;
+    }
+
 	void MergePtree(ptree* dst,
 		const ptree& source,
 		const ptree::path_type& current_path = ptree::path_type(""))
@@ -35,59 +49,82 @@ namespace {
 
 Config::Config()
 {
-	Load();
+	valid_ = Load();
 }
 
-void Config::Load()
+bool Config::Load()
 {
-
 	try {
 		std::ifstream ifs;
 		ifs.open(CONFIG_JSON);
 		read_json(ifs, pt_);
+		LoadValues();
+		return true;
 	} catch(std::exception& e) {
 		Logger::Error(unicode::ToTString(e.what()));
 	}
-	
-    port_ =             pt_.get<uint16_t>("port", 39390);
-    server_name_ =		pt_.get<std::string>("server_name", "MMO Server");
-    server_note_ =		pt_.get<std::string>("server_note", "");
-	stage_ =			pt_.get<std::string>("stage", unicode::ToString(_T("stage:ケロリン町")));
-    capacity_ =			pt_.get<int>("capacity", 20);
 
-	public_ =			pt_.get<bool>("public", false);
+	// 読み込めなかった場合や値の型が合わない場合は、すべて既定値にする
+	pt_.clear();
+	LoadValues();
+	return false;
+}
+
+void Config::LoadValues()
+{
+	blocking_address_patterns_.clear();
+	blocking_address_filter_ = AddressFilter();
+	lobby_servers_.clear();
+
+    port_ =             GetValue<uint16_t>(pt_, "port", 39390);
+    server_name_ =		GetValue<std::string>(pt_, "server_name", "MMO Server");
+    server_note_ =		GetValue<std::string>(pt_, "server_note", "");
+	stage_ =			GetValue<std::string>(pt_, "stage", unicode::ToString(_T("stage:ケロリン町")));
+    capacity_ =			GetValue<int>(pt_, "capacity", 20);
 
-	receive_limit_1_ =	pt_.get<int>("receive_limit_1", 60);
-	receive_limit_2_ =	pt_.get<int>("receive_limit_2", 100);
+	public_ =			GetValue<bool>(pt_, "public", false);
+
+	receive_limit_1_ =	GetValue<int>(pt_, "receive_limit_1", 60);
+	receive_limit_2_ =	GetValue<int>(pt_, "receive_limit_2", 100);
+
+	interest_cell_size_ =	GetValue<int>(pt_, "interest_cell_size", 200);
+	interest_radius_ =		GetValue<int>(pt_, "interest_radius", 0);
+
+	tick_rate_ =		std::max(1, std::min(60, GetValue<int>(pt_, "tick_rate", 15)));
+
+	push_account_patch_ =	GetValue<bool>(pt_, "push_account_patch", true);
+
+	{
+		auto log_level = GetValue<std::string>(pt_, "log_level", "info");
+		log_level_ = log_level == "debug" ? LOGGER_LEVEL_DEBUG :
+			log_level == "error" ? LOGGER_LEVEL_ERROR : LOGGER_LEVEL_INFO;
+	}
+
+	metrics_port_ =		GetValue<uint16_t>(pt_, "metrics_port", 0);
+	metrics_file_ =		GetValue<std::string>(pt_, "metrics_file", "");
+	metrics_file_interval_ =	GetValue<int>(pt_, "metrics_file_interval", 60);
 
 	auto patterns =		pt_.get_child("blocking_address_patterns", ptree());
 	BOOST_FOREACH(const auto& item, patterns) {
 		blocking_address_patterns_.push_back(item.second.get_value<std::string>());
+		blocking_address_filter_.Add(blocking_address_patterns_.back());
 	}
 
 	auto lobby_servers = pt_.get_child("lobby_servers", ptree());
 	BOOST_FOREACH(const auto& item, lobby_servers) {
 		lobby_servers_.push_back(item.second.get_value<std::string>());
 	}
-	
-	if (exists(CONFIG_JSON)) {
-		timestamp_ = last_write_time(CONFIG_JSON);
-	}
-}
-
-void Config::Reload()
-{
-	if (exists(CONFIG_JSON) &&
-		timestamp_ < last_write_time(CONFIG_JSON)) {
-		Config::Load();
-		Logger::Info(_T("Configuration reloaded."));
-	}
 }
 
 //
 // アクセサ
 //
 
+bool Config::is_valid() const
+{
+	return valid_;
+}
+
 uint16_t Config::port() const
 {
 	return port_;
@@ -128,11 +165,56 @@ int Config::receive_limit_2() const
 	return receive_limit_2_;
 }
 
+int Config::interest_cell_size() const
+{
+	return interest_cell_size_;
+}
+
+int Config::interest_radius() const
+{
+	return interest_radius_;
+}
+
+int Config::tick_rate() const
+{
+	return tick_rate_;
+}
+
+bool Config::push_account_patch() const
+{
+	return push_account_patch_;
+}
+
+int Config::log_level() const
+{
+	return log_level_;
+}
+
+uint16_t Config::metrics_port() const
+{
+	return metrics_port_;
+}
+
+const std::string& Config::metrics_file() const
+{
+	return metrics_file_;
+}
+
+int Config::metrics_file_interval() const
+{
+	return metrics_file_interval_;
+}
+
 const std::list<std::string>& Config::blocking_address_patterns() const
 {
 	return blocking_address_patterns_;
 }
 
+const AddressFilter& Config::blocking_address_filter() const
+{
+	return blocking_address_filter_;
+}
+
 const std::list<std::string>& Config::lobby_servers() const
 {
 	return lobby_servers_;
@@ -9,15 +9,25 @@
 #include <istream>
 #include <string>
 #include <list>
+#include <memory>
+#include "AddressFilter.hpp"
 
+// サーバーの設定 (読み込み後は変更しない)
 class Config
 {
     public:
 		Config();
-		void Reload();
+
+		static const char* CONFIG_JSON;
+
+		// 設定ファイルを読み込めたか (falseの場合はすべて既定値)
+		bool is_valid() const;
 
     private:
-		void Load();
+		bool Load();
+		void LoadValues();
+
+		bool valid_;
 
         uint16_t port_;
         std::string server_name_;
@@ -29,8 +39,22 @@ class Config
 
 		int receive_limit_1_;
 		int receive_limit_2_;
+
+		int interest_cell_size_;
+		int interest_radius_;
+
+		int tick_rate_;
+
+		bool push_account_patch_;
+
+		int log_level_;
+
+		uint16_t metrics_port_;
+		std::string metrics_file_;
+		int metrics_file_interval_;
 		
 		std::list<std::string> blocking_address_patterns_;
+		AddressFilter blocking_address_filter_;
 		std::list<std::string> lobby_servers_;
 
 		boost::property_tree::ptree pt_;
@@ -48,12 +72,24 @@ class Config
 		int receive_limit_1() const;
 		int receive_limit_2() const;
 
+		int interest_cell_size() const;
+		int interest_radius() const;
+
+		int tick_rate() const;
+
+		bool push_account_patch() const;
+
+		int log_level() const;
+
+		uint16_t metrics_port() const;
+		const std::string& metrics_file() const;
+		int metrics_file_interval() const;
+
 		const std::list<std::string>& blocking_address_patterns() const;
+		const AddressFilter& blocking_address_filter() const;
 		const std::list<std::string>& lobby_servers() const;
 
 		const boost::property_tree::ptree& pt() const;
-
-	private:
-		static const char* CONFIG_JSON;
-		time_t timestamp_;
 };
+
+typedef std::shared_ptr<const Config> ConfigPtr;
@@ -0,0 +1,112 @@
+//
+// ConfigWatcher.cpp
+//
+
+#include "ConfigWatcher.hpp"
+#include <boost/filesystem.hpp>
+#include "../common/Logger.hpp"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#endif
+
+ConfigWatcher::ConfigWatcher() :
+    current_(new Config()),
+    stopped_(false)
+{
+    Logger::SetLevel(current_->log_level());
+
+    thread_ = boost::thread([this](){ Run(); });
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+    stopped_.store(true);
+    thread_.join();
+}
+
+ConfigPtr ConfigWatcher::config() const
+{
+    return std::atomic_load(&current_);
+}
+
+void ConfigWatcher::Update()
+{
+    ConfigPtr config(new Config());
+    if (!config->is_valid()) {
+        Logger::Error(_T("Failed to reload the configuration. Keeping the previous one."));
+        return;
+    }
+
+    std::atomic_store(&current_, config);
+    Logger::SetLevel(config->log_level());
+    Logger::Info(_T("Configuration reloaded."));
+}
+
+#ifdef __linux__
+
+void ConfigWatcher::Run()
+{
+    // エディタによっては別名で保存してから置き換えるので、ディレクトリを監視する
+    int fd = inotify_init();
+    if (fd < 0 || inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        Logger::Error(_T("Failed to watch the configuration file"));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    char buffer[4096];
+    while (!stopped_.load()) {
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, CONFIG_WATCH_INTERVAL_SECONDS * 1000) <= 0) {
+            continue;
+        }
+
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        bool changed = false;
+        for (ssize_t offset = 0; offset < length; ) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            if (event->len > 0 && strcmp(event->name, "config.json") == 0) {
+                changed = true;
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+
+        if (changed) {
+            Update();
+        }
+    }
+
+    close(fd);
+}
+
+#else
+
+void ConfigWatcher::Run()
+{
+    using namespace boost::filesystem;
+
+    auto GetTimestamp = []() -> time_t {
+        boost::system::error_code error;
+        time_t timestamp = last_write_time(Config::CONFIG_JSON, error);
+        return error ? 0 : timestamp;
+    };
+
+    time_t timestamp = GetTimestamp();
+    while (!stopped_.load()) {
+        boost::this_thread::sleep(boost::posix_time::seconds(CONFIG_WATCH_INTERVAL_SECONDS));
+
+        time_t new_timestamp = GetTimestamp();
+        if (new_timestamp > timestamp) {
+            timestamp = new_timestamp;
+            Update();
+        }
+    }
+}
+
+#endif
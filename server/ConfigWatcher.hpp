@@ -0,0 +1,36 @@
+//
+// ConfigWatcher.hpp
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <boost/thread.hpp>
+#include "Config.hpp"
+
+#define CONFIG_WATCH_INTERVAL_SECONDS (2)
+
+// 設定ファイルの監視
+// 変更を検知すると監視スレッドで読み込み直し、新しい設定に差し替える
+// 読み込みに失敗した場合は、前の設定を使い続ける
+// 設定は読み込み後に変更しないので、参照側は取り出したポインタを保持している間そのまま使える
+class ConfigWatcher {
+    public:
+        ConfigWatcher();
+        ~ConfigWatcher();
+
+        ConfigPtr config() const;
+
+    private:
+        void Run();
+        void Update();
+
+    private:
+        // std::atomic_load, std::atomic_store でのみ読み書きする
+        // 古い設定は最後の参照がなくなった時点で解放される
+        ConfigPtr current_;
+
+        std::atomic<bool> stopped_;
+        boost::thread thread_;
+};
@@ -0,0 +1,167 @@
+//
+// InterestGrid.cpp
+//
+
+#include "InterestGrid.hpp"
+#include <algorithm>
+#include <boost/foreach.hpp>
+
+InterestGrid::InterestGrid(int cell_size, int interest_radius) :
+    cell_size_(0),
+    range_(0)
+{
+    // 関心半径が0以下の場合はチャンネル全体を1セルとして扱う
+    if (cell_size > 0 && interest_radius > 0) {
+        cell_size_ = cell_size;
+        range_ = (interest_radius + cell_size - 1) / cell_size;
+    }
+}
+
+bool InterestGrid::enabled() const
+{
+    return cell_size_ > 0;
+}
+
+int InterestGrid::ToCell(int16_t value) const
+{
+    if (cell_size_ <= 0) {
+        return 0;
+    }
+
+    // 負の座標も切り捨て方向を揃える
+    return value >= 0 ? value / cell_size_ : -((-value + cell_size_ - 1) / cell_size_);
+}
+
+InterestGrid::CellKey InterestGrid::GetCellKey(unsigned char channel, int cell_x, int cell_z)
+{
+    return (static_cast<CellKey>(channel) << 48) |
+        (static_cast<CellKey>(static_cast<uint16_t>(cell_x)) << 16) |
+        static_cast<CellKey>(static_cast<uint16_t>(cell_z));
+}
+
+void InterestGrid::GetNeighbors(uint32_t self_id, unsigned char channel, int cell_x, int cell_z,
+    std::vector<uint32_t>* neighbors) const
+{
+    for (int x = cell_x - range_; x <= cell_x + range_; x++) {
+        for (int z = cell_z - range_; z <= cell_z + range_; z++) {
+            auto it = cells_.find(GetCellKey(channel, x, z));
+            if (it != cells_.end()) {
+                BOOST_FOREACH(uint32_t user_id, it->second) {
+                    if (user_id != self_id) {
+                        neighbors->push_back(user_id);
+                    }
+                }
+            }
+        }
+    }
+    std::sort(neighbors->begin(), neighbors->end());
+}
+
+void InterestGrid::RemoveFromCell(uint32_t user_id, const Entry& entry)
+{
+    auto it = cells_.find(GetCellKey(entry.channel, entry.cell_x, entry.cell_z));
+    if (it != cells_.end()) {
+        auto& users = it->second;
+        users.erase(std::remove(users.begin(), users.end(), user_id), users.end());
+        if (users.empty()) {
+            cells_.erase(it);
+        }
+    }
+}
+
+void InterestGrid::Update(const network::SessionPtr& session, const PlayerPosition& pos,
+    std::vector<network::SessionPtr>* watchers,
+    std::vector<network::SessionPtr>* entered,
+    std::vector<network::SessionPtr>* left)
+{
+    const uint32_t user_id = session->id();
+    const unsigned char channel = session->channel();
+    const int cell_x = ToCell(pos.x);
+    const int cell_z = ToCell(pos.z);
+
+    std::vector<uint32_t> current;
+    GetNeighbors(user_id, channel, cell_x, cell_z, &current);
+
+    std::vector<uint32_t> entered_ids, left_ids;
+
+    auto it = entries_.find(user_id);
+    if (it == entries_.end()) {
+        entered_ids = current;
+    } else {
+        const Entry& old_entry = it->second;
+        if (old_entry.channel != channel ||
+            old_entry.cell_x != cell_x || old_entry.cell_z != cell_z) {
+
+            std::vector<uint32_t> previous;
+            GetNeighbors(user_id, old_entry.channel, old_entry.cell_x, old_entry.cell_z, &previous);
+
+            std::set_difference(current.begin(), current.end(),
+                previous.begin(), previous.end(), std::back_inserter(entered_ids));
+            std::set_difference(previous.begin(), previous.end(),
+                current.begin(), current.end(), std::back_inserter(left_ids));
+
+            RemoveFromCell(user_id, old_entry);
+            it = entries_.end();
+        }
+    }
+
+    if (it == entries_.end()) {
+        Entry entry;
+        entry.session = session;
+        entry.channel = channel;
+        entry.cell_x = cell_x;
+        entry.cell_z = cell_z;
+        entries_[user_id] = entry;
+        cells_[GetCellKey(channel, cell_x, cell_z)].push_back(user_id);
+    }
+
+    auto lock_sessions = [this](const std::vector<uint32_t>& ids, std::vector<network::SessionPtr>* out) {
+        if (!out) return;
+        BOOST_FOREACH(uint32_t id, ids) {
+            auto entry_it = entries_.find(id);
+            if (entry_it != entries_.end()) {
+                if (auto other = entry_it->second.session.lock()) {
+                    out->push_back(other);
+                }
+            }
+        }
+    };
+
+    lock_sessions(current, watchers);
+    lock_sessions(entered_ids, entered);
+    lock_sessions(left_ids, left);
+}
+
+void InterestGrid::GetWatchers(uint32_t user_id, std::vector<network::SessionPtr>* watchers) const
+{
+    auto it = entries_.find(user_id);
+    if (it == entries_.end()) {
+        return;
+    }
+
+    std::vector<uint32_t> neighbors;
+    GetNeighbors(user_id, it->second.channel, it->second.cell_x, it->second.cell_z, &neighbors);
+    BOOST_FOREACH(uint32_t id, neighbors) {
+        auto entry_it = entries_.find(id);
+        if (entry_it != entries_.end()) {
+            if (auto other = entry_it->second.session.lock()) {
+                watchers->push_back(other);
+            }
+        }
+    }
+}
+
+bool InterestGrid::Contains(uint32_t user_id, unsigned char channel) const
+{
+    auto it = entries_.find(user_id);
+    return it != entries_.end() && it->second.channel == channel;
+}
+
+void InterestGrid::Remove(uint32_t user_id)
+{
+    auto it = entries_.find(user_id);
+    if (it != entries_.end()) {
+        RemoveFromCell(user_id, it->second);
+        entries_.erase(it);
+    }
+}
@@ -0,0 +1,57 @@
+//
+// InterestGrid.hpp
+//
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "../common/network/Session.hpp"
+#include "../common/database/AccountProperty.hpp"
+
+// チャンネルごとの一様グリッド
+// 位置情報の配信先を、関心範囲内にいるプレイヤーに限定する
+class InterestGrid {
+    public:
+        InterestGrid(int cell_size, int interest_radius);
+
+        // 位置を更新し、配信先と関心範囲への出入りを返す
+        void Update(const network::SessionPtr& session, const PlayerPosition& pos,
+            std::vector<network::SessionPtr>* watchers,
+            std::vector<network::SessionPtr>* entered,
+            std::vector<network::SessionPtr>* left);
+
+        void Remove(uint32_t user_id);
+
+        // 位置を変えずに、関心範囲内にいるプレイヤーを返す
+        void GetWatchers(uint32_t user_id, std::vector<network::SessionPtr>* watchers) const;
+
+        // 指定したチャンネルに登録済みか
+        bool Contains(uint32_t user_id, unsigned char channel) const;
+
+        bool enabled() const;
+
+    private:
+        typedef uint64_t CellKey;
+
+        struct Entry {
+            network::SessionWeakPtr session;
+            unsigned char channel;
+            int cell_x, cell_z;
+        };
+
+        int ToCell(int16_t value) const;
+        static CellKey GetCellKey(unsigned char channel, int cell_x, int cell_z);
+
+        void GetNeighbors(uint32_t self_id, unsigned char channel, int cell_x, int cell_z,
+            std::vector<uint32_t>* neighbors) const;
+        void RemoveFromCell(uint32_t user_id, const Entry& entry);
+
+    private:
+        int cell_size_;
+        int range_;
+
+        std::unordered_map<uint32_t, Entry> entries_;
+        std::unordered_map<CellKey, std::vector<uint32_t>> cells_;
+};
@@ -0,0 +1,170 @@
+//
+// MetricsServer.cpp
+//
+
+#include "MetricsServer.hpp"
+#include <fstream>
+#include <boost/make_shared.hpp>
+#include <boost/filesystem.hpp>
+#include "../common/Logger.hpp"
+#include "../common/Metrics.hpp"
+
+namespace network {
+
+    using boost::asio::ip::tcp;
+
+    MetricsServer::MetricsServer(boost::asio::io_service& io_service) :
+        io_service_(io_service),
+        acceptor_(io_service),
+        accept_timer_(io_service),
+        file_timer_(io_service),
+        file_interval_seconds_(0)
+    {
+    }
+
+    void MetricsServer::Start(uint16_t port, const std::string& file, int file_interval_seconds)
+    {
+        if (port > 0) {
+            boost::system::error_code error;
+            tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+            acceptor_.open(endpoint.protocol(), error);
+            if (!error) {
+                acceptor_.set_option(tcp::acceptor::reuse_address(true), error);
+                acceptor_.bind(endpoint, error);
+            }
+            if (!error) {
+                acceptor_.listen(boost::asio::socket_base::max_connections, error);
+            }
+
+            if (error) {
+                Logger::Error(_T("Failed to open metrics port %d: %s"), port, unicode::ToTString(error.message()));
+                acceptor_.close(error);
+            } else {
+                Logger::Info(_T("Metrics: http://127.0.0.1:%d/metrics"), port);
+                Accept();
+            }
+        }
+
+        if (!file.empty() && file_interval_seconds > 0) {
+            file_ = file;
+            file_interval_seconds_ = file_interval_seconds;
+            file_timer_.expires_from_now(boost::posix_time::seconds(file_interval_seconds_));
+            file_timer_.async_wait(boost::bind(&MetricsServer::WriteFile, this, boost::asio::placeholders::error));
+        }
+    }
+
+    void MetricsServer::Stop()
+    {
+        boost::system::error_code error;
+        acceptor_.close(error);
+        accept_timer_.cancel(error);
+        file_timer_.cancel(error);
+    }
+
+    void MetricsServer::Accept()
+    {
+        auto connection = boost::make_shared<Connection>(io_service_);
+        acceptor_.async_accept(connection->socket,
+            boost::bind(&MetricsServer::ReceiveConnection, this, connection, boost::asio::placeholders::error));
+    }
+
+    void MetricsServer::RetryAccept(const boost::system::error_code& error)
+    {
+        if (!error && acceptor_.is_open()) {
+            Accept();
+        }
+    }
+
+    void MetricsServer::ReceiveConnection(const ConnectionPtr& connection, const boost::system::error_code& error)
+    {
+        if (error) {
+            // 閉じた場合は受け付けを終える
+            // ファイルディスクリプタが足りない場合などはすぐに失敗し続けるので、少し待ってから受け付け直す
+            if (error != boost::asio::error::operation_aborted) {
+                Logger::Error(_T("Failed to accept a metrics connection: %s"), unicode::ToTString(error.message()));
+                accept_timer_.expires_from_now(boost::posix_time::seconds(METRICS_SERVER_ACCEPT_RETRY_SECONDS));
+                accept_timer_.async_wait(boost::bind(&MetricsServer::RetryAccept, this, boost::asio::placeholders::error));
+            }
+            return;
+        }
+
+        // 応答しない接続を残さない
+        connection->timer.expires_from_now(boost::posix_time::seconds(METRICS_SERVER_TIMEOUT_SECONDS));
+        connection->timer.async_wait([connection](const boost::system::error_code& error) {
+            if (!error) {
+                boost::system::error_code ignored;
+                connection->socket.close(ignored);
+            }
+        });
+
+        boost::asio::async_read_until(connection->socket, connection->request, "\r\n\r\n",
+            boost::bind(&MetricsServer::ReceiveRequest, this, connection, boost::asio::placeholders::error));
+
+        Accept();
+    }
+
+    void MetricsServer::ReceiveRequest(const ConnectionPtr& connection, const boost::system::error_code& error)
+    {
+        if (error) {
+            boost::system::error_code ignored;
+            connection->timer.cancel(ignored);
+            return;
+        }
+
+        std::string line;
+        std::istream stream(&connection->request);
+        std::getline(stream, line);
+
+        std::string status, body;
+        if (line.compare(0, 13, "GET /metrics ") == 0 || line.compare(0, 14, "HEAD /metrics ") == 0) {
+            status = "200 OK";
+            body = metrics::Metrics::getInstance().Export();
+        } else {
+            status = "404 Not Found";
+            body = "Not Found\n";
+        }
+
+        connection->response =
+            "HTTP/1.0 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+        if (line.compare(0, 5, "HEAD ") != 0) {
+            connection->response += body;
+        }
+
+        boost::asio::async_write(connection->socket, boost::asio::buffer(connection->response),
+            [connection](const boost::system::error_code& error, size_t) {
+                boost::system::error_code ignored;
+                connection->socket.shutdown(tcp::socket::shutdown_both, ignored);
+                connection->socket.close(ignored);
+                connection->timer.cancel(ignored);
+            });
+    }
+
+    void MetricsServer::WriteFile(const boost::system::error_code& error)
+    {
+        if (error) {
+            return;
+        }
+
+        // 読み取り側が書きかけのファイルを見ないよう、一時ファイルから置き換える
+        const std::string temporary = file_ + ".tmp";
+        {
+            std::ofstream ofs(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            ofs << metrics::Metrics::getInstance().Export();
+        }
+
+        boost::system::error_code rename_error;
+        boost::filesystem::rename(temporary, file_, rename_error);
+        if (rename_error) {
+            Logger::Error(_T("Failed to write metrics to %s: %s"), unicode::ToTString(file_),
+                unicode::ToTString(rename_error.message()));
+        }
+
+        file_timer_.expires_at(file_timer_.expires_at() + boost::posix_time::seconds(file_interval_seconds_));
+        file_timer_.async_wait(boost::bind(&MetricsServer::WriteFile, this, boost::asio::placeholders::error));
+    }
+
+}
@@ -0,0 +1,60 @@
+//
+// MetricsServer.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+#define METRICS_SERVER_MAX_REQUEST_LENGTH (4096)
+#define METRICS_SERVER_TIMEOUT_SECONDS (5)
+#define METRICS_SERVER_ACCEPT_RETRY_SECONDS (1)
+
+namespace network {
+
+    // 計測値をPrometheusのテキスト形式で公開する
+    // ループバックアドレスでHTTPの GET /metrics に応答し、指定があれば定期的にファイルへ書き出す
+    // 応答はサーバーのio_serviceのスレッドで作られる
+    class MetricsServer {
+        public:
+            MetricsServer(boost::asio::io_service& io_service);
+
+            // portが0の場合はHTTPを開かない、fileが空の場合は書き出さない
+            void Start(uint16_t port, const std::string& file, int file_interval_seconds);
+            void Stop();
+
+        private:
+            struct Connection {
+                Connection(boost::asio::io_service& io_service) :
+                    socket(io_service),
+                    request(METRICS_SERVER_MAX_REQUEST_LENGTH),
+                    timer(io_service) {}
+
+                boost::asio::ip::tcp::socket socket;
+                boost::asio::streambuf request;
+                boost::asio::deadline_timer timer;
+                std::string response;
+            };
+            typedef boost::shared_ptr<Connection> ConnectionPtr;
+
+            void Accept();
+            void RetryAccept(const boost::system::error_code& error);
+            void ReceiveConnection(const ConnectionPtr& connection, const boost::system::error_code& error);
+            void ReceiveRequest(const ConnectionPtr& connection, const boost::system::error_code& error);
+
+            void WriteFile(const boost::system::error_code& error);
+
+        private:
+            boost::asio::io_service& io_service_;
+            boost::asio::ip::tcp::acceptor acceptor_;
+            boost::asio::deadline_timer accept_timer_;
+
+            boost::asio::deadline_timer file_timer_;
+            std::string file_;
+            int file_interval_seconds_;
+    };
+
+}
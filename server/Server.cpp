@@ -12,18 +12,41 @@
 #include "../common/Logger.hpp"
 #include "../common/network/Command.hpp"
 #include "../common/network/Utils.hpp"
+#include "ChatMessage.hpp"
 
 namespace network {
 
     Server::Server() :
-            endpoint_(tcp::v4(), config_.port()),
+			config_(config_watcher_.config()),
+			interest_grid_(config()->interest_cell_size(), config()->interest_radius()),
+			interest_cell_size_(config()->interest_cell_size()),
+			interest_radius_(config()->interest_radius()),
+            resolver_(io_service_),
+            metrics_server_(io_service_),
+            metrics_collector_(0),
+            stats_timer_(io_service_),
+            stats_interval_(0),
+            endpoint_(tcp::v4(), config()->port()),
             acceptor_(io_service_, endpoint_),
-            socket_udp_(io_service_, udp::endpoint(udp::v4(), config_.port())),
+            socket_udp_(io_service_, udp::endpoint(udp::v4(), config()->port())),
             udp_packet_count_(0),
-			recent_chat_log_(10)
+            tick_timer_(io_service_),
+            tick_(0),
+            start_time_(boost::posix_time::microsec_clock::universal_time()),
+            worker_work_(worker_service_),
+            worker_thread_([this](){ worker_service_.run(); })
     {
     }
 
+    Server::~Server()
+    {
+        if (metrics_collector_) {
+            metrics::Metrics::getInstance().RemoveCollector(metrics_collector_);
+        }
+        worker_service_.stop();
+        worker_thread_.join();
+    }
+
     void Server::Start(CallbackFuncPtr callback)
     {
         callback_ = std::make_shared<CallbackFunc>(
@@ -37,10 +60,11 @@ namespace network {
 				}
             } else if (auto session = c.session().lock()) {
 				auto read_average = session->GetReadByteAverage();
-				if (read_average > config_.receive_limit_2()) {
+				const ConfigPtr& config = this->config();
+				if (read_average > config->receive_limit_2()) {
 					Logger::Info(_T("Banished a session: %d %dbyte/s"), session->id(), read_average);
 					session->Close();
-				} else if(read_average > config_.receive_limit_1()) {
+				} else if(read_average > config->receive_limit_1()) {
 					Logger::Info(_T("Receive limit exceeded: %d: %d byte/s"), session->id(), read_average);
 				} else {
 					if (callback) {
@@ -51,12 +75,6 @@ namespace network {
 
         });
 
-		BOOST_FOREACH(const auto& host, config().lobby_servers()) {
-			udp::resolver resolver(io_service_);
-			udp::resolver::query query(udp::v4(), host.c_str(), "39380");
-			lobby_hosts_.push_back(resolver.resolve(query));
-		}
-
         {
         auto new_session = boost::make_shared<ServerSession>(io_service_);
         acceptor_.async_accept(new_session->tcp_socket(),
@@ -71,10 +89,31 @@ namespace network {
                   boost::asio::placeholders::bytes_transferred));
         }
 
+        tick_timer_.expires_from_now(boost::posix_time::milliseconds(1000 / config()->tick_rate()));
+        tick_timer_.async_wait(boost::bind(&Server::Tick, this, boost::asio::placeholders::error));
+
+        // 計測値の公開 (Collectorはio_serviceのスレッドで呼ばれる)
+        metrics_collector_ = metrics::Metrics::getInstance().AddCollector(
+            [this](metrics::Writer* writer) { CollectMetrics(writer); });
+        {
+            const ConfigPtr& config = this->config();
+            metrics_server_.Start(config->metrics_port(), config->metrics_file(), config->metrics_file_interval());
+        }
+
+        if (stats_interval_ > 0) {
+            stats_timer_.expires_from_now(boost::posix_time::seconds(stats_interval_));
+            stats_timer_.async_wait(boost::bind(&Server::LogLatencyStats, this, boost::asio::placeholders::error));
+        }
+
         boost::asio::io_service::work work(io_service_);
         io_service_.run();
     }
 
+    void Server::SetStatsInterval(int seconds)
+    {
+        stats_interval_ = seconds;
+    }
+
     void Server::Stop()
     {
         io_service_.stop();
@@ -100,64 +139,197 @@ namespace network {
 		return count;
 	}
 
-	std::string Server::GetStatusJSON() const
+	bool Server::StatusCache::IsValid(uint32_t revision, const ConfigPtr& config, uint32_t time) const
 	{
-		auto msg = (
-					boost::format("{\"nam\":\"%s\",\"ver\":\"%d.%d.%d\",\"cnt\":%d,\"cap\":%d,\"stg\":\"%s\"}")
-						% config_.server_name()
+		return !payload.empty() && this->revision == revision && this->config == config &&
+			time - this->time < STATUS_CACHE_MILLISECONDS;
+	}
+
+	void Server::StatusCache::Update(uint32_t revision, const ConfigPtr& config, uint32_t time)
+	{
+		this->revision = revision;
+		this->config = config;
+		this->time = time;
+	}
+
+	const std::string& Server::GetStatusJSON()
+	{
+		const uint32_t revision = account_.GetCurrentRevision();
+		const uint32_t now = GetServerTime();
+		const ConfigPtr& config = this->config();
+		if (status_cache_.IsValid(revision, config, now)) {
+			return status_cache_.payload;
+		}
+
+		int rtt_50, rtt_90, rtt_99;
+		GetRoundTripTimePercentiles(&rtt_50, &rtt_90, &rtt_99);
+
+		status_cache_.payload = (
+					boost::format("{\"nam\":\"%s\",\"ver\":\"%d.%d.%d\",\"cnt\":%d,\"cap\":%d,\"stg\":\"%s\",\"rtt\":[%d,%d,%d]}")
+						% config->server_name()
 						% MMO_VERSION_MAJOR % MMO_VERSION_MINOR % MMO_VERSION_REVISION
 						% GetUserCount()
-						% config_.capacity()
+						% config->capacity()
 						% channel_.GetDefaultStage()
+						% rtt_50 % rtt_90 % rtt_99
 					).str();
 
-		return msg;
+		status_cache_.Update(revision, config, now);
+		return status_cache_.payload;
 	}
 
-	std::string Server::GetFullStatus() const
+	const std::string& Server::GetFullStatus(uint16_t format_version)
 	{
 		using namespace boost::property_tree;
+
+		const uint32_t revision = account_.GetCurrentRevision();
+		const uint32_t now = GetServerTime();
+		const ConfigPtr& config = this->config();
+
+		if (format_version > 0) {
+			if (!server_info_cache_.IsValid(revision, config, now)) {
+				server_info_cache_.payload = GetServerInfo().Serialize();
+				server_info_cache_.Update(revision, config, now);
+			}
+			return server_info_cache_.payload;
+		}
+
+		if (full_status_cache_.IsValid(revision, config, now)) {
+			return full_status_cache_.payload;
+		}
+
+		auto info = GetServerInfo();
 		ptree xml_ptree;
 
-		xml_ptree.put_child("config", config_.pt());
-		xml_ptree.put("version", (boost::format("%d.%d.%d") 
-			% MMO_VERSION_MAJOR % MMO_VERSION_MINOR % MMO_VERSION_REVISION).str());
-		xml_ptree.put("protocol_version", MMO_PROTOCOL_VERSION);
+		xml_ptree.put_child("config", config->pt());
+		xml_ptree.put("version", info.version);
+		xml_ptree.put("protocol_version", info.protocol_version);
+		xml_ptree.put("rtt.p50", info.rtt_50);
+		xml_ptree.put("rtt.p90", info.rtt_90);
+		xml_ptree.put("rtt.p99", info.rtt_99);
 
 		{
 			ptree player_array;
-			auto id_list = account_.GetIDList();
-			BOOST_FOREACH(const auto& s, sessions_) {
-				if (auto session = s.lock()) {
-					if (!s.expired() && session->online() && session->id() > 0) {
-						auto id = session->id();
-						ptree player;
-						player.put("name", account_.GetUserName(id));
-						player.put("model_name", account_.GetUserModelName(id));
-						player_array.push_back(std::make_pair("", player));
-					}
-				}
+			BOOST_FOREACH(const auto& player, info.players) {
+				ptree player_pt;
+				player_pt.put("name", player.name);
+				player_pt.put("model_name", player.model_name);
+				player_array.push_back(std::make_pair("", player_pt));
 			}
 			xml_ptree.put_child("players", player_array);
 		}
 
-		//{
-		//	ptree log_array;
-		//	BOOST_FOREACH(const std::string& msg, recent_chat_log_) {
-		//		log_array.push_back(std::make_pair("", msg));
-		//	}
-		//	xml_ptree.put_child("recent_chat_log", log_array);
-		//}
-
 		xml_ptree.put_child("channels", channel_.pt());
 		std::stringstream stream;
 		boost::archive::text_oarchive oa(stream);
 		oa << xml_ptree;
 
-		return stream.str();
+		full_status_cache_.payload = stream.str();
+		full_status_cache_.Update(revision, config, now);
+		return full_status_cache_.payload;
 	}
 
-	const Config& Server::config() const
+	ServerInfo Server::GetServerInfo()
+	{
+		const ConfigPtr& config = this->config();
+		ServerInfo info;
+		info.name = config->server_name();
+		info.note = config->server_note();
+		info.stage = config->stage();
+		info.capacity = config->capacity();
+		info.version = (boost::format("%d.%d.%d")
+			% MMO_VERSION_MAJOR % MMO_VERSION_MINOR % MMO_VERSION_REVISION).str();
+		info.protocol_version = MMO_PROTOCOL_VERSION;
+		GetRoundTripTimePercentiles(&info.rtt_50, &info.rtt_90, &info.rtt_99);
+
+		BOOST_FOREACH(const auto& s, sessions_) {
+			if (auto session = s.lock()) {
+				if (!s.expired() && session->online() && session->id() > 0) {
+					auto id = session->id();
+					ServerInfo::Player player;
+					player.name = account_.GetUserName(id);
+					player.model_name = account_.GetUserModelName(id);
+					info.players.push_back(player);
+				}
+			}
+		}
+
+		info.LoadChannels(channel_.pt());
+		return info;
+	}
+
+	void Server::CollectMetrics(metrics::Writer* writer)
+	{
+		writer->Gauge("mmo_server_sessions", "Sessions held by the server.", sessions_.size());
+		writer->Gauge("mmo_server_users", "Logged-in users.", GetUserCount());
+		writer->Gauge("mmo_server_tick", "Ticks since the server started.", tick_);
+
+		int rtt_50, rtt_90, rtt_99;
+		GetRoundTripTimePercentiles(&rtt_50, &rtt_90, &rtt_99);
+		writer->Type("mmo_server_round_trip_milliseconds", "Smoothed round-trip time over sessions.", "gauge");
+		writer->Sample("mmo_server_round_trip_milliseconds", "quantile=\"0.5\"", rtt_50);
+		writer->Sample("mmo_server_round_trip_milliseconds", "quantile=\"0.9\"", rtt_90);
+		writer->Sample("mmo_server_round_trip_milliseconds", "quantile=\"0.99\"", rtt_99);
+
+		// 次のティックを待っている処理の量
+		writer->Gauge("mmo_server_pending_positions", "Sessions with position updates waiting for the next tick.",
+			pending_positions_.size());
+		writer->Gauge("mmo_server_pending_revisions", "Users with revision notices waiting for the next tick.",
+			dirty_revisions_.size());
+		writer->Gauge("mmo_server_pending_removals", "Logged-out accounts waiting for removal.",
+			removal_timers_.size());
+	}
+
+	void Server::LogLatencyStats(const boost::system::error_code& error)
+	{
+		if (error) {
+			return;
+		}
+
+		auto& stats = metrics::Metrics::getInstance();
+		LogLatencyStats("receive", stats.receive_latency, 0);
+		LogLatencyStats("send", stats.send_latency, 1);
+
+		stats_timer_.expires_at(stats_timer_.expires_at() + boost::posix_time::seconds(stats_interval_));
+		stats_timer_.async_wait(boost::bind(&Server::LogLatencyStats, this, boost::asio::placeholders::error));
+	}
+
+	void Server::LogLatencyStats(const char* name, const metrics::LatencyHistogramArray& histograms, int kind)
+	{
+		// ヘッダーごとに前回からの差分を取り、全体の集計にも加える
+		metrics::LatencyHistogram::Snapshot total, current;
+		total.Clear();
+
+		for (size_t header = 0; header < histograms.size(); header++) {
+			if (!histograms.GetSnapshot(header, &current)) {
+				continue;
+			}
+
+			auto& previous = stats_snapshots_[kind << 8 | static_cast<int>(header)];
+			auto interval = current;
+			interval.Subtract(previous);
+			previous = current;
+
+			if (interval.count == 0) {
+				continue;
+			}
+			total.Add(interval);
+
+			Logger::Info(_T("%s"), unicode::ToTString((boost::format(
+				"Latency %s 0x%02x: %d calls, p50 %dus, p99 %dus, p99.9 %dus")
+				% name % header % interval.count
+				% interval.GetPercentile(50.0) % interval.GetPercentile(99.0) % interval.GetPercentile(99.9)).str()));
+		}
+
+		if (total.count > 0) {
+			Logger::Info(_T("%s"), unicode::ToTString((boost::format(
+				"Latency %s total: %d calls, p50 %dus, p99 %dus, p99.9 %dus")
+				% name % total.count
+				% total.GetPercentile(50.0) % total.GetPercentile(99.0) % total.GetPercentile(99.9)).str()));
+		}
+	}
+
+	const ConfigPtr& Server::config() const
 	{
 		return config_;
 	}
@@ -167,9 +339,34 @@ namespace network {
 		return account_;
 	}
 	
-	void Server::AddChatLog(const std::string& msg)
+	uint32_t Server::AddChatLog(unsigned char channel, uint32_t user_id, const std::string& message)
 	{
-		recent_chat_log_.push_back(msg);
+		return chat_history_.Append(channel, user_id, message);
+	}
+
+	void Server::SendChatLog(const SessionPtr& session, unsigned char channel, uint32_t sequence, int count)
+	{
+		// 別のチャンネルのシーケンス番号は意味を持たないので最新のものを送る
+		if (channel != session->channel()) {
+			channel = session->channel();
+			sequence = 0;
+		}
+
+		std::vector<ChatHistory::Entry> entries;
+		chat_history_.Get(channel, sequence,
+			std::min(std::max(count, 0), CHAT_HISTORY_MAX_COUNT), CHAT_HISTORY_MAX_BATCH_SIZE, &entries);
+
+		std::string data;
+		BOOST_FOREACH(const auto& entry, entries) {
+			data += Utils::Serialize(
+				ChatInfoEnvelope::Format(entry.user_id, entry.sequence, entry.time), entry.message);
+		}
+
+		if (!entries.empty()) {
+			sequence = entries.back().sequence;
+		}
+		session->Send(ClientReceiveChatLog(channel, sequence,
+			static_cast<uint32_t>(data.size()), Utils::LZ4Compress(data)));
 	}
 
     bool Server::Empty() const
@@ -179,18 +376,11 @@ namespace network {
 
 	bool Server::IsBlockedAddress(const boost::asio::ip::address& address)
 	{
-		BOOST_FOREACH(const auto& pattern, config_.blocking_address_patterns()) {
-			if (network::Utils::MatchWithWildcard(pattern, address.to_string())) {
-				return true;
-			}
-		}
-		return false;
+		return config()->blocking_address_filter().Match(address);
 	}
 
     void Server::ReceiveSession(const SessionPtr& session, const boost::system::error_code& error)
     {
-		config_.Reload();
-
 		if (!session) return;
 
 		const auto address = session->tcp_socket().remote_endpoint().address();
@@ -199,8 +389,10 @@ namespace network {
 		if(IsBlockedAddress(address)) {
 			Logger::Info("Blocked IP Address: %s", address);
             session->Close();
+            metrics::Metrics::getInstance().sessions_blocked.Add();
 
 		} else {
+            metrics::Metrics::getInstance().sessions_accepted.Add();
             session->set_on_receive(callback_);
             session->Start();
             sessions_.push_back(SessionWeakPtr(session));
@@ -275,30 +467,522 @@ namespace network {
 		}
 	}
 
-    void Server::SendUDPTestPacket(const std::string& ip_address, uint16_t port)
-    {
-        using boost::asio::ip::udp;
+	void Server::UpdatePlayerPosition(const SessionPtr& session, const PlayerPosition& pos)
+	{
+		// ログイン前のセッションは関心範囲に登録しない
+		if (session->id() == 0) {
+			return;
+		}
 
-        std::stringstream port_str;
-        port_str << (int)port;
+		const uint32_t user_id = session->id();
+		const bool joined = !interest_grid_.Contains(user_id, session->channel());
 
-        udp::resolver resolver(io_service_);
-        udp::resolver::query query(udp::v4(), ip_address.c_str(), port_str.str().c_str());
-        udp::resolver::iterator iterator = resolver.resolve(query);
+		std::vector<SessionPtr> watchers, entered, left;
+		interest_grid_.Update(session, pos, &watchers, &entered, &left);
 
-        static char request[] = "MMO UDP Test Packet";
-        for (int i = 0; i < UDP_TEST_PACKET_TIME; i++) {
+		// 関心範囲内のプレイヤーに次のティックで送信
+		BOOST_FOREACH(const auto& other, watchers) {
+			QueuePlayerPosition(other, user_id);
+		}
 
-            io_service_.post(boost::bind(&Server::DoWriteUDP, this, request, *iterator));
-        }
+		// 新しく範囲内に入ったプレイヤーの位置を送信
+		BOOST_FOREACH(const auto& other, entered) {
+			QueuePlayerPosition(session, other->id());
+		}
+
+		// 範囲外に出たプレイヤーは、お互いの表示を消す
+		BOOST_FOREACH(const auto& other, left) {
+			QueuePlayerLeave(other, user_id);
+			QueuePlayerLeave(session, other->id());
+		}
+
+		// チャンネルに入った時点で範囲外にいるプレイヤーも、参加時のスナップショットで表示されているので消す
+		if (joined && interest_grid_.enabled()) {
+			std::vector<uint32_t> visible_ids;
+			BOOST_FOREACH(const auto& other, watchers) {
+				visible_ids.push_back(other->id());
+			}
+			std::sort(visible_ids.begin(), visible_ids.end());
+
+			BOOST_FOREACH(const auto& s, sessions_) {
+				if (auto other = s.lock()) {
+					if (other->id() > 0 && other->id() != user_id && other->channel() == session->channel() &&
+						!std::binary_search(visible_ids.begin(), visible_ids.end(), other->id())) {
+						QueuePlayerLeave(session, other->id());
+					}
+				}
+			}
+		}
+	}
+
+	// 同じティックで範囲への出入りが続いた場合は、後の方だけを送る
+	void Server::QueuePlayerPosition(const SessionPtr& session, uint32_t user_id)
+	{
+		if (session->id() == 0 || user_id == 0) {
+			return;
+		}
+
+		auto& pending = pending_positions_[session->id()];
+		pending.session = session;
+		pending.user_ids.push_back(user_id);
+		pending.left_ids.erase(std::remove(pending.left_ids.begin(), pending.left_ids.end(), user_id),
+			pending.left_ids.end());
+	}
+
+	void Server::QueuePlayerLeave(const SessionPtr& session, uint32_t user_id)
+	{
+		if (session->id() == 0 || user_id == 0) {
+			return;
+		}
+
+		auto& pending = pending_positions_[session->id()];
+		pending.session = session;
+		pending.left_ids.push_back(user_id);
+		pending.user_ids.erase(std::remove(pending.user_ids.begin(), pending.user_ids.end(), user_id),
+			pending.user_ids.end());
+	}
+
+	// 関心範囲の設定を変えた場合は、全員を新しいグリッドに登録し直し、範囲への出入りを送る
+	void Server::RebuildInterestGrid(int cell_size, int interest_radius)
+	{
+		InterestGrid grid(cell_size, interest_radius);
+
+		std::vector<SessionPtr> sessions;
+		BOOST_FOREACH(const auto& s, sessions_) {
+			if (auto session = s.lock()) {
+				if (session->id() > 0 && interest_grid_.Contains(session->id(), session->channel())) {
+					grid.Update(session, account_.GetUserPosition(session->id()), nullptr, nullptr, nullptr);
+					sessions.push_back(session);
+				}
+			}
+		}
+
+		auto get_watcher_ids = [](const InterestGrid& target, uint32_t user_id) -> std::vector<uint32_t> {
+			std::vector<SessionPtr> watchers;
+			target.GetWatchers(user_id, &watchers);
+			std::vector<uint32_t> ids;
+			BOOST_FOREACH(const auto& other, watchers) {
+				ids.push_back(other->id());
+			}
+			std::sort(ids.begin(), ids.end());
+			return ids;
+		};
+
+		BOOST_FOREACH(const auto& session, sessions) {
+			const auto previous = get_watcher_ids(interest_grid_, session->id());
+			const auto current = get_watcher_ids(grid, session->id());
+
+			std::vector<uint32_t> entered_ids, left_ids;
+			std::set_difference(current.begin(), current.end(),
+				previous.begin(), previous.end(), std::back_inserter(entered_ids));
+			std::set_difference(previous.begin(), previous.end(),
+				current.begin(), current.end(), std::back_inserter(left_ids));
+
+			BOOST_FOREACH(uint32_t other_id, entered_ids) {
+				QueuePlayerPosition(session, other_id);
+			}
+			BOOST_FOREACH(uint32_t other_id, left_ids) {
+				QueuePlayerLeave(session, other_id);
+			}
+		}
+
+		interest_grid_ = grid;
+		interest_cell_size_ = cell_size;
+		interest_radius_ = interest_radius;
+		Logger::Info(_T("Interest grid rebuilt: cell size %d, radius %d"), cell_size, interest_radius);
+	}
+
+	uint32_t Server::GetServerTime() const
+	{
+		using namespace boost::posix_time;
+		return static_cast<uint32_t>((microsec_clock::universal_time() - start_time_).total_milliseconds());
+	}
+
+	void Server::GetRoundTripTimePercentiles(int* p50, int* p90, int* p99) const
+	{
+		std::vector<double> rtts;
+		BOOST_FOREACH(const auto& s, sessions_) {
+			if (auto session = s.lock()) {
+				if (session->id() > 0 && session->round_trip_time() > 0) {
+					rtts.push_back(session->round_trip_time());
+				}
+			}
+		}
+
+		*p50 = *p90 = *p99 = 0;
+		if (!rtts.empty()) {
+			std::sort(rtts.begin(), rtts.end());
+			*p50 = static_cast<int>(rtts[(rtts.size() - 1) * 50 / 100]);
+			*p90 = static_cast<int>(rtts[(rtts.size() - 1) * 90 / 100]);
+			*p99 = static_cast<int>(rtts[(rtts.size() - 1) * 99 / 100]);
+		}
+	}
+
+	void Server::RemovePlayerPosition(uint32_t user_id)
+	{
+		interest_grid_.Remove(user_id);
+		pending_positions_.erase(user_id);
+		position_encoders_.erase(user_id);
+	}
+
+	void Server::ResetPositionEncoder(const SessionPtr& session)
+	{
+		// 次に送るフレームがキーフレームになる
+		auto it = position_encoders_.find(session->id());
+		if (it == position_encoders_.end()) {
+			return;
+		}
+		it->second.Reset();
+
+		// 復号できなかった位置を補うため、関心範囲内の全員の位置を載せる
+		std::vector<SessionPtr> watchers;
+		interest_grid_.GetWatchers(session->id(), &watchers);
+		BOOST_FOREACH(const auto& other, watchers) {
+			QueuePlayerPosition(session, other->id());
+		}
+	}
+
+	void Server::NotifyAccountRevision(uint32_t user_id)
+	{
+		// 次のティックでまとめて通知する
+		// スナップショットはティックごとに作り直し、それ以降の変更はこの通知で補う
+		dirty_revisions_.insert(user_id);
+	}
+
+	void Server::SyncChannelRevisions(uint32_t user_id)
+	{
+		channel_syncs_.insert(user_id);
+	}
+
+	void Server::FlushAccountRevisions()
+	{
+		if (dirty_revisions_.empty() && channel_syncs_.empty()) {
+			snapshot_syncs_.clear();
+			return;
+		}
+
+		const bool push = config()->push_account_patch();
+		const uint32_t current = account_.GetCurrentRevision();
+
+		// 多くのセッションは同じカーソルなので、変更されたユーザーの一覧を使い回す
+		// 履歴から外れたカーソルは進めない
+		typedef std::pair<bool, std::vector<uint32_t>> ChangedUsers;
+		std::unordered_map<uint32_t, ChangedUsers> changed_users;
+
+		BOOST_FOREACH(SessionWeakPtr& ptr, sessions_) {
+			auto session = ptr.lock();
+			if (!session || session->id() == 0 || !account_.IsLoggedIn(session->id())) {
+				continue;
+			}
+
+			const uint32_t self_id = session->id();
+			auto& sent = sent_revisions_[self_id];
+
+			// 同じチャンネルのユーザーと、送信済みのユーザーのみ通知する
+			// スナップショットを受け取ったセッションには、作成後に変更された全員を送る
+			const bool snapshot_synced = snapshot_syncs_.find(self_id) != snapshot_syncs_.end();
+			std::vector<uint32_t> user_ids;
+			BOOST_FOREACH(uint32_t user_id, dirty_revisions_) {
+				if (snapshot_synced || user_id == self_id || sent.find(user_id) != sent.end() ||
+					account_.GetUserChannel(user_id) == session->channel()) {
+					user_ids.push_back(user_id);
+				}
+			}
+
+			// チャンネルを移動したセッションには、移動先のユーザーを通知する
+			if (channel_syncs_.find(self_id) != channel_syncs_.end()) {
+				BOOST_FOREACH(UserID user_id, account_.GetIDList()) {
+					if (account_.IsLoggedIn(user_id) &&
+						account_.GetUserChannel(user_id) == session->channel() &&
+						dirty_revisions_.find(user_id) == dirty_revisions_.end()) {
+						user_ids.push_back(user_id);
+					}
+				}
+			}
+
+			std::string batch;
+			BOOST_FOREACH(uint32_t user_id, user_ids) {
+				auto revision = account_.GetUserRevision(user_id);
+				if (push) {
+					// TCPで順に届くので、送信済みのリビジョンをクライアントの値とみなす
+					auto it = sent.find(user_id);
+					uint32_t client_revision = it != sent.end() ? it->second : 0;
+					if (client_revision < revision) {
+						batch += Utils::Serialize(account_.GetUserRevisionPatch(user_id, client_revision));
+						sent[user_id] = revision;
+					}
+				} else if (revision > 0) {
+					batch += Utils::Serialize(user_id, revision);
+				}
+			}
+
+			if (push) {
+				// 範囲外で送っていない変更があるうちは、カーソルを進めない
+				auto& cursor = account_cursors_[self_id];
+				auto changed = changed_users.find(cursor);
+				if (changed == changed_users.end()) {
+					changed = changed_users.insert(std::make_pair(cursor, ChangedUsers())).first;
+					changed->second.first = account_.GetChangedUsersSince(cursor, &changed->second.second);
+				}
+
+				const auto& changed_ids = changed->second.second;
+				const bool received_all = changed->second.first &&
+					std::all_of(changed_ids.begin(), changed_ids.end(), [this, &sent](uint32_t user_id) -> bool {
+						auto it = sent.find(user_id);
+						return it != sent.end() && it->second >= account_.GetUserRevision(user_id);
+					});
+				if (received_all) {
+					cursor = current;
+				}
+
+				if (!batch.empty()) {
+					session->Send(ClientReceiveAccountRevisionPatchBatch(cursor, batch));
+				}
+			} else if (!batch.empty()) {
+				session->Send(ClientReceiveAccountRevisionUpdateNotifyBatch(batch));
+			}
+		}
+
+		dirty_revisions_.clear();
+		channel_syncs_.clear();
+		snapshot_syncs_.clear();
+	}
+
+	void Server::SyncAccountRevisions(const SessionPtr& session, uint32_t cursor)
+	{
+		// オンラインのユーザー全員の情報と、同じチャンネルの位置をまとめて送る
+		const auto& snapshot = GetWorldSnapshot(session->channel());
+
+		// 再接続したクライアントには、カーソル以降に変更されたユーザーのみ送る
+		// 送信済みとするのは、実際にパッチを送ったユーザーのみ
+		auto current = account_.GetCurrentRevision();
+		auto& sent = sent_revisions_[session->id()];
+		std::vector<std::string> patches;
+		std::vector<uint32_t> user_ids;
+		if (account_.GetRevisionPatchesSince(cursor, &patches, &user_ids)) {
+			std::string data;
+			BOOST_FOREACH(const auto& patch, patches) {
+				data += Utils::Serialize(patch);
+			}
+			session->Send(ClientReceiveWorldSnapshot(current, data, snapshot.positions));
+
+			BOOST_FOREACH(uint32_t user_id, user_ids) {
+				sent[user_id] = account_.GetUserRevision(user_id);
+			}
+			account_cursors_[session->id()] = current;
+		} else {
+			session->Send(ClientReceiveWorldSnapshot(snapshot.cursor, snapshot.patches, snapshot.positions));
+
+			BOOST_FOREACH(const auto& revision, snapshot.revisions) {
+				sent[revision.first] = revision.second;
+			}
+			account_cursors_[session->id()] = snapshot.cursor;
+		}
+		snapshot_syncs_.insert(session->id());
+	}
+
+	const Server::WorldSnapshot& Server::GetWorldSnapshot(unsigned char channel)
+	{
+		auto it = world_snapshots_.find(channel);
+		if (it != world_snapshots_.end()) {
+			return it->second;
+		}
+
+		WorldSnapshot& snapshot = world_snapshots_[channel];
+		snapshot.cursor = account_.GetCurrentRevision();
+		std::vector<UserPosition> positions;
+
+		const auto& list = account_.GetIDList();
+		BOOST_FOREACH(UserID user_id, list) {
+			if (!account_.IsLoggedIn(user_id)) {
+				continue;
+			}
+
+			auto revision = account_.GetUserRevision(user_id);
+			snapshot.patches += Utils::Serialize(account_.GetUserRevisionPatch(user_id, 0));
+			snapshot.revisions.push_back(std::make_pair(user_id, revision));
+
+			if (account_.GetUserChannel(user_id) == channel) {
+				positions.push_back(UserPosition(user_id, account_.GetUserPosition(user_id)));
+			}
+		}
+
+		PositionEncoder encoder;
+		snapshot.positions = encoder.Encode(positions, GetServerTime());
+		return snapshot;
+	}
+
+	void Server::SendAccountRevisionPatch(const SessionPtr& session, uint32_t user_id, uint32_t client_revision)
+	{
+		auto revision = account_.GetUserRevision(user_id);
+		if (client_revision < revision) {
+			session->Send(ClientReceiveAccountRevisionPatch(
+				account_.GetUserRevisionPatch(user_id, client_revision)));
+			sent_revisions_[session->id()][user_id] = revision;
+		}
+	}
+
+	void Server::ResetAccountRevisions(uint32_t user_id)
+	{
+		sent_revisions_.erase(user_id);
+		account_cursors_.erase(user_id);
+	}
+
+	void Server::SetUserTripAsync(uint32_t user_id, const std::string& trip)
+	{
+		// トリップの計算は重いので、ワーカースレッドで行いI/Oスレッドで反映する
+		// ワーカーは1本なので、同じユーザーの更新は順序どおりに反映される
+		worker_service_.post([this, user_id, trip](){
+			auto hashed_trip = Account::HashTrip(trip);
+			io_service_.post([this, user_id, hashed_trip](){
+				account_.SetUserHashedTrip(user_id, hashed_trip);
+				NotifyAccountRevision(user_id);
+			});
+		});
+	}
+
+	void Server::ScheduleAccountRemoval(uint32_t user_id)
+	{
+		CancelAccountRemoval(user_id);
+
+		auto ticks = ToTicks(boost::posix_time::minutes(ACCOUNT_REMOVAL_MINUTES));
+		removal_timers_[user_id] = timer_wheel_.Schedule(ticks, [this, user_id](){
+			removal_timers_.erase(user_id);
+			account_.Remove(user_id);
+		});
+	}
+
+	void Server::CancelAccountRemoval(uint32_t user_id)
+	{
+		auto it = removal_timers_.find(user_id);
+		if (it != removal_timers_.end()) {
+			timer_wheel_.Cancel(it->second);
+			removal_timers_.erase(it);
+		}
+	}
+
+	uint32_t Server::ToTicks(const boost::posix_time::time_duration& duration) const
+	{
+		return static_cast<uint32_t>(duration.total_milliseconds() * config()->tick_rate() / 1000);
+	}
+
+	void Server::Tick(const boost::system::error_code& error)
+	{
+		if (error) {
+			return;
+		}
+
+		// 期限からの遅れをイベントループの遅延として記録する
+		auto lag = boost::posix_time::microsec_clock::universal_time() - tick_timer_.expires_at();
+		metrics::Metrics::getInstance().event_loop_lag.Record(std::max<int64_t>(0, lag.total_microseconds()));
+
+		tick_++;
+		world_snapshots_.clear();
+		timer_wheel_.Advance();
+
+		config_ = config_watcher_.config();
+		const ConfigPtr& config = config_;
+		if (config->interest_cell_size() != interest_cell_size_ ||
+			config->interest_radius() != interest_radius_) {
+			RebuildInterestGrid(config->interest_cell_size(), config->interest_radius());
+		}
+
+		FlushAccountRevisions();
+		FlushPlayerPositions();
+
+		// 往復遅延の計測
+		const int tick_rate = config->tick_rate();
+		if (tick_ % (PING_INTERVAL_SECONDS * tick_rate) == 0) {
+			SendAll(ClientRequestedPing(GetServerTime()));
+		}
+
+		tick_timer_.expires_at(tick_timer_.expires_at() +
+			boost::posix_time::milliseconds(1000 / tick_rate));
+		tick_timer_.async_wait(boost::bind(&Server::Tick, this, boost::asio::placeholders::error));
+	}
+
+	void Server::FlushPlayerPositions()
+	{
+		auto it = pending_positions_.begin();
+		while (it != pending_positions_.end()) {
+			auto session = it->second.session.lock();
+			if (!session) {
+				it = pending_positions_.erase(it);
+				continue;
+			}
+
+			// 送信が詰まっているセッションは、追いついた時点で最新の位置だけを送る
+			auto& user_ids = it->second.user_ids;
+			std::sort(user_ids.begin(), user_ids.end());
+			user_ids.erase(std::unique(user_ids.begin(), user_ids.end()), user_ids.end());
+
+			auto& left_ids = it->second.left_ids;
+			std::sort(left_ids.begin(), left_ids.end());
+			left_ids.erase(std::unique(left_ids.begin(), left_ids.end()), left_ids.end());
+
+			if (session->send_queue_size() > SNAPSHOT_MAX_SEND_QUEUE ||
+				session->write_average_limit() <= session->GetWriteByteAverage()) {
+				++it;
+				continue;
+			}
+
+			if (!left_ids.empty()) {
+				std::string buffer;
+				BOOST_FOREACH(uint32_t user_id, left_ids) {
+					buffer += Utils::Serialize(user_id);
+				}
+				session->Send(ClientLeaveInterestRange(buffer));
+			}
+
+			if (user_ids.empty()) {
+				it = pending_positions_.erase(it);
+				continue;
+			}
+
+			std::vector<UserPosition> positions;
+			positions.reserve(user_ids.size());
+			BOOST_FOREACH(uint32_t user_id, user_ids) {
+				positions.push_back(UserPosition(user_id, account_.GetUserPosition(user_id)));
+			}
+
+			// 送信先ごとに前回送信した位置との差分で符号化
+			auto& encoder = position_encoders_[it->first];
+			session->Send(ClientUpdatePlayerPositionSnapshot(encoder.Encode(positions, GetServerTime())));
+
+			it = pending_positions_.erase(it);
+		}
+	}
+
+    void Server::SendUDPTestPacket(const std::string& ip_address, uint16_t port)
+    {
+        // 名前解決はイベントループを止めないよう非同期で行う
+        resolver_.Resolve(ip_address, port,
+            [this](const boost::system::error_code& error, const udp::endpoint& endpoint) {
+                if (error) {
+                    return;
+                }
+                static char request[] = "MMO UDP Test Packet";
+                for (int i = 0; i < UDP_TEST_PACKET_TIME; i++) {
+                    io_service_.post(boost::bind(&Server::DoWriteUDP, this, request, endpoint));
+                }
+            });
     }
 
 	void Server::SendPublicPing()
 	{
-		static char request[] = "P";
-		BOOST_FOREACH(const auto& iterator, lobby_hosts_) {
-			io_service_.post(boost::bind(&Server::DoWriteUDP, this, request, *iterator));
-		}
+		// 別スレッドから呼ばれるので、名前解決はio_serviceのスレッドで行う
+		io_service_.post([this]() {
+			const ConfigPtr& config = this->config();
+			BOOST_FOREACH(const auto& host, config->lobby_servers()) {
+				resolver_.Resolve(host, 39380,
+					[this](const boost::system::error_code& error, const udp::endpoint& endpoint) {
+						if (!error) {
+							static char request[] = "P";
+							DoWriteUDP(request, endpoint);
+						}
+					});
+			}
+		});
 	}
 
     void Server::SendUDP(const std::string& message, const boost::asio::ip::udp::endpoint endpoint)
@@ -309,6 +993,7 @@ namespace network {
     void Server::ReceiveUDP(const boost::system::error_code& error, size_t bytes_recvd)
     {
         if (bytes_recvd > 0) {
+            metrics::Metrics::getInstance().udp_packets_received.Add();
             std::string buffer(receive_buf_udp_, bytes_recvd);
             FetchUDP(buffer, sender_endpoint_);
         }
@@ -378,10 +1063,10 @@ namespace network {
 		if (it != sessions_.end()) {
 			weak_session = *it;
 			if (auto session = weak_session.lock()) {
-				Logger::Debug("Receive UDP Command: %d", session->id());
+				LOG_DEBUG("Receive UDP Command: %d", session->id());
 			}
 		} else {
-			Logger::Debug("Receive anonymous UDP Command");
+			LOG_DEBUG("Receive anonymous UDP Command");
 		}
 
         if (buffer.size() > network::Utils::Deserialize(buffer, &header)) {
@@ -411,6 +1096,7 @@ namespace network {
     void Server::ServerSession::Start()
     {
         online_ = true;
+        accepted_time_ = boost::posix_time::microsec_clock::universal_time();
 
         // Nagleアルゴリズムを無効化
         socket_tcp_.set_option(boost::asio::ip::tcp::no_delay(true));
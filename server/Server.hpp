@@ -7,14 +7,27 @@
 #include <string>
 #include <list>
 #include <functional>
-#include <boost/circular_buffer.hpp>
+#include <unordered_map>
+#include <unordered_set>
 #include "../common/network/Session.hpp"
-#include "Config.hpp"
+#include "../common/network/PositionCodec.hpp"
+#include "../common/network/ServerInfo.hpp"
+#include "ConfigWatcher.hpp"
 #include "Account.hpp"
 #include "Channel.hpp"
+#include "InterestGrid.hpp"
+#include "TimerWheel.hpp"
+#include "ChatHistory.hpp"
+#include "AddressResolver.hpp"
+#include "MetricsServer.hpp"
+#include "../common/Metrics.hpp"
 
 #define UDP_MAX_RECEIVE_LENGTH (2048)
 #define UDP_TEST_PACKET_TIME (5)
+#define SNAPSHOT_MAX_SEND_QUEUE (32)
+#define PING_INTERVAL_SECONDS (5)
+#define ACCOUNT_REMOVAL_MINUTES (30)
+#define STATUS_CACHE_MILLISECONDS (1000)
 
 namespace network {
 
@@ -30,7 +43,11 @@ class Server {
 
     public:
         Server();
+        ~Server();
         void Start(CallbackFuncPtr callback);
+
+        // 0より大きい場合、コマンドごとの遅延の集計をこの間隔(秒)でログに出力する
+        void SetStatsInterval(int seconds);
         void Stop();
         void Stop(int interrupt_type);
 
@@ -38,14 +55,35 @@ class Server {
         void SendOthers(const Command&, uint32_t self_id, int channel = -1, bool limited = false);
         void SendTo(const Command&, uint32_t);
 
+		void UpdatePlayerPosition(const SessionPtr& session, const PlayerPosition& pos);
+		void RemovePlayerPosition(uint32_t user_id);
+		void ResetPositionEncoder(const SessionPtr& session);
+
+		uint32_t GetServerTime() const;
+		void GetRoundTripTimePercentiles(int* p50, int* p90, int* p99) const;
+
+		void NotifyAccountRevision(uint32_t user_id);
+		void SyncChannelRevisions(uint32_t user_id);
+		void SyncAccountRevisions(const SessionPtr& session, uint32_t cursor = 0);
+		void SendAccountRevisionPatch(const SessionPtr& session, uint32_t user_id, uint32_t client_revision);
+		void ResetAccountRevisions(uint32_t user_id);
+
+		void SetUserTripAsync(uint32_t user_id, const std::string& trip);
+
+		void ScheduleAccountRemoval(uint32_t user_id);
+		void CancelAccountRemoval(uint32_t user_id);
+
         bool Empty() const;
-		std::string GetStatusJSON() const;
-		std::string GetFullStatus() const;
+		const std::string& GetStatusJSON();
+		// format_versionが0の場合はtext_archive形式、それ以外はバイナリ形式
+		const std::string& GetFullStatus(uint16_t format_version = 0);
 
-		const Config& config() const;
+		// io_serviceのスレッドでのみ使う (設定の変更はティックごとに取り込む)
+		const ConfigPtr& config() const;
 		Account& account();
 
-		void AddChatLog(const std::string& msg);
+		uint32_t AddChatLog(unsigned char channel, uint32_t user_id, const std::string& message);
+		void SendChatLog(const SessionPtr& session, unsigned char channel, uint32_t sequence, int count);
 
         int GetSessionReadAverageLimit();
 		int GetUserCount() const;
@@ -66,12 +104,62 @@ class Server {
 
         void FetchUDP(const std::string& buffer, const boost::asio::ip::udp::endpoint endpoint);
 
+        void Tick(const boost::system::error_code& error);
+        void QueuePlayerPosition(const SessionPtr& session, uint32_t user_id);
+        void QueuePlayerLeave(const SessionPtr& session, uint32_t user_id);
+        void FlushPlayerPositions();
+        void RebuildInterestGrid(int cell_size, int interest_radius);
+        uint32_t ToTicks(const boost::posix_time::time_duration& duration) const;
+        void FlushAccountRevisions();
+
+        struct WorldSnapshot {
+            uint32_t cursor;
+            std::string patches;
+            std::string positions;
+            std::vector<std::pair<uint32_t, uint32_t>> revisions;
+        };
+        const WorldSnapshot& GetWorldSnapshot(unsigned char channel);
+
+        ServerInfo GetServerInfo();
+
+        void CollectMetrics(metrics::Writer* writer);
+        void LogLatencyStats(const boost::system::error_code& error);
+        void LogLatencyStats(const char* name, const metrics::LatencyHistogramArray& histograms, int kind);
+
+        // ステータスの送信データ
+        // アカウントのリビジョンか設定が変わるか、往復遅延を更新するために一定時間が経つと作り直す
+        struct StatusCache {
+            StatusCache() : revision(0), time(0) {}
+
+            bool IsValid(uint32_t revision, const ConfigPtr& config, uint32_t time) const;
+            void Update(uint32_t revision, const ConfigPtr& config, uint32_t time);
+
+            uint32_t revision;
+            ConfigPtr config;
+            uint32_t time;
+            std::string payload;
+        };
+
     private:
-	   Config config_;
+	   ConfigWatcher config_watcher_;
+	   // 監視中の設定をティックごとに取り出したもの
+	   // 呼び出しのたびにstd::atomic_loadするとロックを取るので、io_serviceのスレッドではこれを参照する
+	   ConfigPtr config_;
 	   Account account_;
 	   Channel channel_;
+	   InterestGrid interest_grid_;
+	   int interest_cell_size_;
+	   int interest_radius_;
 
        boost::asio::io_service io_service_;
+       AddressResolver resolver_;
+       MetricsServer metrics_server_;
+       int metrics_collector_;
+
+       // 遅延の集計の出力 (前回出力した時点の値との差を出力する)
+       boost::asio::deadline_timer stats_timer_;
+       int stats_interval_;
+       std::unordered_map<int, metrics::LatencyHistogram::Snapshot> stats_snapshots_;
        tcp::endpoint endpoint_;
        tcp::acceptor acceptor_;
 
@@ -81,13 +169,53 @@ class Server {
        char receive_buf_udp_[2048];
        uint8_t udp_packet_count_;
 
+       boost::asio::deadline_timer tick_timer_;
+       uint32_t tick_;
+       boost::posix_time::ptime start_time_;
+
+       // 次のティックで送信する位置情報 (送信先ID -> 移動したプレイヤーと、関心範囲から出たプレイヤーのID)
+       struct PendingPositions {
+           SessionWeakPtr session;
+           std::vector<uint32_t> user_ids;
+           std::vector<uint32_t> left_ids;
+       };
+       std::unordered_map<uint32_t, PendingPositions> pending_positions_;
+       std::unordered_map<uint32_t, PositionEncoder> position_encoders_;
+
+       // 各セッションに送信済みのアカウントリビジョン (送信先ID -> ユーザーID -> リビジョン)
+       std::unordered_map<uint32_t, std::unordered_map<uint32_t, uint32_t>> sent_revisions_;
+
+       // 各セッションに送った変更履歴の位置 (範囲外のユーザーの変更を送っていない間は進めない)
+       std::unordered_map<uint32_t, uint32_t> account_cursors_;
+
+       // 次のティックで通知するユーザーと、チャンネルを移動したセッション、スナップショットを送ったセッション
+       std::unordered_set<uint32_t> dirty_revisions_;
+       std::unordered_set<uint32_t> channel_syncs_;
+       std::unordered_set<uint32_t> snapshot_syncs_;
+
+       // 参加時に送るチャンネルごとのスナップショット (ティックごとに破棄し、最初の参加時に作る)
+       std::unordered_map<unsigned char, WorldSnapshot> world_snapshots_;
+
+       StatusCache status_cache_;
+       StatusCache full_status_cache_;
+       StatusCache server_info_cache_;
+
+       // ログアウトしたユーザーの遅延削除
+       TimerWheel timer_wheel_;
+       std::unordered_map<uint32_t, TimerWheel::TimerId> removal_timers_;
+
        CallbackFuncPtr callback_;
 
        boost::mutex mutex_;
        std::list<SessionWeakPtr> sessions_;
 
-	   boost::circular_buffer<std::string> recent_chat_log_;
-	   std::list<udp::resolver::iterator> lobby_hosts_;
+	   // チャンネルごとのチャット履歴
+	   ChatHistory chat_history_;
+
+       // 重い計算を行うワーカースレッド
+       boost::asio::io_service worker_service_;
+       boost::asio::io_service::work worker_work_;
+       boost::thread worker_thread_;
 
 };
 
@@ -0,0 +1,111 @@
+//
+// TimerWheel.cpp
+//
+
+#include "TimerWheel.hpp"
+#include <algorithm>
+#include <boost/foreach.hpp>
+
+TimerWheel::TimerWheel() :
+    current_tick_(0),
+    next_id_(0)
+{
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(uint32_t ticks, const Callback& callback)
+{
+    Timer timer;
+    timer.id = ++next_id_;
+    timer.expires = current_tick_ + std::max<uint32_t>(1, ticks);
+    timer.callback = callback;
+
+    Insert(timer);
+    return timer.id;
+}
+
+bool TimerWheel::Cancel(TimerId id)
+{
+    auto it = locations_.find(id);
+    if (it == locations_.end()) {
+        return false;
+    }
+
+    it->second.slot->erase(it->second.it);
+    locations_.erase(it);
+    return true;
+}
+
+size_t TimerWheel::size() const
+{
+    return locations_.size();
+}
+
+void TimerWheel::Insert(Timer timer)
+{
+    // 最上位の範囲を超える場合は、最上位で折り返さないよう切り詰める
+    const uint64_t max_delta = (1ULL << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1;
+    uint64_t delta = timer.expires - current_tick_;
+    if (delta > max_delta) {
+        timer.expires = current_tick_ + max_delta;
+        delta = max_delta;
+    }
+
+    Slot* slot;
+    if (delta < ROOT_SIZE) {
+        slot = &root_[timer.expires & (ROOT_SIZE - 1)];
+    } else {
+        int level = 0;
+        while (delta >= (1ULL << (ROOT_BITS + (level + 1) * LEVEL_BITS))) {
+            level++;
+        }
+        int shift = ROOT_BITS + level * LEVEL_BITS;
+        slot = &levels_[level][(timer.expires >> shift) & (LEVEL_SIZE - 1)];
+    }
+
+    const TimerId id = timer.id;
+    slot->push_back(std::move(timer));
+
+    Location location = {slot, std::prev(slot->end())};
+    locations_[id] = location;
+}
+
+void TimerWheel::Cascade(int level, int index)
+{
+    Slot timers;
+    timers.splice(timers.end(), levels_[level][index]);
+
+    BOOST_FOREACH(auto& timer, timers) {
+        Insert(std::move(timer));
+    }
+}
+
+void TimerWheel::Advance()
+{
+    current_tick_++;
+
+    // 下位のホイールが一周したら、上位のスロットを振り分け直す
+    const int root_index = current_tick_ & (ROOT_SIZE - 1);
+    if (root_index == 0) {
+        for (int level = 0; level < LEVELS; level++) {
+            int shift = ROOT_BITS + level * LEVEL_BITS;
+            int index = (current_tick_ >> shift) & (LEVEL_SIZE - 1);
+            Cascade(level, index);
+            if (index != 0) {
+                break;
+            }
+        }
+    }
+
+    Slot expired;
+    expired.splice(expired.end(), root_[root_index]);
+
+    BOOST_FOREACH(const auto& timer, expired) {
+        locations_.erase(timer.id);
+    }
+
+    BOOST_FOREACH(const auto& timer, expired) {
+        if (timer.callback) {
+            timer.callback();
+        }
+    }
+}
@@ -0,0 +1,61 @@
+//
+// TimerWheel.hpp
+//
+
+#pragma once
+
+#include <list>
+#include <array>
+#include <unordered_map>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+// 階層タイマーホイール
+// サーバーのティックで進め、遅延処理の登録と取り消しを O(1) で行う
+class TimerWheel {
+    public:
+        typedef uint64_t TimerId;
+        typedef std::function<void()> Callback;
+
+        TimerWheel();
+
+        TimerId Schedule(uint32_t ticks, const Callback& callback);
+        bool Cancel(TimerId id);
+        void Advance();
+
+        size_t size() const;
+
+    private:
+        enum {
+            ROOT_BITS = 8,
+            LEVEL_BITS = 6,
+            LEVELS = 4,
+            ROOT_SIZE = 1 << ROOT_BITS,
+            LEVEL_SIZE = 1 << LEVEL_BITS,
+        };
+
+        struct Timer {
+            TimerId id;
+            uint64_t expires;
+            Callback callback;
+        };
+
+        typedef std::list<Timer> Slot;
+
+        struct Location {
+            Slot* slot;
+            Slot::iterator it;
+        };
+
+        void Insert(Timer timer);
+        void Cascade(int level, int index);
+
+    private:
+        uint64_t current_tick_;
+        TimerId next_id_;
+
+        std::array<Slot, ROOT_SIZE> root_;
+        std::array<std::array<Slot, LEVEL_SIZE>, LEVELS> levels_;
+        std::unordered_map<TimerId, Location> locations_;
+};
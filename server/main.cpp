@@ -5,12 +5,12 @@
 #include <iostream>
 #include <sstream>
 #include <ctime>
-#include <boost/format.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/property_tree/json_parser.hpp>
 #include <boost/foreach.hpp>
 #include "version.hpp"
 #include "Server.hpp"
+#include "ChatMessage.hpp"
+#include "CommandRegistry.hpp"
 #include "../common/network/Encrypter.hpp"
 #include "../common/network/Signature.hpp"
 #include "../common/database/AccountProperty.hpp"
@@ -32,21 +32,34 @@ using namespace boost::posix_time;
 
 void client_sync(network::Server& server);
 void public_ping(network::Server& server);
-void server();
+void server(int stats_interval);
 
 int main(int argc, char* argv[])
 {
 	Logger::Info(_T("%s"), unicode::ToTString(MMO_VERSION_TEXT));
 
+	// --stats-interval <秒>: コマンドごとの遅延の集計を定期的にログに出力する
+	int stats_interval = 0;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--stats-interval" && i + 1 < argc) {
+			stats_interval = atoi(argv[++i]);
+		} else if (arg.compare(0, 17, "--stats-interval=") == 0) {
+			stats_interval = atoi(arg.c_str() + 17);
+		} else {
+			Logger::Error(_T("Unknown option: %s"), unicode::ToTString(arg));
+		}
+	}
+
 #ifndef NDEBUG
  try {
 #endif
 
-	 server();
+	 server(stats_interval);
 
 #ifndef NDEBUG
   } catch (std::exception& e) {
-      Logger::Error(e.what());
+      Logger::Fatal(e.what());
       Logger::Info("Stop Server");
   }
 #endif
@@ -55,7 +68,7 @@ int main(int argc, char* argv[])
 
 }
 
-void server()
+void server(int stats_interval)
 {
 
     // 署名
@@ -64,340 +77,293 @@ void server()
     // アカウント
     network::Server server;
 
-    auto callback = std::make_shared<std::function<void(network::Command)>>(
-            [&server, &sign](network::Command c){
+    // チャットメッセージの解析用バッファ
+    ChatMessage chat_message;
+    ChatInfoEnvelope chat_info;
 
-        // ログを出力
-        auto msg = (boost::format("Receive: 0x%08x %dbyte") % c.header() % c.body().size()).str();
+    network::CommandRegistry registry;
+
+    // サーバー情報要求 (形式バージョンのない古いクライアントにはtext_archive形式で返す)
+    registry.RegisterRaw(network::header::ServerRequestedFullServerInfo, [&server](network::Command& c) {
         if (auto session = c.session().lock()) {
-            msg += " from " + session->global_ip();
+            uint16_t format_version = 0;
+            if (c.body().size() >= sizeof(uint16_t)) {
+                network::Utils::Deserialize(c.body(), &format_version);
+            }
+            session->Send(network::ClientReceiveFullServerInfo(server.GetFullStatus(format_version)));
         }
+    });
 
-        // if (auto session = c.session().lock()) {
-        //     std::cout << "Write Average: " << session->GetReadByteAverage() << "bytes" << std::endl;
-        // }
-		auto header = c.header();
-        switch (c.header()) {
-
-		case network::header::ServerRequestedFullServerInfo:
-		{
-			if (auto session = c.session().lock()) {
-				session->Send(network::ClientReceiveFullServerInfo(server.GetFullStatus()));
-			}
-		}
-		break;
+    // ステータス要求
+    registry.RegisterRaw(network::header::ServerRequstedStatus, [&server](network::Command& c) {
+        // ステータスを送り返す
+        server.SendUDP(server.GetStatusJSON(), c.udp_endpoint());
+    });
 
-		case network::header::ServerRequestedPlainFullServerInfo:
-		{
-			//if (auto session = c.session().lock()) {
-			//	session->Send(network::ClientReceivePlainFullServerInfo(server.GetFullStatus()));
-			//}
-		}
-		break;
+    // JSONメッセージ受信
+    registry.Register<network::ServerReceiveJSON>(
+            [&server, &chat_message, &chat_info](const network::SessionPtr& session, const std::string& message_json) {
+        uint32_t id = static_cast<unsigned int>(session->id());
+        if (id == 0) {
+            Logger::Error(_T("Invalid session id"));
+            return;
+        }
 
-		// ステータス要求
-		case network::header::ServerRequstedStatus:
-		{
-			// ステータスを送り返す
-			server.SendUDP(server.GetStatusJSON(), c.udp_endpoint());
-		}
-		break;
-
-        // JSONメッセージ受信
-        case network::header::ServerReceiveJSON:
-        {
-            if (auto session = c.session().lock()) {
-                uint32_t id = static_cast<unsigned int>(session->id());
-				if (id == 0) {
-					Logger::Error(_T("Invalid session id"));
-					break;
-				}
-				
-				std::stringstream message_json(network::Utils::Deserialize<std::string>(c.body()));
-
-				using namespace boost::property_tree;
-				ptree message_tree;
-				json_parser::read_json(message_json, message_tree);
-
-				// プライベートメッセージの処理
-				std::list<uint32_t> destination_list;
-				auto private_list_tree =  message_tree.get_child("private", ptree());
-				BOOST_FOREACH(const auto& user_id, private_list_tree) {
-					destination_list.push_back(user_id.second.get_value<uint32_t>());
-				}
-
-                ptime now = second_clock::universal_time();
-                auto time_string = to_iso_extended_string(now);
-
-                std::string info_json;
-                info_json += "{";
-                info_json += (boost::format("\"id\":\"%d\",") % id).str();
-                info_json += (boost::format("\"time\":\"%s\"") % time_string).str();
-                info_json += "}";
-
-				auto send_command = network::ClientReceiveJSON(info_json, message_json.str());
-
-				if (destination_list.size() > 0) {
-					BOOST_FOREACH(uint32_t user_id, destination_list) {
-						server.SendTo(send_command, user_id);
-					}
-				} else {
-					auto name = server.account().GetUserName(id);
-					auto body = message_tree.get<std::string>("body", std::string());
-					server.AddChatLog((boost::format("[%s] %s") % name % body).str());
-
-					server.SendAll(send_command, session->channel());
-				}
-
-				Logger::Info("Receive JSON: %s", message_json.str());
-            }
+        // 宛先だけを取り出す
+        if (!chat_message.Parse(message_json)) {
+            Logger::Error(_T("Invalid JSON message"));
+            return;
         }
-            break;
-
-
-        // 位置情報受信
-        case network::header::ServerUpdatePlayerPosition:
-        {
-            if (auto session = c.session().lock()) {
-                PlayerPosition pos;
-                network::Utils::Deserialize(c.body(), &pos.x, &pos.y, &pos.z, &pos.theta, &pos.vy);
-                server.account().SetUserPosition(session->id(), pos);
-                server.SendOthers(network::ClientUpdatePlayerPosition(session->id(),
-					pos.x,pos.y,pos.z,pos.theta, pos.vy), session->id(), session->channel(), true);
+
+        if (chat_message.private_ids.size() > 0) {
+            auto send_command = network::ClientReceiveJSON(chat_info.Build(id), message_json);
+            BOOST_FOREACH(uint32_t user_id, chat_message.private_ids) {
+                server.SendTo(send_command, user_id);
             }
+        } else {
+            // 全体へのメッセージは履歴に記録し、シーケンス番号を付けて送る
+            auto sequence = server.AddChatLog(session->channel(), id, message_json);
+            auto send_command = network::ClientReceiveJSON(chat_info.Build(id, sequence), message_json);
+            server.SendAll(send_command, session->channel());
         }
-            break;
-
-        // 公開鍵フィンガープリント受信
-        case network::header::ServerReceiveClientInfo:
-        {
-            if (auto session = c.session().lock()) {
 
-				// 最大接続数を超えていないか判定
-				if (server.GetUserCount() >= server.config().capacity()) {
-					Logger::Info("Refused Session");
-					session->SyncSend(network::ClientReceiveServerCrowdedError());
-					session->Close();
+        LOG_INFO("Receive JSON: %s", message_json);
+    });
 
-				}
+    // 位置情報受信
+    registry.Register<network::ServerUpdatePlayerPosition>(
+            [&server](const network::SessionPtr& session, int16_t x, int16_t y, int16_t z, uint8_t theta, uint8_t vy) {
+        if (session->id() == 0) {
+            Logger::Error(_T("Invalid session id"));
+            return;
+        }
 
-				session->ResetReadByteAverage();
+        PlayerPosition pos(x, y, z, theta, static_cast<int8_t>(vy));
+        server.account().SetUserPosition(session->id(), pos);
+        server.UpdatePlayerPosition(session, pos);
+    });
 
-                std::string finger_print;
-                uint16_t version;
-                uint16_t udp_port;
+    // 往復遅延の計測結果
+    registry.Register<network::ServerReceivePong>(
+            [&server](const network::SessionPtr& session, uint32_t ping_time) {
+        uint32_t now = server.GetServerTime();
+        if (now >= ping_time) {
+            session->UpdateRoundTripTime(now - ping_time);
+        }
+    });
 
-                network::Utils::Deserialize(c.body(), &finger_print, &version, &udp_port);
+    // 位置情報の復号に失敗したクライアントに、次のティックでキーフレームを送る
+    registry.Register<network::ServerRequestedPositionKeyframe>(
+            [&server](const network::SessionPtr& session) {
+        server.ResetPositionEncoder(session);
+    }, true);
+
+    // 公開鍵フィンガープリント受信
+    registry.Register<network::ServerReceiveClientInfo>(
+            [&server, &sign](const network::SessionPtr& session,
+                const std::string& finger_print, uint16_t version, uint16_t udp_port) {
+
+        // 最大接続数を超えていないか判定
+        if (server.GetUserCount() >= server.config()->capacity()) {
+            Logger::Info("Refused Session");
+            session->SyncSend(network::ClientReceiveServerCrowdedError());
+            session->Close();
+        }
 
-                // クライアントのプロトコルバージョンをチェック
-                if (version != MMO_PROTOCOL_VERSION) {
-                    Logger::Info("Unsupported Client Version : v%d", version);
-                    session->Send(network::ClientReceiveUnsupportVersionError(1));
-                    return;
-                }
+        session->ResetReadByteAverage();
 
-                // UDPパケットの宛先を設定
-                session->set_udp_port(udp_port);
+        // クライアントのプロトコルバージョンをチェック
+        if (version != MMO_PROTOCOL_VERSION) {
+            Logger::Info("Unsupported Client Version : v%d", version);
+            session->Send(network::ClientReceiveUnsupportVersionError(1));
+            return;
+        }
 
-                Logger::Info("UDP destination is %s:%d", session->global_ip(), session->udp_port());
+        // UDPパケットの宛先を設定
+        session->set_udp_port(udp_port);
 
-                // テスト送信
-                server.SendUDPTestPacket(session->global_ip(), session->udp_port());
+        LOG_INFO("UDP destination is %s:%d", session->global_ip(), session->udp_port());
 
-                uint32_t id = server.account().GetUserIdFromFingerPrint(finger_print);
-                if (id == 0) {
-                    // 未登録の場合、公開鍵を要求
-                    session->Send(network::ClientRequestedPublicKey());
-                } else {
-                    uint32_t user_id = static_cast<uint32_t>(id);
-                    // ログイン
-                    session->set_id(user_id);
-                    server.account().LogIn(user_id);
-                    session->encrypter().SetPublicKey(server.account().GetPublicKey(user_id));
+        // テスト送信
+        server.SendUDPTestPacket(session->global_ip(), session->udp_port());
 
-                    server.account().SetUserIPAddress(session->id(), session->global_ip());
-                    server.account().SetUserUDPPort(session->id(), session->udp_port());
+        uint32_t id = server.account().GetUserIdFromFingerPrint(finger_print);
+        if (id == 0) {
+            // 未登録の場合、公開鍵を要求
+            session->Send(network::ClientRequestedPublicKey());
+        } else {
+            uint32_t user_id = static_cast<uint32_t>(id);
+            // ログイン
+            session->set_id(user_id);
+            server.CancelAccountRemoval(user_id);
+            server.account().LogIn(user_id);
+            session->encrypter().SetPublicKey(server.account().GetPublicKey(user_id));
 
-                    // 共通鍵を送り返す
-                    auto key = session->encrypter().GetCryptedCommonKey();
-                    session->Send(network::ClientReceiveCommonKey(key, sign.Sign(key), user_id));
+            server.account().SetUserIPAddress(session->id(), session->global_ip());
+            server.account().SetUserUDPPort(session->id(), session->udp_port());
 
-                }
-                Logger::Info(msg);
-            }
+            // 共通鍵を送り返す
+            auto key = session->encrypter().GetCryptedCommonKey();
+            session->Send(network::ClientReceiveCommonKey(key, sign.Sign(key), user_id));
         }
-            break;
-
-        // 公開鍵受信
-        case network::header::ServerReceivePublicKey:
-        {
-            if (auto session = c.session().lock()) {
-				auto public_key = network::Utils::Deserialize<std::string>(c.body());
-                uint32_t user_id = server.account().RegisterPublicKey(public_key);
+    }, true);
 
-				assert(user_id > 0);
+    // 公開鍵受信
+    registry.Register<network::ServerReceivePublicKey>(
+            [&server, &sign](const network::SessionPtr& session, const std::string& public_key) {
+        uint32_t user_id = server.account().RegisterPublicKey(public_key);
 
-				session->ResetReadByteAverage();
+        assert(user_id > 0);
 
-                // ログイン
-                session->set_id(user_id);
-                server.account().LogIn(user_id);
-                session->encrypter().SetPublicKey(server.account().GetPublicKey(user_id));
+        session->ResetReadByteAverage();
 
-                server.account().SetUserIPAddress(session->id(), session->global_ip());
-                server.account().SetUserUDPPort(session->id(), session->udp_port());
+        // ログイン
+        session->set_id(user_id);
+        server.CancelAccountRemoval(user_id);
+        server.account().LogIn(user_id);
+        session->encrypter().SetPublicKey(server.account().GetPublicKey(user_id));
 
-                // 共通鍵を送り返す
-                auto key = session->encrypter().GetCryptedCommonKey();
-                session->Send(network::ClientReceiveCommonKey(key, sign.Sign(key), user_id));
+        server.account().SetUserIPAddress(session->id(), session->global_ip());
+        server.account().SetUserUDPPort(session->id(), session->udp_port());
 
-            }
-            Logger::Info(msg);
-        }
-            break;
+        // 共通鍵を送り返す
+        auto key = session->encrypter().GetCryptedCommonKey();
+        session->Send(network::ClientReceiveCommonKey(key, sign.Sign(key), user_id));
+    }, true);
 
-        // 暗号化通信開始
-        case network::header::ServerStartEncryptedSession:
-        {
-            if (auto session = c.session().lock()) {
-				
-				session->Send(network::ClientReceiveServerInfo(server.config().stage()));
+    // 暗号化通信開始
+    registry.Register<network::ServerStartEncryptedSession>(
+            [&server](const network::SessionPtr& session) {
+        session->Send(network::ClientReceiveServerInfo(server.config()->stage()));
 
-                session->Send(network::ClientStartEncryptedSession());
-                session->EnableEncryption();
+        session->Send(network::ClientStartEncryptedSession());
+        session->EnableEncryption();
+    }, true);
 
-                Logger::Info(msg);
+    // アカウント初期化情報の受信 (カーソルは古いクライアントでは省略される)
+    registry.RegisterRaw(network::header::ServerReceiveAccountInitializeData, [&server](network::Command& c) {
+        if (auto session = c.session().lock()) {
+            std::string data;
+            uint32_t cursor = 0;
+            size_t readed = network::Utils::Deserialize(c.body(), &data);
+            if (c.body().size() >= readed + sizeof(uint32_t)) {
+                network::Utils::Deserialize(c.body().substr(readed), &cursor);
+            }
+            boost::optional<std::string> trip;
+            server.account().LoadInitializeData(session->id(), data, &trip);
+            if (trip) {
+                server.SetUserTripAsync(session->id(), *trip);
             }
-        }
-            break;
-
-        // アカウント初期化情報の受信
-        case network::header::ServerReceiveAccountInitializeData:
-        {
-            if (auto session = c.session().lock()) {
-				auto data = network::Utils::Deserialize<std::string>(c.body());
-                server.account().LoadInitializeData(session->id(), data);
-
-                const auto& list = server.account().GetIDList();
-                BOOST_FOREACH(UserID user_id, list) {
-                    session->Send(network::ClientReceiveAccountRevisionUpdateNotify(user_id,
-                            server.account().GetUserRevision(user_id)));
-                }
 
-                server.SendOthers(
-                        network::ClientReceiveAccountRevisionUpdateNotify(session->id(),
-                                server.account().GetUserRevision(session->id())), session->id());
+            server.NotifyAccountRevision(session->id());
+            server.SyncAccountRevisions(session, cursor);
 
-                Logger::Info(msg);
-            }
+            // 移動するまで関心範囲に入らないと、その間は周囲の移動を受け取れない
+            server.UpdatePlayerPosition(session, server.account().GetUserPosition(session->id()));
         }
-        break;
-
-        // アカウント更新情報の要求
-        case network::header::ServerRequestedAccountRevisionPatch:
-        {
-            if (auto session = c.session().lock()) {
-                uint32_t user_id;
-                uint32_t client_revision;
-                network::Utils::Deserialize(c.body(), &user_id, &client_revision);
-
-                if (client_revision < server.account().GetUserRevision(user_id)) {
-                    session->Send(network::ClientReceiveAccountRevisionPatch(
-                            server.account().GetUserRevisionPatch(user_id, client_revision)));
-                }
-                Logger::Info(msg);
-            }
+    }, true);
+
+    // チャット履歴の要求
+    registry.Register<network::ServerRequestedChatLog>(
+            [&server](const network::SessionPtr& session, uint8_t channel, uint32_t sequence, uint16_t count) {
+        if (session->id() == 0) {
+            Logger::Error(_T("Invalid session id"));
+            return;
         }
-        break;
+        server.SendChatLog(session, channel, sequence, count);
+    });
 
-        case network::header::ServerUpdateAccountProperty:
-        {
-            if (auto session = c.session().lock()) {
-                AccountProperty property;
-				std::string buffer = c.body().substr(sizeof(AccountProperty));
-                network::Utils::Deserialize(c.body(), &property);
+    // アカウント更新情報の要求
+    registry.Register<network::ServerRequestedAccountRevisionPatch>(
+            [&server](const network::SessionPtr& session, uint32_t user_id, int client_revision) {
+        server.SendAccountRevisionPatch(session, user_id, static_cast<uint32_t>(client_revision));
+    }, true);
 
-                auto old_revision = server.account().GetUserRevision(session->id());
+    // アカウント情報の更新 (値の型はプロパティごとに異なる)
+    registry.RegisterRaw(network::header::ServerUpdateAccountProperty, [&server](network::Command& c) {
+        if (auto session = c.session().lock()) {
+            AccountProperty property;
+            std::string buffer = c.body().substr(sizeof(AccountProperty));
+            network::Utils::Deserialize(c.body(), &property);
 
-                switch (property) {
+            auto old_revision = server.account().GetUserRevision(session->id());
 
-                case NAME:
-                    {
-						std::string value;
-						network::Utils::Deserialize(buffer, &value);
-                        server.account().SetUserName(session->id(), value);
-                    }
-                    break;
-                case TRIP:
-                    {
-						std::string value;
-						network::Utils::Deserialize(buffer, &value);
-                        server.account().SetUserTrip(session->id(), value);
-                    }
-                    break;
-                case MODEL_NAME:
-                    {
-						std::string value;
-						network::Utils::Deserialize(buffer, &value);
-                        server.account().SetUserModelName(session->id(), value);
-                    }
-                    break;
-                case CHANNEL:
-                    {
-						std::string value;
-						network::Utils::Deserialize(buffer, &value);
-						auto channel = *reinterpret_cast<const unsigned int*>(value.data());
-                        server.account().SetUserChannel(session->id(), channel);
-						session->set_channel(channel);
-                    }
-                    break;
-                default:
-                    ;
-                }
+            switch (property) {
 
-                auto new_revison = server.account().GetUserRevision(session->id());
-                if (new_revison > old_revision) {
-                    server.SendAll(
-                            network::ClientReceiveAccountRevisionUpdateNotify(
-                            session->id(),new_revison));
+            case NAME:
+                {
+                    std::string value;
+                    network::Utils::Deserialize(buffer, &value);
+                    server.account().SetUserName(session->id(), value);
+                }
+                break;
+            case TRIP:
+                {
+                    std::string value;
+                    network::Utils::Deserialize(buffer, &value);
+                    server.SetUserTripAsync(session->id(), value);
                 }
+                break;
+            case MODEL_NAME:
+                {
+                    std::string value;
+                    network::Utils::Deserialize(buffer, &value);
+                    server.account().SetUserModelName(session->id(), value);
+                }
+                break;
+            case CHANNEL:
+                {
+                    std::string value;
+                    network::Utils::Deserialize(buffer, &value);
+                    auto channel = *reinterpret_cast<const unsigned int*>(value.data());
+                    server.account().SetUserChannel(session->id(), channel);
+                    session->set_channel(channel);
+                    server.SyncChannelRevisions(session->id());
+                    server.UpdatePlayerPosition(session, server.account().GetUserPosition(session->id()));
+                }
+                break;
+            default:
+                ;
+            }
 
-                Logger::Info(msg);
+            auto new_revison = server.account().GetUserRevision(session->id());
+            if (new_revison > old_revision) {
+                server.NotifyAccountRevision(session->id());
             }
         }
-        break;
+    }, true);
 
-        // エラー
-        case network::header::UserFatalConnectionError:
-        {
-            if (c.body().size() > 0) {
-                uint32_t user_id = network::Utils::Deserialize<uint32_t>(c.body());
-                server.account().LogOut(user_id);
+    // エラー
+    registry.RegisterRaw(network::header::UserFatalConnectionError, [&server](network::Command& c) {
+        if (c.body().size() > 0) {
+            uint32_t user_id = network::Utils::Deserialize<uint32_t>(c.body());
+            server.account().LogOut(user_id);
+            server.RemovePlayerPosition(user_id);
 
-                server.SendAll(
-                        network::ClientReceiveAccountRevisionUpdateNotify(user_id,
-                                server.account().GetUserRevision(user_id)));
+            server.NotifyAccountRevision(user_id);
+            server.ResetAccountRevisions(user_id);
 
-                Logger::Info("Logout User: %d", user_id);
-				server.account().Remove(user_id);
-            }
-        }
-        Logger::Info(msg);
-        break;
-
-        default:
-            break;
+            Logger::Info("Logout User: %d", user_id);
+            server.ScheduleAccountRemoval(user_id);
         }
+    }, true);
 
+    auto callback = std::make_shared<std::function<void(network::Command)>>(
+            [&registry](network::Command c){
+        registry.Dispatch(c);
     });
 
+	server.SetStatsInterval(stats_interval);
+
 	client_sync(server);
 
-	if (server.config().is_public()) {
+	if (server.config()->is_public()) {
 		public_ping(server);
 	}
 
     server.Start(callback);
+
+    registry.LogStats();
 }
 
 void public_ping(network::Server& server)
@@ -0,0 +1,56 @@
+//
+// AccountBench.cpp
+//
+
+#include "Test.hpp"
+#include <boost/filesystem.hpp>
+#include "../Account.hpp"
+
+// アカウント情報の取得のコスト
+// 参加のたびに全員分を読む GetUserRevision などを、ログイン中の1000人について計測する
+int main()
+{
+    using namespace boost::filesystem;
+
+    // サーバーの accounts フォルダを書き換えないよう、一時フォルダに保存する
+    const path directory = temp_directory_path() / unique_path();
+    {
+        Account account(directory.string());
+
+        const int user_count = 1000;
+        std::vector<UserID> user_ids;
+        for (int i = 0; i < user_count; i++) {
+            UserID user_id = account.RegisterPublicKey("public key " + std::to_string(i));
+            account.LogIn(user_id);
+            account.SetUserName(user_id, "player" + std::to_string(i));
+            account.SetUserModelName(user_id, "初音ミク");
+            account.SetUserChannel(user_id, i % 4);
+            account.SetUserPosition(user_id, PlayerPosition(i, 0, i, 0, 0));
+            user_ids.push_back(user_id);
+        }
+        CHECK(account.GetIDList().size() == user_ids.size());
+        CHECK(account.GetUserName(user_ids[10]) == "player10");
+
+        const int rounds = 1000;
+        auto measure = [&](const char* name, std::function<size_t(UserID)> func) {
+            test::Report(name, test::Measure(rounds, [&](int) {
+                for (size_t i = 0; i < user_ids.size(); i++) {
+                    test::sink() += func(user_ids[i]);
+                }
+            }) / user_count, "ns/call");
+        };
+
+        measure("GetUserRevision", [&](UserID id) { return account.GetUserRevision(id); });
+        measure("GetUserChannel", [&](UserID id) { return account.GetUserChannel(id); });
+        measure("GetUserPosition", [&](UserID id) { return account.GetUserPosition(id).x; });
+        measure("GetUserName", [&](UserID id) { return account.GetUserName(id).size(); });
+        measure("GetUserModelName", [&](UserID id) { return account.GetUserModelName(id).size(); });
+        measure("IsLoggedIn", [&](UserID id) { return account.IsLoggedIn(id); });
+        measure("GetUserRevisionPatch (full)", [&](UserID id) {
+            return account.GetUserRevisionPatch(id, 0).size();
+        });
+    }
+    remove_all(directory);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,210 @@
+//
+// AccountStoreTest.cpp
+//
+
+#include "Test.hpp"
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include "../AccountStore.hpp"
+
+using namespace boost::filesystem;
+
+namespace {
+
+AccountStore::Record MakeRecord(uint32_t user_id, const std::string& name)
+{
+    AccountStore::Record record;
+    record.user_id = user_id;
+    record.finger_print = "finger print " + std::to_string(user_id);
+    record.public_key = "public key " + std::to_string(user_id);
+    record.name = name;
+    record.model_name = "初音ミク";
+    return record;
+}
+
+bool HasName(const AccountStore& store, uint32_t user_id, const std::string& name)
+{
+    auto record = store.Find(user_id);
+    return record && record->name == name;
+}
+
+void AppendBytes(const path& file, const std::string& data)
+{
+    std::ofstream ofs(file.string().c_str(), std::ios::binary | std::ios::app);
+    ofs.write(data.data(), data.size());
+}
+
+// 1から順にPutしたログを作り、そのコピーを返す
+// ストアを閉じるとまとめられてしまうので、開いている間にコピーする
+path MakeLog(const path& base, const std::string& name, uint32_t first, uint32_t last,
+    const std::string& prefix)
+{
+    const path directory = base / ("source_" + name);
+    const path copy = base / name;
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        for (uint32_t id = first; id <= last; id++) {
+            store.Put(MakeRecord(id, prefix + std::to_string(id)));
+        }
+        copy_file(directory / "accounts.log", copy, copy_option::overwrite_if_exists);
+    }
+    remove_all(directory);
+    return copy;
+}
+
+// 末尾の書き込みが途中で切れたログは、読める部分まで使ってまとめ直す
+void TestTornLog(const path& base)
+{
+    const path directory = base / "torn";
+    create_directory(directory);
+
+    const path log = MakeLog(base, "torn.log", 1, 10, "player");
+    resize_file(log, file_size(log) - 3);
+    rename(log, directory / "accounts.log");
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(HasName(store, 1, "player1"));
+        CHECK(HasName(store, 9, "player9"));
+        CHECK(store.Find(10) == nullptr);
+        CHECK(exists(directory / "accounts.dat"));
+        CHECK(file_size(directory / "accounts.log") == 0);
+        store.Put(MakeRecord(11, "player11"));
+    }
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(HasName(store, 9, "player9"));
+        CHECK(HasName(store, 11, "player11"));
+        CHECK(store.max_user_id() == 11);
+    }
+}
+
+// 読めないスナップショットは退避し、以後はまとめずにログへ追記し続ける
+// 壊れたログの末尾は切り詰めて、追記した分を読めるようにする
+void TestCorruptedSnapshot(const path& base)
+{
+    const path directory = base / "corrupted";
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        for (uint32_t id = 1; id <= 10; id++) {
+            store.Put(MakeRecord(id, "player" + std::to_string(id)));
+        }
+    }
+    CHECK(exists(directory / "accounts.dat"));
+    AppendBytes(directory / "accounts.dat", "broken");
+
+    const path log = MakeLog(base, "corrupted.log", 20, 22, "player");
+    const uintmax_t valid_size = file_size(log);
+    AppendBytes(log, "torn");
+    rename(log, directory / "accounts.log");
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(!exists(directory / "accounts.dat"));
+        CHECK(exists(directory / "accounts.dat.corrupted"));
+        CHECK(file_size(directory / "accounts.log") == valid_size);
+
+        // 末尾以外は退避したファイルから読める
+        for (uint32_t id = 1; id <= 10; id++) {
+            CHECK(HasName(store, id, "player" + std::to_string(id)));
+        }
+        CHECK(HasName(store, 22, "player22"));
+        store.Put(MakeRecord(23, "player23"));
+    }
+    CHECK(!exists(directory / "accounts.dat"));
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(HasName(store, 5, "player5"));
+        CHECK(HasName(store, 23, "player23"));
+    }
+
+    // 退避したファイルを消すと、再びまとめるようになる
+    remove(directory / "accounts.dat.corrupted");
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(HasName(store, 23, "player23"));
+    }
+    CHECK(exists(directory / "accounts.dat"));
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(HasName(store, 20, "player20"));
+        CHECK(HasName(store, 23, "player23"));
+    }
+}
+
+// まとめる途中で終了すると、切り替え前のログと書きかけの一時ファイルが残る
+// 切り替え前のログ、新しいログの順に再生してからまとめ直す
+void TestRestartDuringCompaction(const path& base)
+{
+    const path directory = base / "compaction";
+    create_directory(directory);
+
+    const path old_log = MakeLog(base, "old.log", 1, 5, "old");
+    const path new_log = MakeLog(base, "new.log", 3, 8, "new");
+    rename(old_log, directory / "accounts.log.1");
+    rename(new_log, directory / "accounts.log");
+    AppendBytes(directory / "accounts.dat.tmp", "MMOA");
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(HasName(store, 1, "old1"));
+        CHECK(HasName(store, 2, "old2"));
+        CHECK(HasName(store, 3, "new3"));
+        CHECK(HasName(store, 8, "new8"));
+        CHECK(store.FindUserId("finger print 5") == 5);
+        CHECK(!exists(directory / "accounts.log.1"));
+        CHECK(!exists(directory / "accounts.dat.tmp"));
+        CHECK(exists(directory / "accounts.dat"));
+    }
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(HasName(store, 1, "old1"));
+        CHECK(HasName(store, 5, "new5"));
+        CHECK(store.max_user_id() == 8);
+    }
+}
+
+// しきい値を超えて別スレッドでまとめた後も、すべての変更が残る
+void TestBackgroundCompaction(const path& base)
+{
+    const path directory = base / "background";
+    const uint32_t count = ACCOUNT_STORE_COMPACTION_THRESHOLD * 2 + 10;
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        for (uint32_t id = 1; id <= count; id++) {
+            store.Put(MakeRecord(id, "player" + std::to_string(id)));
+        }
+    }
+    CHECK(!exists(directory / "accounts.log.1"));
+    {
+        AccountStore store(directory.string());
+        store.Load();
+        CHECK(store.max_user_id() == count);
+        CHECK(HasName(store, 1, "player1"));
+        CHECK(HasName(store, count, "player" + std::to_string(count)));
+    }
+}
+
+}
+
+int main()
+{
+    const path base = temp_directory_path() / unique_path();
+    create_directories(base);
+
+    TestTornLog(base);
+    TestCorruptedSnapshot(base);
+    TestRestartDuringCompaction(base);
+    TestBackgroundCompaction(base);
+
+    remove_all(base);
+    return TEST_RESULT();
+}
@@ -0,0 +1,157 @@
+//
+// AddressFilterTest.cpp
+//
+
+#include "Test.hpp"
+#include <boost/foreach.hpp>
+#include "../AddressFilter.hpp"
+#include "../../common/network/Utils.hpp"
+
+namespace {
+
+    typedef boost::asio::ip::address Address;
+
+    std::vector<Address> Addresses(const std::vector<std::string>& texts)
+    {
+        std::vector<Address> addresses;
+        BOOST_FOREACH(const auto& text, texts) {
+            addresses.push_back(Address::from_string(text));
+        }
+        return addresses;
+    }
+
+    const std::vector<Address>& V4Addresses()
+    {
+        static const std::vector<Address> addresses = Addresses({
+            "0.0.0.0", "1.2.3.4", "9.255.255.255", "10.0.0.1", "10.0.0.2", "10.255.255.255",
+            "11.0.0.0", "100.64.0.1", "127.0.0.1", "192.168.0.1", "192.168.1.22",
+            "192.168.10.20", "192.169.0.1", "255.255.255.255"
+        });
+        return addresses;
+    }
+
+    const std::vector<Address>& V6Addresses()
+    {
+        static const std::vector<Address> addresses = Addresses({
+            "::", "::1", "2001:db8::1", "2001:db8::2", "2001:db8:ffff::1", "2001:db9::1", "fe80::1"
+        });
+        return addresses;
+    }
+
+    // 木で照合するパターンと、文字列での照合に戻るパターン
+    const std::vector<std::string>& WildcardPatterns()
+    {
+        static const std::vector<std::string> patterns = {
+            "*", "10.*.*.*", "10.*", "192.168.*", "192.168.*.*", "127.0.0.1", "2001:db8::1",
+            "192.168.1*", "1*.0.0.1", "192.16?.*", "*.1", "192.168.*.2?", "*:*", "fe80::*"
+        };
+        return patterns;
+    }
+
+    AddressFilter MakeFilter(const std::string& pattern)
+    {
+        AddressFilter filter;
+        filter.Add(pattern);
+        return filter;
+    }
+
+    bool MatchWithWildcard(const std::string& pattern, const Address& address)
+    {
+        return network::Utils::MatchWithWildcard(pattern, address.to_string());
+    }
+
+    // ワイルドカードのパターンは、従来の文字列での照合と同じ結果になる
+    void TestSameAsWildcard()
+    {
+        std::vector<Address> addresses = V4Addresses();
+        addresses.insert(addresses.end(), V6Addresses().begin(), V6Addresses().end());
+
+        AddressFilter all;
+        BOOST_FOREACH(const auto& pattern, WildcardPatterns()) {
+            all.Add(pattern);
+            const AddressFilter filter = MakeFilter(pattern);
+            BOOST_FOREACH(const auto& address, addresses) {
+                CHECK(filter.Match(address) == MatchWithWildcard(pattern, address));
+            }
+        }
+
+        // "*" を除くと、どのパターンにも一致しないアドレスが残る
+        AddressFilter without_any;
+        BOOST_FOREACH(const auto& pattern, WildcardPatterns()) {
+            if (pattern != "*") {
+                without_any.Add(pattern);
+            }
+        }
+        BOOST_FOREACH(const auto& address, addresses) {
+            bool expected = false;
+            BOOST_FOREACH(const auto& pattern, WildcardPatterns()) {
+                if (pattern != "*") {
+                    expected = expected || MatchWithWildcard(pattern, address);
+                }
+            }
+            CHECK(all.Match(address));
+            CHECK(without_any.Match(address) == expected);
+        }
+        CHECK(!without_any.Match(Address::from_string("9.255.255.255")));
+    }
+
+    void CheckMatches(const std::string& pattern,
+        const std::vector<std::string>& matched, const std::vector<std::string>& unmatched)
+    {
+        const AddressFilter filter = MakeFilter(pattern);
+        BOOST_FOREACH(const auto& address, Addresses(matched)) {
+            CHECK(filter.Match(address));
+        }
+        BOOST_FOREACH(const auto& address, Addresses(unmatched)) {
+            CHECK(!filter.Match(address));
+        }
+    }
+
+    // CIDR表記の境界
+    void TestCidr()
+    {
+        CheckMatches("0.0.0.0/0", {"0.0.0.0", "10.0.0.1", "255.255.255.255"}, {"::1", "2001:db8::1"});
+        CheckMatches("::/0", {"0.0.0.0", "255.255.255.255", "::", "::1", "2001:db8::1"}, {});
+        CheckMatches("10.0.0.1/32", {"10.0.0.1"}, {"10.0.0.0", "10.0.0.2", "11.0.0.1"});
+        CheckMatches("10.0.0.0/8", {"10.0.0.0", "10.255.255.255"}, {"9.255.255.255", "11.0.0.0"});
+        CheckMatches("192.168.0.0/23", {"192.168.0.1", "192.168.1.255"}, {"192.168.2.0", "192.167.255.255"});
+        CheckMatches("2001:db8::1/128", {"2001:db8::1"}, {"2001:db8::", "2001:db8::2"});
+        CheckMatches("2001:db8::/32", {"2001:db8::1", "2001:db8:ffff::1"}, {"2001:db9::1", "10.0.0.1"});
+
+        // 範囲外の長さは、文字列としても一致しない
+        CheckMatches("10.0.0.0/33", {}, {"10.0.0.0", "10.0.0.1"});
+        CheckMatches("2001:db8::/129", {}, {"2001:db8::", "2001:db8::1"});
+        CheckMatches("10.0.0.0/x", {}, {"10.0.0.0"});
+    }
+
+    // IPv4射影アドレスは、元のIPv4アドレスと同じ結果になる
+    void TestV4Mapped()
+    {
+        std::vector<std::string> patterns = WildcardPatterns();
+        patterns.push_back("0.0.0.0/0");
+        patterns.push_back("10.0.0.0/8");
+        patterns.push_back("10.0.0.1/32");
+        patterns.push_back("192.168.0.0/23");
+
+        BOOST_FOREACH(const auto& pattern, patterns) {
+            const AddressFilter filter = MakeFilter(pattern);
+            BOOST_FOREACH(const auto& address, V4Addresses()) {
+                const Address mapped = boost::asio::ip::address_v6::v4_mapped(address.to_v4());
+                CHECK(filter.Match(mapped) == filter.Match(address));
+            }
+        }
+
+        CheckMatches("10.*.*.*", {"::ffff:10.1.2.3"}, {"::ffff:11.1.2.3", "::10.1.2.3"});
+        CheckMatches("192.168.1*", {"::ffff:192.168.10.20"}, {"::ffff:192.169.10.20"});
+        CheckMatches("::ffff:0:0/96", {"10.0.0.1", "::ffff:10.0.0.1"}, {"::1", "::10.0.0.1"});
+    }
+
+}
+
+int main()
+{
+    TestSameAsWildcard();
+    TestCidr();
+    TestV4Mapped();
+    return TEST_RESULT();
+}
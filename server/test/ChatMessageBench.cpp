@@ -0,0 +1,75 @@
+//
+// ChatMessageBench.cpp
+//
+
+#include "Test.hpp"
+#include <sstream>
+#include <list>
+#include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "../ChatMessage.hpp"
+
+// ServerReceiveJSON で受信したチャットメッセージ1件あたりの処理時間
+// 従来の property_tree と boost::format による処理と比べる
+namespace {
+
+    const char* MESSAGES[] = {
+        "{\"body\":\"こんにちは\"}",
+        "{\"body\":\"今日のイベントは21時からです。集合場所は広場の噴水前で！\","
+            "\"color\":\"#ff8800\",\"style\":{\"bold\":true,\"size\":14}}",
+        "{\"private\":[\"1024\",\"2048\"],\"body\":\"\\u3042\\u3068\\u3067\\u884c\\u304f\\ud83d\\ude00\"}",
+        "{\"private\":[77],\"body\":\"\\\"quoted\\\" and\\nmultiline\\ttext\","
+            "\"reply\":{\"id\":\"4096\",\"seq\":\"123456\",\"time\":\"2026-10-19T12:34:56\"}}",
+    };
+
+    const int MESSAGE_COUNT = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+
+    // 変更前の ServerReceiveJSON と同じ処理
+    size_t ParsePropertyTree(const std::string& json, uint32_t id)
+    {
+        using namespace boost::property_tree;
+        using namespace boost::posix_time;
+
+        std::stringstream message_json(json);
+        ptree message_tree;
+        json_parser::read_json(message_json, message_tree);
+
+        std::list<uint32_t> destination_list;
+        auto private_list_tree = message_tree.get_child("private", ptree());
+        BOOST_FOREACH(const auto& user_id, private_list_tree) {
+            destination_list.push_back(user_id.second.get_value<uint32_t>());
+        }
+
+        auto time_string = to_iso_extended_string(second_clock::universal_time());
+        std::string info_json;
+        info_json += "{";
+        info_json += (boost::format("\"id\":\"%d\",") % id).str();
+        info_json += (boost::format("\"time\":\"%s\"") % time_string).str();
+        info_json += "}";
+
+        return destination_list.size() + info_json.size();
+    }
+
+}
+
+int main()
+{
+    std::vector<std::string> messages(MESSAGES, MESSAGES + MESSAGE_COUNT);
+
+    const double tree = test::Measure(20000, [&](int i) {
+        test::sink() += ParsePropertyTree(messages[i % MESSAGE_COUNT], i);
+    });
+
+    ChatMessage chat_message;
+    ChatInfoEnvelope chat_info;
+    const double scanner = test::Measure(200000, [&](int i) {
+        chat_message.Parse(messages[i % MESSAGE_COUNT]);
+        test::sink() += chat_message.private_ids.size() + chat_info.Build(i).size();
+    });
+
+    test::Report("property_tree + boost::format", tree, "ns/msg");
+    test::Report("scanner + envelope", scanner, "ns/msg");
+
+    return TEST_RESULT();
+}
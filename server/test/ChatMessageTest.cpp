@@ -0,0 +1,204 @@
+//
+// ChatMessageTest.cpp
+//
+
+#include "Test.hpp"
+#include <sstream>
+#include <boost/foreach.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "../ChatMessage.hpp"
+
+namespace {
+
+    std::vector<uint32_t> Ids(uint32_t a = 0, uint32_t b = 0, uint32_t c = 0)
+    {
+        std::vector<uint32_t> ids;
+        if (a) ids.push_back(a);
+        if (b) ids.push_back(b);
+        if (c) ids.push_back(c);
+        return ids;
+    }
+
+    bool StartsWith(const std::string& text, const std::string& prefix)
+    {
+        return text.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    bool Parse(const std::string& json, std::vector<uint32_t>* ids = nullptr)
+    {
+        ChatMessage message;
+        bool result = message.Parse(json);
+        if (ids) {
+            *ids = message.private_ids;
+        }
+        return result;
+    }
+
+    // 従来の property_tree による解析と宛先が一致する
+    void CheckSameAsPropertyTree(const std::string& json)
+    {
+        using namespace boost::property_tree;
+        std::stringstream stream(json);
+        ptree tree;
+        read_json(stream, tree);
+
+        std::vector<uint32_t> expected;
+        auto private_list_tree = tree.get_child("private", ptree());
+        BOOST_FOREACH(const auto& user_id, private_list_tree) {
+            expected.push_back(user_id.second.get_value<uint32_t>());
+        }
+
+        std::vector<uint32_t> ids;
+        CHECK(Parse(json, &ids));
+        CHECK(ids == expected);
+    }
+
+    void TestPrivate()
+    {
+        std::vector<uint32_t> ids;
+
+        CHECK(Parse("{\"body\":\"hello\"}", &ids));
+        CHECK(ids.empty());
+
+        CHECK(Parse("{\"private\":[12,\"34\",4294967295],\"body\":\"hi\"}", &ids));
+        CHECK(ids == Ids(12, 34, 4294967295u));
+
+        CHECK(Parse(" { \"private\" : [ ] } ", &ids));
+        CHECK(ids.empty());
+
+        // 配列以外は宛先なし
+        CHECK(Parse("{\"private\":\"12\"}", &ids));
+        CHECK(ids.empty());
+        CHECK(Parse("{\"private\":null}", &ids));
+        CHECK(ids.empty());
+
+        // 重複したキーは最初の値
+        CHECK(Parse("{\"private\":[1],\"private\":[2]}", &ids));
+        CHECK(ids == Ids(1));
+
+        // ユーザーIDとして読めない値
+        CHECK(!Parse("{\"private\":[-1]}"));
+        CHECK(!Parse("{\"private\":[1.5]}"));
+        CHECK(!Parse("{\"private\":[\"abc\"]}"));
+        CHECK(!Parse("{\"private\":[\"\"]}"));
+        CHECK(!Parse("{\"private\":[4294967296]}"));
+        CHECK(!Parse("{\"private\":[1,]}"));
+        CHECK(!Parse("{\"private\":[1}"));
+
+        // 解析用のバッファを使い回しても前回の宛先は残らない
+        ChatMessage message;
+        CHECK(message.Parse("{\"private\":[5]}"));
+        CHECK(message.Parse("{\"body\":\"all\"}"));
+        CHECK(message.private_ids.empty());
+    }
+
+    void TestStrings()
+    {
+        CHECK(Parse("{\"body\":\"\\\" \\\\ \\/ \\b \\f \\n \\r \\t\"}"));
+        CHECK(Parse("{\"body\":\"\\u3042\\u00e9\\uD83D\\uDE00\"}"));
+        CHECK(Parse("{\"b\\u006fdy\":\"escaped key\"}"));
+        CHECK(Parse("{\"body\":\"\xE3\x81\x82\xF0\x9F\x98\x80\"}"));
+
+        CHECK(!Parse("{\"body\":\"\\x41\"}"));
+        CHECK(!Parse("{\"body\":\"\\u12\"}"));
+        CHECK(!Parse("{\"body\":\"\\u12G4\"}"));
+        CHECK(!Parse("{\"body\":\"\\uD83D\"}"));
+        CHECK(!Parse("{\"body\":\"\\uD83D\\u0041\"}"));
+        CHECK(!Parse("{\"body\":\"tab\there\"}"));
+        CHECK(!Parse("{\"body\":\"line\nbreak\"}"));
+        CHECK(!Parse("{\"body\":\"unterminated}"));
+        CHECK(!Parse("{\"body\":\"ends with\\"));
+    }
+
+    // 対象外のフィールドは中身を検証して読み飛ばす
+    void TestIgnoredFields()
+    {
+        std::vector<uint32_t> ids;
+        CHECK(Parse("{\"name\":{\"first\":[1,{\"a\":null}],\"x\":-0.5e+3},"
+            "\"flags\":[true,false,null],\"private\":[7],\"n\":0,\"e\":1E-2}", &ids));
+        CHECK(ids == Ids(7));
+
+        CHECK(Parse("{\"body\":{\"text\":\"nested\"},\"private\":[8]}", &ids));
+        CHECK(ids == Ids(8));
+
+        CHECK(!Parse("{\"x\":tru}"));
+        CHECK(!Parse("{\"x\":nul}"));
+        CHECK(!Parse("{\"x\":01}"));
+        CHECK(!Parse("{\"x\":1.}"));
+        CHECK(!Parse("{\"x\":1e}"));
+        CHECK(!Parse("{\"x\":-}"));
+        CHECK(!Parse("{\"x\":{\"a\"}}"));
+        CHECK(!Parse("{\"x\":{1:2}}"));
+        CHECK(!Parse("{\"x\":[1 2]}"));
+
+        // 入れ子の深さの上限
+        std::string deep(64, '[');
+        deep += std::string(64, ']');
+        CHECK(Parse("{\"x\":" + deep + "}"));
+        std::string too_deep(100, '[');
+        too_deep += std::string(100, ']');
+        CHECK(!Parse("{\"x\":" + too_deep + "}"));
+    }
+
+    void TestDocument()
+    {
+        CHECK(Parse("{}"));
+        CHECK(Parse(" \r\n\t{ } \n"));
+
+        CHECK(!Parse(""));
+        CHECK(!Parse("   "));
+        CHECK(!Parse("[]"));
+        CHECK(!Parse("\"body\""));
+        CHECK(!Parse("{"));
+        CHECK(!Parse("{\"body\":\"a\""));
+        CHECK(!Parse("{\"body\":\"a\",}"));
+        CHECK(!Parse("{,}"));
+        CHECK(!Parse("{\"body\" \"a\"}"));
+        CHECK(!Parse("{body:\"a\"}"));
+        CHECK(!Parse("{\"body\":\"a\"}}"));
+        CHECK(!Parse("{\"body\":\"a\"} x"));
+        CHECK(!Parse(std::string("{\"body\":\"a\"}\0", 14)));
+
+        // 途中で切れた入力はどこで切れても受け付けない
+        const std::string json = "{\"private\":[12,\"34\"],\"body\":\"\\u3042\",\"x\":{\"y\":[true,-1.5e3]}}";
+        for (size_t i = 0; i < json.size(); i++) {
+            CHECK(!Parse(json.substr(0, i)));
+        }
+        CHECK(Parse(json));
+    }
+
+    void TestCompatibility()
+    {
+        CheckSameAsPropertyTree("{\"body\":\"hello\"}");
+        CheckSameAsPropertyTree("{\"private\":[12,\"34\"],\"body\":\"hi\"}");
+        CheckSameAsPropertyTree("{\"private\":[],\"body\":\"\\u3042\\uD83D\\uDE00\",\"color\":\"#ff0000\"}");
+        CheckSameAsPropertyTree("{\"body\":\"x\",\"meta\":{\"reply\":[1,2,{\"a\":null}]},\"private\":[3]}");
+    }
+
+    void TestEnvelope()
+    {
+        CHECK(ChatInfoEnvelope::Format(12, 34, 0) ==
+            "{\"id\":\"12\",\"seq\":\"34\",\"time\":\"1970-01-01T00:00:00\"}");
+
+        ChatInfoEnvelope envelope;
+        const std::string with_sequence = envelope.Build(12, 34);
+        CHECK(StartsWith(with_sequence, "{\"id\":\"12\",\"seq\":\"34\",\"time\":\""));
+        CHECK(Parse(with_sequence));
+
+        const std::string without_sequence = envelope.Build(5);
+        CHECK(StartsWith(without_sequence, "{\"id\":\"5\",\"time\":\""));
+        CHECK(Parse(without_sequence));
+    }
+
+}
+
+int main()
+{
+    TestPrivate();
+    TestStrings();
+    TestIgnoredFields();
+    TestDocument();
+    TestCompatibility();
+    TestEnvelope();
+    return TEST_RESULT();
+}
@@ -0,0 +1,100 @@
+//
+// ConfigWatcherTest.cpp
+//
+
+#include "Test.hpp"
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include "../ConfigWatcher.hpp"
+
+namespace {
+
+    void WriteConfig(const std::string& json)
+    {
+        // サーバーの運用と同じく、別名で書いてから置き換える
+        {
+            std::ofstream ofs("config.json.tmp");
+            ofs << json;
+        }
+        boost::filesystem::rename("config.json.tmp", Config::CONFIG_JSON);
+    }
+
+    // 監視スレッドが読み込み直すまで待つ
+    ConfigPtr WaitReload(const ConfigWatcher& watcher, const ConfigPtr& previous)
+    {
+        for (int i = 0; i < 40; i++) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+            auto config = watcher.config();
+            if (config != previous) {
+                return config;
+            }
+        }
+        return previous;
+    }
+
+}
+
+int main()
+{
+    using namespace boost::filesystem;
+
+    // 設定ファイルはカレントディレクトリから読むので、一時フォルダに移る
+    const path original = current_path();
+    const path directory = temp_directory_path() / unique_path();
+    create_directories(directory);
+    current_path(directory);
+
+    // 起動時に読めなかった場合は既定値
+    {
+        WriteConfig("{\"capacity\":\"20x\",\"server_name\":\"typo\"}");
+        Config config;
+        CHECK(!config.is_valid());
+        CHECK(config.capacity() == 20);
+        CHECK(config.server_name() == "MMO Server");
+    }
+
+    {
+        WriteConfig("{\"capacity\":30,\"server_name\":\"first\"}");
+        ConfigWatcher watcher;
+
+        auto first = watcher.config();
+        CHECK(first->is_valid());
+        CHECK(first->capacity() == 30);
+        std::weak_ptr<const Config> first_weak = first;
+
+        // 監視スレッドが監視を始めるまで待つ
+        boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+
+        WriteConfig("{\"capacity\":40,\"server_name\":\"second\"}");
+        auto second = WaitReload(watcher, first);
+        CHECK(second != first);
+        CHECK(second->capacity() == 40);
+
+        // 取り出した設定は、差し替えられた後も使える
+        CHECK(first->server_name() == "first");
+
+        // 参照がなくなった古い設定は解放される
+        first.reset();
+        CHECK(first_weak.expired());
+
+        // 壊れた設定は無視し、前の設定を使い続ける
+        WriteConfig("{\"capacity\":50,");
+        CHECK(WaitReload(watcher, second) == second);
+        CHECK(watcher.config()->capacity() == 40);
+
+        // 値の型が合わない場合も同じ
+        WriteConfig("{\"capacity\":\"20x\"}");
+        CHECK(WaitReload(watcher, second) == second);
+        WriteConfig("{\"capacity\":50,\"port\":70000}");
+        CHECK(WaitReload(watcher, second) == second);
+        CHECK(watcher.config()->capacity() == 40);
+
+        WriteConfig("{\"capacity\":60}");
+        auto third = WaitReload(watcher, second);
+        CHECK(third->capacity() == 60);
+    }
+    current_path(original);
+    remove_all(directory);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,133 @@
+//
+// InterestGridBench.cpp
+//
+
+#include "Test.hpp"
+#include <random>
+#include <unordered_map>
+#include <boost/foreach.hpp>
+#include "../InterestGrid.hpp"
+#include "../../common/network/Command.hpp"
+#include "../../common/network/PositionCodec.hpp"
+
+// 位置情報の配信量のボットシミュレーション
+// 広さ4000四方のチャンネルを歩き回るボットが毎秒2回移動したときの送信量を比べる
+//  - チャンネル全体: 移動ごとに全員へ ClientUpdatePlayerPosition を送る (従来の方式)
+//  - 関心範囲: Server::UpdatePlayerPosition と同じく配信先を絞り、
+//    ティックごとに送信先ごとの差分符号化したスナップショットを送る
+namespace {
+
+    const int MAP_SIZE = 4000;
+    const int STEP = 40;
+    const int CELL_SIZE = 200;
+    const int INTEREST_RADIUS = 600;
+    const int TICK_RATE = 15;
+    const int MOVES_PER_SECOND = 2;
+    const int SECONDS = 10;
+
+    // コマンドヘッダーと長さ
+    const size_t FRAME_OVERHEAD = 5;
+
+    // 送受信はしないので、関心範囲の登録にだけ使う
+    class BotSession : public network::Session {
+        public:
+            BotSession(boost::asio::io_service& io_service) : Session(io_service) {}
+            void Start() {}
+    };
+
+    struct Result {
+        size_t channel_bytes;
+        size_t grid_bytes;
+    };
+
+    Result Simulate(int user_count)
+    {
+        using namespace network;
+
+        boost::asio::io_service io_service;
+        std::mt19937 random(1);
+        std::uniform_int_distribution<int> coordinate(0, MAP_SIZE);
+        std::uniform_int_distribution<int> step(-STEP, STEP);
+        std::uniform_int_distribution<int> move(0, TICK_RATE - 1);
+
+        std::vector<SessionPtr> sessions;
+        std::vector<PlayerPosition> positions;
+        for (int i = 0; i < user_count; i++) {
+            SessionPtr session = boost::make_shared<BotSession>(io_service);
+            session->set_id(i + 1);
+            session->set_channel(0);
+            sessions.push_back(session);
+            positions.push_back(PlayerPosition(coordinate(random), 0, coordinate(random), 0, 0));
+        }
+
+        InterestGrid grid(CELL_SIZE, INTEREST_RADIUS);
+        std::unordered_map<uint32_t, std::vector<uint32_t>> pending;
+        std::unordered_map<uint32_t, PositionEncoder> encoders;
+
+        // 参加時に関心範囲へ登録する
+        BOOST_FOREACH(const auto& session, sessions) {
+            grid.Update(session, positions[session->id() - 1], nullptr, nullptr, nullptr);
+        }
+
+        Result result = {0, 0};
+        for (int tick = 0; tick < SECONDS * TICK_RATE; tick++) {
+            BOOST_FOREACH(const auto& session, sessions) {
+                if (move(random) >= MOVES_PER_SECOND) {
+                    continue;
+                }
+
+                const uint32_t user_id = session->id();
+                PlayerPosition& pos = positions[user_id - 1];
+                pos.x = std::max(0, std::min(MAP_SIZE, pos.x + step(random)));
+                pos.z = std::max(0, std::min(MAP_SIZE, pos.z + step(random)));
+                pos.theta = static_cast<uint8_t>(random());
+
+                const size_t legacy = ClientUpdatePlayerPosition(user_id,
+                    pos.x, pos.y, pos.z, pos.theta, pos.vy).body().size() + FRAME_OVERHEAD;
+                result.channel_bytes += legacy * (user_count - 1);
+
+                std::vector<SessionPtr> watchers, entered, left;
+                grid.Update(session, pos, &watchers, &entered, &left);
+                watchers.insert(watchers.end(), left.begin(), left.end());
+                BOOST_FOREACH(const auto& other, watchers) {
+                    pending[other->id()].push_back(user_id);
+                }
+                BOOST_FOREACH(const auto& other, entered) {
+                    pending[user_id].push_back(other->id());
+                }
+            }
+
+            BOOST_FOREACH(auto& item, pending) {
+                auto& user_ids = item.second;
+                std::sort(user_ids.begin(), user_ids.end());
+                user_ids.erase(std::unique(user_ids.begin(), user_ids.end()), user_ids.end());
+
+                std::vector<UserPosition> snapshot;
+                BOOST_FOREACH(uint32_t user_id, user_ids) {
+                    snapshot.push_back(UserPosition(user_id, positions[user_id - 1]));
+                }
+                const std::string data = encoders[item.first].Encode(snapshot, tick * 1000 / TICK_RATE);
+                result.grid_bytes += ClientUpdatePlayerPositionSnapshot(data).body().size() + FRAME_OVERHEAD;
+            }
+            pending.clear();
+        }
+
+        result.channel_bytes /= SECONDS;
+        result.grid_bytes /= SECONDS;
+        return result;
+    }
+
+}
+
+int main()
+{
+    const int user_counts[] = {50, 200, 1000};
+    BOOST_FOREACH(int user_count, user_counts) {
+        auto result = Simulate(user_count);
+        std::cout << "users: " << user_count << std::endl;
+        test::Report("channel-wide", result.channel_bytes / 1024, "KB/s");
+        test::Report("interest grid + position codec", result.grid_bytes / 1024, "KB/s");
+    }
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,29 @@
+//
+// LoggerBench.cpp
+//
+
+#include "Test.hpp"
+#include "../../common/Logger.hpp"
+#include "../../common/network/Utils.hpp"
+
+// 無効なレベルのログ呼び出しのコスト
+// LOG_マクロはレベルを確認してから引数を評価するので、パッチの16進文字列化が省かれる
+int main()
+{
+    Logger::SetLevel(LOGGER_LEVEL_INFO);
+    const std::string patch(64, '\x5a');
+
+    test::Report("LOG_DEBUG (disabled)", test::Measure(10000000, [&](int) {
+        LOG_DEBUG(_T("Patch: %s"), unicode::ToTString(network::Utils::ToHexString(patch)));
+    }), "ns/call");
+
+    test::Report("argument evaluation only", test::Measure(1000000, [&](int) {
+        test::sink() += unicode::ToTString(network::Utils::ToHexString(patch)).size();
+    }), "ns/call");
+
+    test::Report("Logger::Debug (argument evaluated)", test::Measure(1000000, [&](int) {
+        Logger::Debug(_T("Patch: %s"), unicode::ToTString(network::Utils::ToHexString(patch)));
+    }), "ns/call");
+
+    return TEST_RESULT();
+}
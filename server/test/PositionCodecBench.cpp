@@ -0,0 +1,114 @@
+//
+// PositionCodecBench.cpp
+//
+
+#include "Test.hpp"
+#include <cmath>
+#include <random>
+#include <boost/foreach.hpp>
+#include "../../common/network/Command.hpp"
+#include "../../common/network/PositionCodec.hpp"
+
+// 位置情報1件あたりの送信量
+// 歩く・向きを変える・立ち止まる・ジャンプするプレイヤーの移動を15Hzで生成し、
+// 従来の ClientUpdatePlayerPosition と、差分符号化したスナップショットを比べる
+namespace {
+
+    const int PLAYER_COUNT = 30;
+    const int TICK_RATE = 15;
+    const int SECONDS = 60;
+
+    // コマンドヘッダーと長さ (従来の方式は1件ごとに、スナップショットはフレームごとにかかる)
+    const size_t FRAME_OVERHEAD = 5;
+
+    struct Walker {
+        double x, z, heading, speed, vy, y;
+    };
+
+    std::vector<std::vector<network::UserPosition>> CreateTrace()
+    {
+        std::mt19937 random(1);
+        std::uniform_real_distribution<double> uniform(0, 1);
+
+        std::vector<Walker> walkers(PLAYER_COUNT);
+        BOOST_FOREACH(auto& walker, walkers) {
+            walker.x = uniform(random) * 2000;
+            walker.z = uniform(random) * 2000;
+            walker.heading = uniform(random) * 2 * M_PI;
+            walker.speed = 0;
+            walker.vy = walker.y = 0;
+        }
+
+        std::vector<std::vector<network::UserPosition>> frames;
+        for (int tick = 0; tick < SECONDS * TICK_RATE; tick++) {
+            std::vector<network::UserPosition> frame;
+            for (int i = 0; i < PLAYER_COUNT; i++) {
+                Walker& walker = walkers[i];
+                if (uniform(random) < 0.02) {
+                    walker.speed = uniform(random) < 0.3 ? 0 : 2 + uniform(random) * 3;
+                }
+                if (uniform(random) < 0.05) {
+                    walker.heading += (uniform(random) - 0.5) * M_PI / 2;
+                }
+                if (walker.y == 0 && uniform(random) < 0.01) {
+                    walker.vy = 6;
+                }
+
+                walker.x += std::cos(walker.heading) * walker.speed;
+                walker.z += std::sin(walker.heading) * walker.speed;
+                walker.y = std::max(0.0, walker.y + walker.vy);
+                walker.vy = walker.y > 0 ? walker.vy - 1 : 0;
+
+                // 立ち止まっているプレイヤーは送らない
+                if (walker.speed == 0 && walker.y == 0) {
+                    continue;
+                }
+
+                PlayerPosition pos(static_cast<int16_t>(walker.x), static_cast<int16_t>(walker.y),
+                    static_cast<int16_t>(walker.z),
+                    static_cast<uint8_t>(walker.heading / (2 * M_PI) * 256),
+                    static_cast<int8_t>(walker.vy));
+                frame.push_back(network::UserPosition(i + 1, pos));
+            }
+            frames.push_back(frame);
+        }
+        return frames;
+    }
+
+}
+
+int main()
+{
+    const auto frames = CreateTrace();
+
+    size_t updates = 0, legacy_bytes = 0, codec_bytes = 0;
+    network::PositionEncoder encoder;
+    for (size_t i = 0; i < frames.size(); i++) {
+        BOOST_FOREACH(const auto& item, frames[i]) {
+            const PlayerPosition& pos = item.second;
+            legacy_bytes += network::ClientUpdatePlayerPosition(item.first,
+                pos.x, pos.y, pos.z, pos.theta, pos.vy).body().size() + FRAME_OVERHEAD;
+        }
+        updates += frames[i].size();
+        codec_bytes += network::ClientUpdatePlayerPositionSnapshot(
+            encoder.Encode(frames[i], i * 1000 / TICK_RATE)).body().size() + FRAME_OVERHEAD;
+    }
+
+    test::Report("ClientUpdatePlayerPosition", static_cast<double>(legacy_bytes) / updates, "bytes/update");
+    test::Report("position snapshot", static_cast<double>(codec_bytes) / updates, "bytes/update");
+
+    std::vector<std::string> encoded;
+    network::PositionEncoder timed_encoder;
+    test::Report("encode", test::Measure(frames.size(), [&](int i) {
+        encoded.push_back(timed_encoder.Encode(frames[i], i));
+    }) / PLAYER_COUNT, "ns/position");
+
+    network::PositionDecoder decoder;
+    std::vector<network::UserPosition> decoded;
+    test::Report("decode", test::Measure(encoded.size(), [&](int i) {
+        decoded.clear();
+        test::sink() += decoder.Decode(encoded[i], &decoded);
+    }) / PLAYER_COUNT, "ns/position");
+
+    return TEST_RESULT();
+}
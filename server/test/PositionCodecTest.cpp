@@ -0,0 +1,173 @@
+//
+// PositionCodecTest.cpp
+//
+
+#include "Test.hpp"
+#include <random>
+#include "../../common/network/PositionCodec.hpp"
+
+using namespace network;
+
+namespace {
+
+    bool Equals(const PlayerPosition& a, const PlayerPosition& b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z && a.theta == b.theta && a.vy == b.vy;
+    }
+
+    bool Equals(const std::vector<UserPosition>& a, const std::vector<UserPosition>& b)
+    {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].first != b[i].first || !Equals(a[i].second, b[i].second)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // ランダムな値でも、キーフレームをまたいでも、送った位置がそのまま復元される
+    void TestRoundTrip()
+    {
+        std::mt19937 random(1);
+        PositionEncoder encoder(8);
+        PositionDecoder decoder;
+
+        for (int frame = 0; frame < 100; frame++) {
+            std::vector<UserPosition> positions;
+            for (uint32_t user_id = 1; user_id <= 20; user_id++) {
+                if (random() % 3 == 0) {
+                    continue;
+                }
+                PlayerPosition pos(static_cast<int16_t>(random()), static_cast<int16_t>(random()),
+                    static_cast<int16_t>(random()), static_cast<uint8_t>(random()), static_cast<int8_t>(random()));
+                positions.push_back(UserPosition(user_id, pos));
+            }
+
+            std::vector<UserPosition> decoded;
+            uint32_t timestamp = 0;
+            CHECK(decoder.Decode(encoder.Encode(positions, frame * 66), &decoded, &timestamp));
+            CHECK(Equals(positions, decoded));
+            CHECK(timestamp == static_cast<uint32_t>(frame * 66));
+        }
+    }
+
+    // 差分が型の幅を超える場合も折り返して復元される
+    void TestWrapAround()
+    {
+        PositionEncoder encoder;
+        PositionDecoder decoder;
+
+        const PlayerPosition values[] = {
+            PlayerPosition(-32768, 32767, 0, 0, -128),
+            PlayerPosition(32767, -32768, -1, 255, 127),
+            PlayerPosition(-32768, 32767, 1, 0, -128),
+        };
+        for (int i = 0; i < 3; i++) {
+            std::vector<UserPosition> positions(1, UserPosition(7, values[i]));
+            std::vector<UserPosition> decoded;
+            CHECK(decoder.Decode(encoder.Encode(positions, 0), &decoded));
+            CHECK(Equals(positions, decoded));
+        }
+    }
+
+    // 変化のないフィールドは送らない
+    void TestUnchanged()
+    {
+        PositionEncoder encoder;
+        std::vector<UserPosition> positions(1, UserPosition(1, PlayerPosition(100, 0, 200, 10, 0)));
+        const std::string first = encoder.Encode(positions, 0);
+        const std::string second = encoder.Encode(positions, 0);
+        CHECK(second.size() < first.size());
+        CHECK(second.size() <= 5);
+    }
+
+    // 途中のフレームが壊れた場合は、次のキーフレームまで何も返さない
+    void TestLoss()
+    {
+        PositionEncoder encoder(4);
+        PositionDecoder decoder;
+
+        std::vector<UserPosition> positions(1, UserPosition(1, PlayerPosition(10, 0, 10, 0, 0)));
+        std::vector<UserPosition> decoded;
+        CHECK(decoder.Decode(encoder.Encode(positions, 0), &decoded));
+        CHECK(decoder.synchronized());
+
+        positions.push_back(UserPosition(2, PlayerPosition(20, 0, 20, 0, 0)));
+        std::string frame = encoder.Encode(positions, 10);
+        frame.resize(frame.size() - 1);
+
+        decoded.clear();
+        CHECK(!decoder.Decode(frame, &decoded));
+        CHECK(decoded.empty());
+        CHECK(!decoder.synchronized());
+
+        // 基準値がずれたままの差分フレームは捨てる
+        for (int i = 0; i < 2; i++) {
+            positions[0].second.x++;
+            decoded.clear();
+            CHECK(!decoder.Decode(encoder.Encode(positions, 20 + i), &decoded));
+            CHECK(decoded.empty());
+        }
+
+        // キーフレームで復帰する
+        positions[0].second.x++;
+        decoded.clear();
+        CHECK(decoder.Decode(encoder.Encode(positions, 30), &decoded));
+        CHECK(decoder.synchronized());
+        CHECK(Equals(positions, decoded));
+    }
+
+    // 送信側をリセットすると、間隔を待たずにキーフレームを送る
+    void TestRequestedKeyframe()
+    {
+        PositionEncoder encoder;
+        PositionDecoder decoder;
+
+        std::vector<UserPosition> positions(1, UserPosition(1, PlayerPosition(10, 0, 10, 0, 0)));
+        std::vector<UserPosition> decoded;
+        CHECK(decoder.Decode(encoder.Encode(positions, 0), &decoded));
+
+        decoded.clear();
+        CHECK(!decoder.Decode(std::string(1, '\0') + "\x7f", &decoded));
+        CHECK(!decoder.synchronized());
+
+        encoder.Reset();
+        positions[0].second.z = 50;
+        decoded.clear();
+        CHECK(decoder.Decode(encoder.Encode(positions, 40), &decoded));
+        CHECK(Equals(positions, decoded));
+    }
+
+    // どこで切れたフレームも受け付けない
+    void TestTruncated()
+    {
+        std::vector<UserPosition> positions;
+        for (uint32_t user_id = 1; user_id <= 5; user_id++) {
+            positions.push_back(UserPosition(user_id * 1000, PlayerPosition(1000, -200, 3000, 64, 5)));
+        }
+
+        PositionEncoder encoder;
+        const std::string frame = encoder.Encode(positions, 12345);
+        for (size_t size = 0; size < frame.size(); size++) {
+            PositionDecoder decoder;
+            std::vector<UserPosition> decoded;
+            CHECK(!decoder.Decode(frame.substr(0, size), &decoded));
+            CHECK(decoded.empty());
+        }
+    }
+
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestWrapAround();
+    TestUnchanged();
+    TestLoss();
+    TestRequestedKeyframe();
+    TestTruncated();
+    return TEST_RESULT();
+}
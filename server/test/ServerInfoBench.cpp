@@ -0,0 +1,45 @@
+//
+// ServerInfoBench.cpp
+//
+
+#include "Test.hpp"
+#include "ServerInfoSample.hpp"
+#include "../../common/network/ServerInfo.hpp"
+
+// ClientReceiveFullServerInfo の符号化と復号のコスト
+// 従来の text_archive と、バイナリ形式を同じ内容で比べる
+int main()
+{
+    const int players[] = {20, 200};
+    for (int i = 0; i < 2; i++) {
+        const auto pt = test::CreateServerInfoTree(players[i]);
+        std::cout << "players: " << players[i] << std::endl;
+
+        std::string text;
+        test::Report("text_archive encode", test::Measure(2000, [&](int) {
+            text = test::ToTextArchive(pt);
+        }) / 1000, "us");
+
+        network::ServerInfo info;
+        info.Load(pt);
+        std::string binary;
+        test::Report("binary encode", test::Measure(20000, [&](int) {
+            binary = info.Serialize();
+        }) / 1000, "us");
+
+        test::Report("text_archive decode", test::Measure(2000, [&](int) {
+            network::ServerInfo decoded;
+            test::sink() += decoded.LoadText(text);
+        }) / 1000, "us");
+
+        test::Report("binary decode", test::Measure(20000, [&](int) {
+            network::ServerInfo decoded;
+            test::sink() += decoded.Parse(binary);
+        }) / 1000, "us");
+
+        test::Report("text_archive size", text.size(), "bytes");
+        test::Report("binary size", binary.size(), "bytes");
+    }
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,74 @@
+//
+// ServerInfoSample.hpp
+//
+
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/property_tree/ptree_serialization.hpp>
+
+namespace test {
+
+    // Server::GetFullStatus と同じ構成の property_tree
+    inline boost::property_tree::ptree CreateServerInfoTree(int player_count)
+    {
+        using boost::property_tree::ptree;
+
+        ptree pt;
+        pt.put("config.server_name", "MMO Server");
+        pt.put("config.server_note", "test note");
+        pt.put("config.stage", "stage:ケロリン町");
+        pt.put("config.capacity", 20);
+        pt.put("version", "1.0.4");
+        pt.put("protocol_version", 4);
+        pt.put("rtt.p50", 30);
+        pt.put("rtt.p90", 60);
+        pt.put("rtt.p99", 120);
+
+        ptree players;
+        for (int i = 0; i < player_count; i++) {
+            ptree player;
+            player.put("name", "player" + std::to_string(i));
+            player.put("model_name", "初音ミク");
+            players.push_back(std::make_pair("", player));
+        }
+        pt.put_child("players", players);
+
+        for (int i = 0; i < 2; i++) {
+            ptree channel;
+            channel.put("name", "チャンネル" + std::to_string(i));
+            channel.put("stage", "stage:ゲキド街");
+            channel.put("capacity", 25);
+
+            ptree warp_point;
+            warp_point.put("position.x", 1.5);
+            warp_point.put("position.y", 0);
+            warp_point.put("position.z", -3);
+            warp_point.put("channel", 1 - i);
+            if (i == 1) {
+                warp_point.put("destination.x", 10);
+                warp_point.put("destination.y", 0);
+                warp_point.put("destination.z", 5);
+            }
+
+            ptree warp_points;
+            warp_points.push_back(std::make_pair("", warp_point));
+            channel.put_child("warp_points", warp_points);
+            pt.put_child(ptree::path_type("channels/ch00" + std::to_string(i), '/'), channel);
+        }
+
+        return pt;
+    }
+
+    inline std::string ToTextArchive(const boost::property_tree::ptree& pt)
+    {
+        std::stringstream stream;
+        boost::archive::text_oarchive archive(stream);
+        archive << pt;
+        return stream.str();
+    }
+
+}
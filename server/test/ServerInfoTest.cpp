@@ -0,0 +1,127 @@
+//
+// ServerInfoTest.cpp
+//
+
+#include "Test.hpp"
+#include "ServerInfoSample.hpp"
+#include "../../common/network/ServerInfo.hpp"
+
+using network::ServerInfo;
+
+namespace {
+
+    bool Equals(const ServerInfo& a, const ServerInfo& b)
+    {
+        if (a.name != b.name || a.note != b.note || a.stage != b.stage || a.capacity != b.capacity ||
+            a.version != b.version || a.protocol_version != b.protocol_version ||
+            a.rtt_50 != b.rtt_50 || a.rtt_90 != b.rtt_90 || a.rtt_99 != b.rtt_99 ||
+            a.channels.size() != b.channels.size() || a.players.size() != b.players.size()) {
+            return false;
+        }
+
+        for (size_t i = 0; i < a.channels.size(); i++) {
+            const auto& x = a.channels[i];
+            const auto& y = b.channels[i];
+            if (x.id != y.id || x.name != y.name || x.stage != y.stage || x.capacity != y.capacity ||
+                x.warp_points.size() != y.warp_points.size()) {
+                return false;
+            }
+            for (size_t j = 0; j < x.warp_points.size(); j++) {
+                const auto& p = x.warp_points[j];
+                const auto& q = y.warp_points[j];
+                if (p.channel != q.channel || p.x != q.x || p.y != q.y || p.z != q.z ||
+                    p.has_destination != q.has_destination ||
+                    p.dest_x != q.dest_x || p.dest_y != q.dest_y || p.dest_z != q.dest_z) {
+                    return false;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < a.players.size(); i++) {
+            if (a.players[i].name != b.players[i].name ||
+                a.players[i].model_name != b.players[i].model_name) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void TestRoundTrip()
+    {
+        ServerInfo info;
+        info.Load(test::CreateServerInfoTree(20));
+        CHECK(info.channels.size() == 2);
+        CHECK(info.players.size() == 20);
+        CHECK(info.channels[1].warp_points[0].has_destination);
+
+        const std::string data = info.Serialize();
+        CHECK(ServerInfo::IsBinary(data));
+
+        ServerInfo decoded;
+        CHECK(decoded.Parse(data));
+        CHECK(Equals(info, decoded));
+        CHECK(decoded.Serialize() == data);
+    }
+
+    void TestTextFallback()
+    {
+        const auto pt = test::CreateServerInfoTree(20);
+        ServerInfo expected;
+        expected.Load(pt);
+
+        const std::string text = test::ToTextArchive(pt);
+        CHECK(!ServerInfo::IsBinary(text));
+
+        ServerInfo decoded;
+        CHECK(decoded.Parse(text));
+        CHECK(Equals(expected, decoded));
+    }
+
+    void TestTruncated()
+    {
+        ServerInfo info;
+        info.Load(test::CreateServerInfoTree(20));
+        const std::string data = info.Serialize();
+
+        // どこで切れても、読み込めたことにはならない
+        for (size_t size = 0; size < data.size(); size++) {
+            ServerInfo decoded;
+            CHECK(!decoded.Parse(data.substr(0, size)));
+        }
+
+        const std::string text = test::ToTextArchive(test::CreateServerInfoTree(20));
+        for (size_t size = 0; size < text.size(); size += 7) {
+            ServerInfo decoded;
+            decoded.Parse(text.substr(0, size));
+        }
+    }
+
+    void TestFormatVersion()
+    {
+        ServerInfo info;
+        info.Load(test::CreateServerInfoTree(1));
+        const std::string data = info.Serialize();
+
+        // 上位バージョンは末尾に項目が追加されたものとして読む
+        std::string newer = data + "extra";
+        newer[5] = static_cast<char>(SERVER_INFO_FORMAT_VERSION + 1);
+        ServerInfo decoded;
+        CHECK(decoded.Parse(newer));
+        CHECK(Equals(info, decoded));
+
+        std::string invalid = data;
+        invalid[4] = invalid[5] = 0;
+        ServerInfo rejected;
+        CHECK(!rejected.Parse(invalid));
+    }
+
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestTextFallback();
+    TestTruncated();
+    TestFormatVersion();
+    return TEST_RESULT();
+}
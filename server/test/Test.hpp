@@ -0,0 +1,63 @@
+//
+// Test.hpp
+//
+
+#pragma once
+
+#include <iostream>
+#include <iomanip>
+#include <stdint.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// テストとベンチマークの簡易ハーネス
+// CHECKが失敗しても続けて実行し、最後にTEST_RESULTで終了コードを返す
+namespace test {
+
+    inline int& failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    // 最適化で計測対象の処理が消えないよう、結果をここに書き込む
+    inline volatile uint64_t& sink()
+    {
+        static volatile uint64_t value = 0;
+        return value;
+    }
+
+    // 1回あたりの処理時間 (ナノ秒)
+    template<class Func>
+    double Measure(int iterations, Func func)
+    {
+        using namespace boost::posix_time;
+        ptime start = microsec_clock::universal_time();
+        for (int i = 0; i < iterations; i++) {
+            func(i);
+        }
+        return (microsec_clock::universal_time() - start).total_microseconds() * 1000.0 / iterations;
+    }
+
+    inline void Report(const char* name, double value, const char* unit)
+    {
+        std::cout << std::left << std::setw(48) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(12) << value << " " << unit << std::endl;
+    }
+
+    inline void Report(const char* name, size_t value, const char* unit)
+    {
+        std::cout << std::left << std::setw(48) << name << std::right
+            << std::setw(12) << value << " " << unit << std::endl;
+    }
+
+}
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #expr ") failed" << std::endl; \
+            test::failures()++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (test::failures() > 0 ? 1 : 0)
@@ -0,0 +1,196 @@
+//
+// TimerWheelTest.cpp
+//
+
+#include "Test.hpp"
+#include <random>
+#include <fstream>
+#include <boost/thread.hpp>
+#include "../TimerWheel.hpp"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+    // /proc/self/status の値 (Linux以外では0)
+    long GetProcessStatus(const std::string& key)
+    {
+        std::ifstream ifs("/proc/self/status");
+        std::string line;
+        while (std::getline(ifs, line)) {
+            if (line.compare(0, key.size() + 1, key + ":") == 0) {
+                return atol(line.c_str() + key.size() + 1);
+            }
+        }
+        return 0;
+    }
+
+    // 確保中のヒープの大きさ (計測できない環境では0)
+    // RSSは解放したメモリを返さないので、先に動いたテストの分が混ざらないようmallocの統計を使う
+    size_t GetHeapUsage()
+    {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+        struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+#else
+        return 0;
+#endif
+    }
+
+    // どの階層に入った場合も、指定したティックちょうどに、期限の順で呼ばれる
+    void TestOrdering()
+    {
+        TimerWheel wheel;
+        std::mt19937 random(1);
+
+        uint64_t now = 0;
+        uint64_t last_fired = 0;
+        int fired = 0, early_or_late = 0, out_of_order = 0;
+
+        for (int i = 0; i < 1000; i++) {
+            now++;
+            wheel.Advance();
+        }
+
+        const int count = 100000;
+        for (int i = 0; i < count; i++) {
+            const uint32_t ticks = random() % (i % 2 ? 30000 : 2000000) + 1;
+            const uint64_t target = now + ticks;
+            wheel.Schedule(ticks, [&, target]() {
+                fired++;
+                if (now != target) {
+                    early_or_late++;
+                }
+                if (target < last_fired) {
+                    out_of_order++;
+                }
+                last_fired = target;
+            });
+
+            if (i % 7 == 0) {
+                now++;
+                wheel.Advance();
+            }
+        }
+
+        while (wheel.size() > 0) {
+            now++;
+            wheel.Advance();
+        }
+
+        CHECK(fired == count);
+        CHECK(early_or_late == 0);
+        CHECK(out_of_order == 0);
+    }
+
+    // 同じティックに同じ遅延で登録したものは、登録した順に呼ばれる
+    void TestSameTick()
+    {
+        TimerWheel wheel;
+        std::vector<int> order;
+        for (int i = 0; i < 5; i++) {
+            wheel.Schedule(300, [&order, i]() { order.push_back(i); });
+        }
+        for (int i = 0; i < 300; i++) {
+            wheel.Advance();
+        }
+
+        CHECK(order.size() == 5);
+        for (size_t i = 0; i < order.size(); i++) {
+            CHECK(order[i] == static_cast<int>(i));
+        }
+    }
+
+    void TestCancel()
+    {
+        TimerWheel wheel;
+        int fired = 0;
+
+        auto cancelled = wheel.Schedule(10, [&]() { fired += 100; });
+        auto kept = wheel.Schedule(10, [&]() { fired++; });
+        CHECK(wheel.Cancel(cancelled));
+        CHECK(!wheel.Cancel(cancelled));
+        CHECK(wheel.size() == 1);
+
+        for (int i = 0; i < 10; i++) {
+            wheel.Advance();
+        }
+        CHECK(fired == 1);
+        CHECK(!wheel.Cancel(kept));
+        CHECK(wheel.size() == 0);
+    }
+
+    // 0ティックは次のティックに、コールバックの中からも登録できる
+    void TestReschedule()
+    {
+        TimerWheel wheel;
+        int fired = 0;
+        std::function<void()> repeat = [&]() {
+            if (++fired < 3) {
+                wheel.Schedule(0, repeat);
+            }
+        };
+        wheel.Schedule(0, repeat);
+
+        for (int i = 0; i < 5; i++) {
+            wheel.Advance();
+        }
+        CHECK(fired == 3);
+    }
+
+    // 10万件のログアウトを30分後の削除として登録しても、スレッドは増えず、
+    // 1件あたりのメモリはリストとハッシュの節点程度に収まる
+    void TestLogouts()
+    {
+        const int count = 100000;
+        const uint32_t delay = 30 * 60 * 15;
+        const size_t max_bytes_per_timer = 256;
+
+        std::vector<TimerWheel::TimerId> ids;
+        ids.reserve(count);
+
+        const long threads = GetProcessStatus("Threads");
+        const size_t heap = GetHeapUsage();
+
+        TimerWheel wheel;
+        int removed = 0;
+        for (int i = 0; i < count; i++) {
+            ids.push_back(wheel.Schedule(delay, [&removed]() { removed++; }));
+        }
+
+        test::Report("threads", static_cast<size_t>(GetProcessStatus("Threads")), "");
+        CHECK(GetProcessStatus("Threads") == threads);
+
+        if (heap > 0) {
+            const size_t bytes_per_timer = (GetHeapUsage() - heap) / count;
+            test::Report("memory per timer", bytes_per_timer, "bytes");
+            CHECK(bytes_per_timer > 0);
+            CHECK(bytes_per_timer <= max_bytes_per_timer);
+        }
+
+        // 半分は再ログインで取り消す
+        for (int i = 0; i < count; i += 2) {
+            CHECK(wheel.Cancel(ids[i]));
+        }
+
+        test::Report("advance 30 minutes", test::Measure(delay, [&](int) {
+            wheel.Advance();
+        }), "ns/tick");
+
+        CHECK(removed == count / 2);
+        CHECK(wheel.size() == 0);
+    }
+
+}
+
+int main()
+{
+    TestOrdering();
+    TestSameTick();
+    TestCancel();
+    TestReschedule();
+    TestLogouts();
+    return TEST_RESULT();
+}